@@ -0,0 +1,1385 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <future>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "cold_comments.h"
+#include "comment_batch.h"
+#include "compact.h"
+#include "factories.h"
+#include "hash_join.h"
+#include "hot_cold.h"
+#include "latency_histogram.h"
+#include "left_right.h"
+#include "models.h"
+#include "observer_ptr.h"
+#include "ordered_output.h"
+#include "ownership_advisor.h"
+#include "parallel.h"
+#include "prefetch.h"
+#include "query.h"
+#include "seqlock.h"
+#include "skip_list.h"
+#include "slab_resource.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "text_store.h"
+#include "tiered_store.h"
+#include "trace.h"
+#include "workload.h"
+#include "workload_backends.h"
+
+/*
+ *  Benchmarks for the helper headers.
+ *  Build in Release mode and run:
+ *      smartPointerBench               runs every benchmark with the default sizes
+ *      smartPointerBench <name> [n]    runs one benchmark, n overrides its size
+ */
+
+using Clock = std::chrono::steady_clock;
+
+double secondsSince(Clock::time_point start) {
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Stops the optimizer from removing a computation whose result is never used.
+void keep(size_t value) {
+    static std::atomic<size_t> sink{0};
+    sink.store(value, std::memory_order_relaxed);
+}
+
+void printRate(const std::string& label, size_t items, double seconds, const std::string& unit = "rows") {
+    std::cout << "  " << label << ": " << items / seconds / 1e6 << " M " << unit << "/s (" << seconds * 1e3 << " ms)"
+              << std::endl;
+}
+
+
+// Hash join of Posts (probe, key authorId) with Persons (build, key id).
+// Compared against one std::unordered_map lookup per Post, which is what rendering a feed does today.
+void benchHashJoin(size_t maxRows) {
+    std::mt19937_64 random(42);
+    for (size_t persons = 1000000; persons <= maxRows; persons *= 10) {
+        size_t posts = persons;
+        std::vector<size_t> personIds(persons);
+        std::iota(personIds.begin(), personIds.end(), size_t{0});
+        std::shuffle(personIds.begin(), personIds.end(), random);
+        std::vector<size_t> authorIds(posts);
+        std::uniform_int_distribution<size_t> anyPerson(0, persons - 1);
+        for (auto& authorId : authorIds) {
+            authorId = anyPerson(random);
+        }
+        auto identity = [](size_t id) { return id; };
+
+        std::cout << "hash join, " << persons << " persons x " << posts << " posts" << std::endl;
+        HashJoin join;
+        auto start = Clock::now();
+        join.build(personIds.begin(), personIds.end(), identity);
+        printRate("radix build", persons, secondsSince(start));
+
+        start = Clock::now();
+        auto matches = join.probe(authorIds.begin(), authorIds.end(), identity);
+        printRate("batched probe", posts, secondsSince(start));
+        keep(matches.size());
+
+        start = Clock::now();
+        std::unordered_map<size_t, size_t> byId;
+        byId.reserve(persons);
+        for (size_t row = 0; row < persons; ++row) {
+            byId.emplace(personIds[row], row);
+        }
+        printRate("unordered_map build", persons, secondsSince(start));
+
+        start = Clock::now();
+        size_t found = 0;
+        for (auto authorId : authorIds) {
+            found += byId.find(authorId) != byId.end();
+        }
+        printRate("unordered_map probe", posts, secondsSince(start));
+        keep(found);
+    }
+}
+
+
+// Filtering Persons: chained lambdas (one pass per condition) against one fused query,
+// on a vector of Persons and on the columnar PersonTable.
+void benchQuery(size_t rows) {
+    using namespace query;
+    std::mt19937_64 random(7);
+    std::uniform_int_distribution<size_t> anyAge(0, 99);
+    const char* firstNames[] = {"John", "Jane", "Mona", "Jack", "Anna", "Erik"};
+    std::vector<Person> people;
+    PersonTable table;
+    people.reserve(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        people.push_back(Person{std::string(firstNames[i % 6]) + " " + std::to_string(i), "Street", anyAge(random), i});
+        table.push_back(people.back());
+    }
+    std::cout << "query, " << rows << " persons" << std::endl;
+
+    auto start = Clock::now();
+    std::vector<const Person*> older;
+    for (const auto& person : people) {
+        if (person.age > 30) {
+            older.push_back(&person);
+        }
+    }
+    std::vector<const Person*> olderJs;
+    for (const Person* person : older) {
+        if (person->name.compare(0, 1, "J") == 0) {
+            olderJs.push_back(person);
+        }
+    }
+    printRate("chained lambdas, age and name", rows, secondsSince(start));
+    keep(olderJs.size());
+
+    auto olderJsQuery = where(age > 30 && name.startsWith("J"));
+    start = Clock::now();
+    keep(olderJsQuery.rows(people.begin(), people.end()).size());
+    printRate("fused query, age and name", rows, secondsSince(start));
+
+    start = Clock::now();
+    keep(olderJsQuery.rows(table).size());
+    printRate("fused query on PersonTable, age and name", rows, secondsSince(start));
+
+    auto middleAged = where(age >= 30 && age < 60);
+    start = Clock::now();
+    size_t found = 0;
+    for (const auto& person : people) {
+        if (person.age >= 30 && person.age < 60) {
+            ++found;
+        }
+    }
+    printRate("branchy loop, age range", rows, secondsSince(start));
+    keep(found);
+
+    start = Clock::now();
+    keep(middleAged.rows(people.begin(), people.end()).size());
+    printRate("fused query, age range", rows, secondsSince(start));
+
+    start = Clock::now();
+    keep(middleAged.count(table));
+    printRate("fused query on PersonTable (SIMD), age range", rows, secondsSince(start));
+}
+
+
+// Churn of Person, Comment and Post objects (a window of live objects, one replaced per step),
+// created with std::make_shared (glibc malloc) or with makeSharedIn on a memory resource.
+template<typename Make>
+double churn(size_t steps, Make make) {
+    std::mt19937_64 random(3);
+    std::vector<std::shared_ptr<void>> live(10000);
+    auto start = Clock::now();
+    for (size_t step = 0; step < steps; ++step) {
+        size_t slot = random() % live.size();
+        live[slot] = make(step % 3);
+    }
+    live.clear();
+    return secondsSince(start);
+}
+
+// Producer creates objects, consumer destroys them: every free is a free from another thread
+template<typename Make>
+double handOver(size_t steps, Make make) {
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::vector<std::vector<std::shared_ptr<void>>> queue;
+    bool done = false;
+    auto start = Clock::now();
+    std::thread consumer([&] {
+        for (;;) {
+            std::vector<std::vector<std::shared_ptr<void>>> batches;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                ready.wait(lock, [&] { return done || !queue.empty(); });
+                if (queue.empty() && done) {
+                    return;
+                }
+                batches.swap(queue);
+            }
+            batches.clear(); // The objects die on this thread
+        }
+    });
+    std::vector<std::shared_ptr<void>> batch;
+    for (size_t step = 0; step < steps; ++step) {
+        batch.push_back(make(step % 3));
+        if (batch.size() == 1000) {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(batch));
+            batch.clear();
+            ready.notify_one();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        queue.push_back(std::move(batch));
+        done = true;
+        ready.notify_one();
+    }
+    consumer.join();
+    return secondsSince(start);
+}
+
+// Slab allocator against glibc malloc and the standard pool resource, same workloads
+void benchSlab(size_t steps) {
+    auto makeStd = [](size_t kind) -> std::shared_ptr<void> {
+        switch (kind) {
+            case 0: return std::make_shared<Person>();
+            case 1: return std::make_shared<Comment>();
+            default: return std::make_shared<Post>();
+        }
+    };
+    auto makeIn = [](std::pmr::memory_resource& resource) {
+        return [&resource](size_t kind) -> std::shared_ptr<void> {
+            switch (kind) {
+                case 0: return makeSharedIn<Person>(resource);
+                case 1: return makeSharedIn<Comment>(resource);
+                default: return makeSharedIn<Post>(resource);
+            }
+        };
+    };
+
+    std::cout << "allocators, " << steps << " make_shared of Person, Comment and Post" << std::endl;
+    printRate("churn, std::make_shared (glibc malloc)", steps, churn(steps, makeStd), "objects");
+    {
+        SlabResource slab;
+        printRate("churn, SlabResource", steps, churn(steps, makeIn(slab)), "objects");
+    }
+    {
+        std::pmr::synchronized_pool_resource pool;
+        printRate("churn, std::pmr::synchronized_pool_resource", steps, churn(steps, makeIn(pool)), "objects");
+    }
+    {
+        // Peak then drop: the pages of the slab go back to the operating system
+        SlabResource slab;
+        std::vector<std::shared_ptr<void>> peak;
+        for (size_t i = 0; i < steps / 10; ++i) {
+            peak.push_back(makeIn(slab)(i % 3));
+        }
+        peak.clear();
+        auto stats = slab.stats();
+        std::cout << "  SlabResource after a peak of " << steps / 10 << " objects, pages mapped: " << stats.pagesMapped
+                  << ", returned: " << stats.pagesReturned << std::endl;
+    }
+    printRate("cross thread, std::make_shared (glibc malloc)", steps, handOver(steps, makeStd), "objects");
+    {
+        SlabResource slab;
+        printRate("cross thread, SlabResource", steps, handOver(steps, makeIn(slab)), "objects");
+        auto stats = slab.stats();
+        std::cout << "  SlabResource pages mapped: " << stats.pagesMapped << ", returned: " << stats.pagesReturned
+                  << ", remote frees: " << stats.remoteFrees << std::endl;
+    }
+    {
+        std::pmr::synchronized_pool_resource pool;
+        printRate("cross thread, std::pmr::synchronized_pool_resource", steps, handOver(steps, makeIn(pool)), "objects");
+    }
+}
+
+
+// Same members as Person, without the pooled operator new
+struct PlainPerson {
+    std::string name{};
+    std::string address{};
+    size_t age{};
+    size_t id{};
+};
+
+// Churn of std::make_unique, once for Person (class operator new, TypePool) and once for a plain struct
+template<typename T>
+double uniqueChurn(size_t steps) {
+    std::mt19937_64 random(5);
+    std::vector<std::unique_ptr<T>> live(10000);
+    auto start = Clock::now();
+    for (size_t step = 0; step < steps; ++step) {
+        live[random() % live.size()] = std::make_unique<T>();
+    }
+    live.clear();
+    return secondsSince(start);
+}
+
+void benchPooledNew(size_t steps) {
+    std::cout << "class operator new, " << steps << " std::make_unique" << std::endl;
+    printRate("PlainPerson (global operator new)", steps, uniqueChurn<PlainPerson>(steps), "objects");
+    printRate("Person (POOLED_NEW)", steps, uniqueChurn<Person>(steps), "objects");
+}
+
+
+// Sum of all ages: whole Person records against the hot part of a SplitVector<Person>
+void benchHotCold(size_t rows) {
+    std::vector<Person> people;
+    std::vector<std::unique_ptr<Person>> owned;
+    SplitVector<Person> split;
+    people.reserve(rows);
+    split.reserve(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        Person person{"Person " + std::to_string(i), "Address " + std::to_string(i), i % 90, i};
+        people.push_back(person);
+        owned.push_back(std::make_unique<Person>(person));
+        split.push_back(person);
+    }
+    std::cout << "age only scan, " << rows << " persons" << std::endl;
+
+    auto scan = [rows](const std::string& label, auto sum) {
+        sum(); // Warm up
+        auto start = Clock::now();
+        size_t total = 0;
+        for (int repeat = 0; repeat < 10; ++repeat) {
+            total += sum();
+        }
+        printRate(label, rows * 10, secondsSince(start));
+        keep(total);
+    };
+    scan("std::vector<Person>", [&] {
+        size_t total = 0;
+        for (const auto& person : people) {
+            total += person.age;
+        }
+        return total;
+    });
+    scan("std::vector<std::unique_ptr<Person>>", [&] {
+        size_t total = 0;
+        for (const auto& person : owned) {
+            total += person->age;
+        }
+        return total;
+    });
+    scan("SplitVector<Person> through PersonRef", [&] {
+        size_t total = 0;
+        for (auto person : split) {
+            total += person.age;
+        }
+        return total;
+    });
+    scan("SplitVector<Person>::hot()", [&] {
+        size_t total = 0;
+        for (const auto& hot : split.hot()) {
+            total += hot.age;
+        }
+        return total;
+    });
+}
+
+
+// Scans over a shuffled std::vector<std::shared_ptr<Person>>, much larger than the last level cache.
+// A loop that only adds ages already overlaps its misses out of order; a loop with some work per
+// element (here hashing the name) cannot look far enough ahead, which is where prefetching pays off.
+void benchPrefetch(size_t rows) {
+    std::vector<std::shared_ptr<Person>> people;
+    people.reserve(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        people.push_back(std::make_shared<Person>(Person{"Person " + std::to_string(i), "", i % 90, i}));
+    }
+    std::shuffle(people.begin(), people.end(), std::mt19937_64(11)); // Neighbours in the vector are far apart on the heap
+    std::cout << "pointer chasing scan, " << rows << " shared_ptr<Person> (about "
+              << rows * (sizeof(Person) + 16) / (1 << 20) << " MB of Persons)" << std::endl;
+
+    auto ageOnly = [](const Person& person) { return person.age; };
+    auto hashName = [](const Person& person) { return std::hash<std::string>()(person.name) + person.age; };
+    auto run = [&](const std::string& work, auto body) {
+        auto start = Clock::now();
+        size_t total = 0;
+        for (const auto& person : people) {
+            total += body(*person);
+        }
+        printRate(work + ", plain loop", rows, secondsSince(start));
+        keep(total);
+
+        for (size_t distance : {4, 16, 64}) {
+            start = Clock::now();
+            total = 0;
+            for (const auto& person : prefetched(people, distance)) {
+                total += body(*person);
+            }
+            printRate(work + ", prefetched, distance " + std::to_string(distance), rows, secondsSince(start));
+            keep(total);
+        }
+
+        auto adaptive = prefetched(people);
+        start = Clock::now();
+        total = 0;
+        for (const auto& person : adaptive) {
+            total += body(*person);
+        }
+        printRate(work + ", prefetched, adaptive (ended at " + std::to_string(adaptive.distance()) + ")", rows,
+                  secondsSince(start));
+        keep(total);
+    };
+    run("age", ageOnly);
+    run("hash of name", hashName);
+}
+
+
+// Age scan over a std::vector<std::unique_ptr<Person>> after churn, before and after compact()
+void benchCompact(size_t rows) {
+    std::mt19937_64 random(13);
+    std::vector<std::unique_ptr<Person>> people(rows);
+    std::vector<std::unique_ptr<Person>> others(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        people[i] = std::make_unique<Person>(Person{"", "", i % 90, i});
+        others[i] = std::make_unique<Person>();
+    }
+    // Churn: free and allocate in random order, so neighbours in the vector end up far apart in memory
+    for (size_t step = 0; step < 4 * rows; ++step) {
+        size_t i = random() % rows;
+        if (step % 2 == 0) {
+            others[random() % rows].reset();
+            people[i] = std::make_unique<Person>(Person{"", "", i % 90, i});
+        } else {
+            others[random() % rows] = std::make_unique<Person>();
+        }
+    }
+    std::cout << "compaction, " << rows << " unique_ptr<Person> after churn" << std::endl;
+
+    auto scan = [&](const std::string& label) {
+        auto start = Clock::now();
+        size_t total = 0;
+        for (int repeat = 0; repeat < 5; ++repeat) {
+            for (const auto& person : people) {
+                total += person->age;
+            }
+        }
+        printRate(label, rows * 5, secondsSince(start));
+        keep(total);
+    };
+    scan("scan before compact()");
+    auto start = Clock::now();
+    compact(people);
+    printRate("compact()", rows, secondsSince(start), "objects");
+    scan("scan after compact()");
+}
+
+// Sum of ages through raw pointers and through observer_ptr, the same loop otherwise
+void benchObserver(size_t rows) {
+    std::vector<std::unique_ptr<Person>> owners;
+    owners.reserve(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        owners.push_back(std::make_unique<Person>(Person{"", "", i % 90, i}));
+    }
+    std::vector<Person*> raw;
+    std::vector<observer_ptr<Person>> observers;
+    for (const auto& owner : owners) {
+        raw.push_back(owner.get());
+        observers.push_back(make_observer(owner));
+    }
+    std::cout << "observer_ptr, " << rows << " Persons, checked: " << observer_ptr<Person>::Checked
+              << ", sizeof " << sizeof(observer_ptr<Person>) << " (raw " << sizeof(Person*) << ")" << std::endl;
+
+    auto start = Clock::now();
+    size_t total = 0;
+    for (int repeat = 0; repeat < 10; ++repeat) {
+        for (Person* person : raw) {
+            total += person->age;
+        }
+    }
+    printRate("raw pointer", rows * 10, secondsSince(start));
+    keep(total);
+
+    start = Clock::now();
+    total = 0;
+    for (int repeat = 0; repeat < 10; ++repeat) {
+        for (const auto& person : observers) {
+            total += person->age;
+        }
+    }
+    printRate("observer_ptr", rows * 10, secondsSince(start));
+    keep(total);
+}
+
+// Read-mostly Post::comments: LeftRight against std::shared_mutex and an atomically swapped shared_ptr (RCU style).
+// Every thread does `operations` / threads operations, one in WriteEvery is a write.
+void benchLeftRight(size_t operations) {
+    constexpr size_t WriteEvery = 100;
+    const size_t threads = std::max<size_t>(4, defaultThreadCount());
+    auto comment = std::make_shared<Comment>(Comment{"I like it.", {}});
+    Post initial{"Holiday", std::vector<std::shared_ptr<Comment>>(16, comment), 1};
+    auto change = [&](Post& post) {
+        post.comments.push_back(comment);
+        if (post.comments.size() > 32) {
+            post.comments.erase(post.comments.begin());
+        }
+    };
+    auto look = [](const Post& post) { return post.comments.size() + post.comments.back()->text.size(); };
+    std::cout << "read-mostly Post, " << operations << " operations on " << threads << " threads, 1 in "
+              << WriteEvery << " writes" << std::endl;
+
+    auto run = [&](const std::string& label, const std::function<size_t()>& read,
+                   const std::function<void()>& write) {
+        std::atomic<size_t> total{0};
+        auto start = Clock::now();
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&] {
+                size_t sum = 0;
+                for (size_t i = 0; i < operations / threads; ++i) {
+                    if (i % WriteEvery == WriteEvery - 1) {
+                        write();
+                    } else {
+                        sum += read();
+                    }
+                }
+                total += sum;
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        printRate(label, operations, secondsSince(start), "operations");
+        keep(total);
+    };
+
+    LeftRight<Post> leftRight(initial);
+    run("LeftRight", [&] { return leftRight.read(look); }, [&] { leftRight.write(change); });
+
+    std::shared_mutex sharedMutex;
+    Post locked = initial;
+    run("std::shared_mutex", [&] {
+        std::shared_lock<std::shared_mutex> lock(sharedMutex);
+        return look(locked);
+    }, [&] {
+        std::unique_lock<std::shared_mutex> lock(sharedMutex);
+        change(locked);
+    });
+
+    // Copy, change, publish; readers keep the version they loaded alive
+    std::mutex writeMutex;
+    auto current = std::make_shared<const Post>(initial);
+    run("atomic shared_ptr (RCU)", [&] { return look(*std::atomic_load(&current)); }, [&] {
+        std::lock_guard<std::mutex> lock(writeMutex);
+        auto next = std::make_shared<Post>(*std::atomic_load(&current));
+        change(*next);
+        std::atomic_store(&current, std::shared_ptr<const Post>(std::move(next)));
+    });
+}
+
+// age and id of one Person read and updated by all threads, one operation in WriteEvery is a write.
+// Writes keep age == id, a read that sees them differ is torn.
+void benchSeqlock(size_t operations) {
+    constexpr size_t WriteEvery = 10;
+    const size_t threads = std::max<size_t>(4, defaultThreadCount());
+    std::cout << "Person scalars, " << operations << " operations on " << threads << " threads, 1 in "
+              << WriteEvery << " writes" << std::endl;
+
+    auto run = [&](const std::string& label, const std::function<PersonHot()>& read,
+                   const std::function<void(const PersonHot&)>& write) {
+        std::atomic<size_t> torn{0};
+        auto start = Clock::now();
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t] {
+                size_t bad = 0;
+                for (size_t i = 0; i < operations / threads; ++i) {
+                    if (i % WriteEvery == WriteEvery - 1) {
+                        write(PersonHot{t * operations + i, t * operations + i});
+                    } else {
+                        PersonHot value = read();
+                        bad += value.age != value.id;
+                    }
+                }
+                torn += bad;
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        printRate(label + " (" + std::to_string(torn.load()) + " torn)", operations, secondsSince(start), "operations");
+    };
+
+    Seqlock<PersonHot> seqlock;
+    run("Seqlock", [&] { return seqlock.load(); }, [&](const PersonHot& value) { seqlock.store(value); });
+
+    std::mutex mutex;
+    PersonHot guarded{};
+    run("std::mutex", [&] {
+        std::lock_guard<std::mutex> lock(mutex);
+        return guarded;
+    }, [&](const PersonHot& value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        guarded = value;
+    });
+
+    std::shared_mutex sharedMutex;
+    PersonHot shared{};
+    run("std::shared_mutex", [&] {
+        std::shared_lock<std::shared_mutex> lock(sharedMutex);
+        return shared;
+    }, [&](const PersonHot& value) {
+        std::unique_lock<std::shared_mutex> lock(sharedMutex);
+        shared = value;
+    });
+}
+
+// Age index under concurrent inserts, erases and range queries, then bulk loading
+void benchSkipList(size_t operations) {
+    const size_t people = 1 << 16;
+    std::vector<std::shared_ptr<Person>> persons;
+    for (size_t i = 0; i < people; ++i) {
+        persons.push_back(std::make_shared<Person>(Person{"", "", i % 90, i}));
+    }
+    std::cout << "skip list on (age, id), " << operations << " operations: 50% insert, 40% range of one age "
+              << "(first 32 entries), 10% erase" << std::endl;
+
+    for (size_t threads : {size_t{1}, size_t{2}, size_t{4}, size_t{8}}) {
+        PersonAgeIndex index;
+        for (size_t i = 0; i < people; i += 2) {
+            index.insert(ageKey(*persons[i]), persons[i]);
+        }
+        std::atomic<size_t> found{0};
+        auto start = Clock::now();
+        parallelSlices(operations, threads, [&](size_t t, size_t begin, size_t end) {
+            std::mt19937_64 random(t + 1);
+            size_t seen = 0;
+            for (size_t i = begin; i < end; ++i) {
+                const auto& person = persons[random() % people];
+                size_t kind = i % 10;
+                if (kind < 5) {
+                    index.insert(ageKey(*person), person);
+                } else if (kind < 9) {
+                    size_t taken = 0;
+                    for (const auto& entry : index.range(AgeKey{person->age, 0}, AgeKey{person->age + 1, 0})) {
+                        seen += entry.value->id & 1;
+                        if (++taken == 32) {
+                            break;
+                        }
+                    }
+                } else {
+                    index.erase(ageKey(*person));
+                }
+            }
+            found += seen;
+        });
+        printRate(std::to_string(threads) + " threads", operations, secondsSince(start), "operations");
+        keep(found);
+    }
+
+    std::vector<std::pair<AgeKey, std::shared_ptr<Person>>> batch;
+    for (const auto& person : persons) {
+        batch.emplace_back(ageKey(*person), person);
+    }
+    std::shuffle(batch.begin(), batch.end(), std::mt19937_64(3));
+    {
+        PersonAgeIndex index;
+        auto start = Clock::now();
+        for (const auto& item : batch) {
+            index.insert(item.first, item.second);
+        }
+        printRate("insert one by one, random order", batch.size(), secondsSince(start));
+    }
+    for (size_t threads : {size_t{1}, size_t{4}}) {
+        PersonAgeIndex index;
+        auto start = Clock::now();
+        size_t inserted = index.insert(batch.begin(), batch.end(), threads);
+        printRate("bulk insert, " + std::to_string(threads) + " threads", inserted, secondsSince(start));
+    }
+}
+
+// Comments added to Posts in batches of BatchSize: make_shared + push_back against appendComments
+void benchAppendComments(size_t comments) {
+    constexpr size_t BatchSize = 16;
+    std::vector<CommentInit> texts(BatchSize, CommentInit{"I like it."});
+    const size_t posts = comments / BatchSize;
+    std::cout << "comments, " << posts * BatchSize << " in batches of " << BatchSize << std::endl;
+
+    auto run = [&](const std::string& label, const std::function<void(const std::shared_ptr<Post>&)>& add) {
+        std::vector<std::shared_ptr<Post>> all;
+        all.reserve(posts);
+        auto start = Clock::now();
+        for (size_t p = 0; p < posts; ++p) {
+            auto post = std::make_shared<Post>();
+            add(post);
+            all.push_back(std::move(post));
+        }
+        printRate(label, posts * BatchSize, secondsSince(start), "comments");
+        start = Clock::now();
+        all.clear();
+        printRate(label + ", destruction", posts * BatchSize, secondsSince(start), "comments");
+    };
+
+    run("make_shared + push_back", [&](const std::shared_ptr<Post>& post) {
+        for (const auto& init : texts) {
+            auto comment = std::make_shared<Comment>();
+            comment->text = init.text;
+            comment->post = post;
+            post->comments.push_back(comment);
+        }
+    });
+    run("appendComments", [&](const std::shared_ptr<Post>& post) { appendComments(post, texts.begin(), texts.end()); });
+}
+
+// Comment texts from a small vocabulary (plus some unique ones): separate std::strings against interned SharedText
+void benchTextStore(size_t comments) {
+    const size_t threads = std::max<size_t>(4, defaultThreadCount());
+    std::vector<std::string> vocabulary;
+    for (size_t i = 0; i < 500; ++i) {
+        vocabulary.push_back("Beautiful shot, I like it! #" + std::to_string(i));
+    }
+    std::mt19937_64 random(5);
+    std::vector<std::string> texts(comments);
+    for (size_t i = 0; i < comments; ++i) {
+        texts[i] = random() % 10 == 0 ? "A comment nobody else wrote, number " + std::to_string(i)
+                                       : vocabulary[random() % vocabulary.size()];
+    }
+    std::cout << "comment text, " << comments << " comments, " << vocabulary.size() << " common texts + 10% unique"
+              << std::endl;
+
+    for (size_t t : {size_t{1}, threads}) {
+        std::vector<std::string> copies(comments);
+        auto start = Clock::now();
+        parallelSlices(comments, t, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                copies[i] = texts[i];
+            }
+        });
+        printRate("std::string copies, " + std::to_string(t) + " threads", comments, secondsSince(start), "comments");
+        size_t bytes = 0;
+        for (const auto& copy : copies) {
+            bytes += copy.capacity() > 15 ? copy.capacity() + 1 : 0;
+        }
+        std::cout << "    heap bytes for text: " << bytes << std::endl;
+    }
+    for (size_t t : {size_t{1}, threads}) {
+        TextStore store;
+        std::vector<SharedText> shared(comments);
+        auto start = Clock::now();
+        parallelSlices(comments, t, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                shared[i] = store.intern(texts[i]);
+            }
+        });
+        printRate("TextStore::intern, " + std::to_string(t) + " threads", comments, secondsSince(start), "comments");
+        TextStoreStats stats = store.stats();
+        std::cout << "    unique texts: " << stats.uniqueTexts << ", stored bytes: " << stats.storedBytes
+                  << ", referenced bytes: " << stats.referencedBytes << ", dedup ratio: " << stats.dedupRatio()
+                  << ", hits: " << stats.hits << " of " << stats.interned << std::endl;
+        start = Clock::now();
+        shared.clear();
+        printRate("release", comments, secondsSince(start), "comments");
+    }
+}
+
+// Comment text from a word list: archived into compressed blocks, then read back at random and post by post
+void benchColdComments(size_t comments) {
+    std::mt19937_64 random(11);
+    std::vector<std::string> texts(comments);
+    size_t rawBytes = 0;
+    for (auto& text : texts) {
+        text = workload::sentence(random, 3, 12);
+        rawBytes += text.size();
+    }
+    std::cout << "cold comment text, " << comments << " comments, " << rawBytes << " bytes" << std::endl;
+
+    ColdCommentStore store;
+    std::vector<ColdCommentStore::Id> ids(comments);
+    auto start = Clock::now();
+    for (size_t i = 0; i < comments; ++i) {
+        ids[i] = store.add(texts[i]);
+    }
+    store.seal();
+    printRate("add + compress", comments, secondsSince(start), "comments");
+    auto stats = store.stats();
+    std::cout << "    " << stats.blocks << " blocks, " << stats.compressedBytes << " bytes compressed, ratio "
+              << stats.compressionRatio() << ", plus " << comments * 12 << " bytes of locations" << std::endl;
+
+    size_t reads = comments / 100;
+    start = Clock::now();
+    size_t total = 0;
+    for (size_t i = 0; i < reads; ++i) {
+        total += store.text(ids[random() % comments]).size(); // Nearly every read decompresses a block
+    }
+    printRate("random reads", reads, secondsSince(start), "comments");
+    reads = comments / 10;
+    start = Clock::now();
+    for (size_t i = 0; i < reads; ++i) {
+        total += store.text(ids[i]).size(); // Neighbours share a block, like the comments of one post
+    }
+    printRate("sequential reads", reads, secondsSince(start), "comments");
+    stats = store.stats();
+    std::cout << "    cache hits " << stats.cacheHits << ", misses " << stats.cacheMisses << std::endl;
+    keep(total);
+
+    start = Clock::now();
+    std::string whole;
+    for (const auto& text : texts) {
+        whole += text;
+    }
+    std::string packed = lzCompress(whole);
+    double seconds = secondsSince(start);
+    std::cout << "    codec: " << whole.size() / seconds / 1e6 << " MB/s compression";
+    start = Clock::now();
+    keep(lzDecompress(packed, whole.size()).size());
+    std::cout << ", " << whole.size() / secondsSince(start) / 1e6 << " MB/s decompression" << std::endl;
+}
+
+// Posts dropped to a spill file and fetched back through SpillRef
+void benchSpill(size_t posts) {
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerBench.spill").string();
+    SpillStore store(path);
+    std::vector<SpillRef<Post>> refs;
+    std::vector<std::shared_ptr<Post>> owners;
+    for (size_t i = 0; i < posts; ++i) {
+        Post post{"Post number " + std::to_string(i), {}, i};
+        for (size_t c = 0; c < 8; ++c) {
+            post.comments.push_back(std::make_shared<Comment>(Comment{"I like it. #" + std::to_string(c), {}}));
+        }
+        owners.push_back(store.make(std::move(post)));
+        refs.emplace_back(owners.back());
+    }
+    std::cout << "spill, " << posts << " posts with 8 comments" << std::endl;
+
+    auto start = Clock::now();
+    owners.clear();
+    printRate("spill on last owner", posts, secondsSince(start), "posts");
+    std::cout << "    " << store.stats().bytesWritten << " bytes written" << std::endl;
+
+    start = Clock::now();
+    size_t total = 0;
+    for (const auto& ref : refs) {
+        total += ref.fetch().get()->comments.size(); // One at a time: the full load latency every time
+    }
+    printRate("fetch and wait, one by one", posts, secondsSince(start), "posts");
+
+    start = Clock::now();
+    std::vector<std::future<std::shared_ptr<Post>>> pending;
+    for (const auto& ref : refs) {
+        pending.push_back(ref.fetch()); // All loads in flight together
+    }
+    for (auto& future : pending) {
+        owners.push_back(future.get());
+    }
+    printRate("fetch all, then wait", posts, secondsSince(start), "posts");
+
+    start = Clock::now();
+    for (const auto& ref : refs) {
+        total += ref.lock() != nullptr; // In memory now: no I/O
+    }
+    printRate("lock while in memory", posts, secondsSince(start), "posts");
+    keep(total);
+    owners.clear();
+    refs.clear();
+}
+
+
+// A RAM budget of a tenth of what all Posts take live, a third of it for hot Posts and the rest for
+// compressed ones. Reads follow a skewed popularity, a few Posts get most of them.
+void benchTiered(size_t posts) {
+    std::mt19937_64 random(13);
+    auto sentence = [&](size_t minWords) { return workload::sentence(random, minWords, minWords + 9); };
+    std::vector<Post> source(posts);
+    size_t allLive = 0;
+    for (size_t i = 0; i < posts; ++i) {
+        source[i].content = "Post " + std::to_string(i) + ": " + sentence(5);
+        source[i].authorId = i % 1000;
+        for (size_t c = 0; c < 8; ++c) {
+            source[i].comments.push_back(std::make_shared<Comment>(Comment{sentence(3), {}}));
+        }
+        allLive += TieredPostStore::liveBytes(source[i]);
+    }
+    size_t budget = allLive / 10;
+    std::cout << "tiered posts, " << posts << " posts, " << allLive / 1024 << " KiB live, RAM budget " << budget / 1024
+              << " KiB" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerBench.cold").string();
+    TieredPostStore store(path, TieredStoreOptions{budget / 3, budget - budget / 3});
+    std::vector<TieredPostStore::Id> ids(posts);
+    auto start = Clock::now();
+    for (size_t i = 0; i < posts; ++i) {
+        ids[i] = store.add(std::move(source[i]));
+    }
+    printRate("add", posts, secondsSince(start), "posts");
+    source.clear();
+    auto stats = store.stats();
+    std::cout << "    in RAM: " << stats.hot << " hot + " << stats.warm << " warm posts, all live in the same budget: "
+              << posts * budget / allLive << " posts; " << stats.cold << " cold, " << stats.indexBytes / 1024
+              << " KiB of bookkeeping" << std::endl;
+
+    // Popularity rank r of a read is posts * u^3, and rank r is a random Post
+    std::vector<TieredPostStore::Id> byRank(ids);
+    std::shuffle(byRank.begin(), byRank.end(), random);
+    std::uniform_real_distribution<double> uniform(0.0, 1.0);
+    size_t reads = posts * 5;
+    std::vector<TieredPostStore::Id> order(reads);
+    for (auto& id : order) {
+        double u = uniform(random);
+        id = byRank[std::min(posts - 1, static_cast<size_t>(double(posts) * u * u * u))];
+    }
+    std::vector<double> latency(reads);
+    size_t total = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < reads; ++i) {
+        auto begin = Clock::now();
+        total += store.get(order[i])->comments.size();
+        latency[i] = std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+    }
+    printRate("skewed reads", reads, secondsSince(start), "reads");
+    keep(total);
+    std::sort(latency.begin(), latency.end());
+    auto percentile = [&](double p) { return latency[std::min(reads - 1, static_cast<size_t>(p * double(reads)))]; };
+    std::cout << "    latency us: p50 " << percentile(0.5) << ", p99 " << percentile(0.99) << ", p99.9 "
+              << percentile(0.999) << ", max " << latency.back() << std::endl;
+    stats = store.stats();
+    std::cout << "    reads hot " << stats.hotReads << ", warm " << stats.warmReads << ", cold " << stats.coldReads
+              << "; " << stats.promotions << " promotions, " << stats.demotions << " demotions" << std::endl;
+    size_t ram = stats.hotBytes + stats.warmBytes + stats.indexBytes;
+    std::cout << "    now in RAM: " << stats.hot << " hot + " << stats.warm << " warm posts, " << ram / 1024
+              << " KiB with bookkeeping, " << double(allLive) / double(ram) << "x the posts per byte of keeping all live; "
+              << stats.coldBytes / 1024 << " KiB in the cold file" << std::endl;
+}
+
+
+// Time to ready: building Persons, Posts and Comments one by one, the way main() does, against mapping a
+// snapshot of them. Both are then walked once. The snapshot file is in the page cache here, so the
+// numbers leave out reading it from disk on a cold start.
+void benchSnapshot(size_t posts) {
+    std::mt19937_64 random(17);
+    size_t personCount = std::max<size_t>(1, posts / 4);
+    std::vector<std::string> texts(posts * 8);
+    for (auto& text : texts) {
+        text = workload::sentence(random, 3, 8); // Generated up front, so the timing is only the construction
+    }
+    std::cout << "snapshot, " << personCount << " persons, " << posts << " posts with 8 comments" << std::endl;
+
+    auto start = Clock::now();
+    std::vector<std::shared_ptr<Person>> persons;
+    std::vector<std::shared_ptr<Post>> feed;
+    persons.reserve(personCount);
+    feed.reserve(posts);
+    for (size_t i = 0; i < personCount; ++i) {
+        persons.push_back(std::make_shared<Person>(Person{"Person " + std::to_string(i), std::to_string(i) + " London St", 20 + i % 50, i}));
+    }
+    for (size_t i = 0; i < posts; ++i) {
+        auto post = std::make_shared<Post>(Post{"Post number " + std::to_string(i), {}, i % personCount});
+        post->comments.reserve(8);
+        for (size_t c = 0; c < 8; ++c) {
+            post->comments.push_back(std::make_shared<Comment>(Comment{texts[i * 8 + c], post}));
+        }
+        feed.push_back(std::move(post));
+    }
+    double built = secondsSince(start);
+    printRate("procedural construction", posts, built, "posts");
+
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerBench.snapshot").string();
+    start = Clock::now();
+    size_t bytes = writeSnapshot(path, persons, feed);
+    printRate("write snapshot", posts, secondsSince(start), "posts");
+    std::cout << "    " << bytes / 1024 << " KiB" << std::endl;
+
+    start = Clock::now();
+    size_t total = 0;
+    for (const auto& post : feed) {
+        total += post->content.size() + post->comments.size();
+        for (const auto& comment : post->comments) {
+            total += comment->text.size();
+        }
+    }
+    double walkedObjects = secondsSince(start);
+    persons.clear();
+    feed.clear();
+
+    start = Clock::now();
+    auto snapshot = Snapshot::open(path);
+    double opened = secondsSince(start);
+    printRate("open snapshot (mmap, fixup, check)", posts, opened, "posts");
+    std::cout << "    time to ready: " << built * 1e3 << " ms built, " << opened * 1e3 << " ms from the snapshot, "
+              << built / opened << "x" << std::endl;
+
+    start = Clock::now();
+    for (const auto& post : snapshot->posts()) {
+        total += post.content.size + post.commentCount;
+        for (size_t c = 0; c < post.commentCount; ++c) {
+            total += post.comments[c].text.size;
+        }
+    }
+    std::cout << "    first walk over all comments: " << walkedObjects * 1e3 << " ms objects, "
+              << secondsSince(start) * 1e3 << " ms snapshot" << std::endl;
+    keep(total);
+    snapshot.reset();
+    std::remove(path.c_str());
+}
+
+
+// Printing Persons (operator<<, which ends every line with std::endl) from several threads: one thread,
+// all threads taking turns on a mutex around the stream (the order then depends on timing), and
+// OrderedOutput, in the order of one thread.
+void benchOrderedOutput(size_t rows) {
+    const size_t threads = std::max<size_t>(4, defaultThreadCount());
+    std::vector<Person> persons(rows);
+    for (size_t i = 0; i < rows; ++i) {
+        persons[i] = Person{"Person " + std::to_string(i), std::to_string(i) + " London St", 20 + i % 50, i};
+    }
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerBench.out").string();
+    std::cout << "ordered output, " << rows << " Persons to a file, " << threads << " threads" << std::endl;
+
+    auto start = Clock::now();
+    {
+        std::ofstream file(path, std::ios::trunc);
+        for (const auto& person : persons) {
+            file << person;
+        }
+    }
+    printRate("one thread", rows, secondsSince(start));
+    auto expected = std::filesystem::file_size(path);
+
+    start = Clock::now();
+    {
+        std::ofstream file(path, std::ios::trunc);
+        std::mutex fileMutex;
+        parallelSlices(rows, threads, [&](size_t, size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                std::lock_guard<std::mutex> lock(fileMutex);
+                file << persons[i];
+            }
+        });
+    }
+    printRate("mutex around the stream", rows, secondsSince(start));
+
+    start = Clock::now();
+    OrderedOutput::Stats stats;
+    {
+        std::ofstream file(path, std::ios::trunc);
+        OrderedOutput out(file);
+        parallelSlices(rows, threads, [&](size_t, size_t begin, size_t end) {
+            OrderedOutput::Producer producer(out);
+            for (size_t i = begin; i < end; ++i) {
+                producer.record(i) << persons[i];
+            }
+        });
+        out.finish();
+        stats = out.stats();
+    }
+    printRate("OrderedOutput", rows, secondsSince(start));
+    std::cout << "    " << stats.batches << " writes to the stream, " << stats.bytes << " bytes (" << expected
+              << " from one thread)" << std::endl;
+    std::filesystem::remove(path);
+}
+
+
+// Recording latencies: LatencyHistogram against keeping every value and sorting, alone and from threads,
+// how close its percentiles are, and what timing a reset costs
+void benchHistogram(size_t values) {
+    std::mt19937_64 random(42);
+    std::lognormal_distribution<double> latency(6.0, 1.2); // Around 400 ns, with a long tail
+    std::vector<uint64_t> samples(values);
+    for (auto& sample : samples) {
+        sample = static_cast<uint64_t>(latency(random));
+    }
+    std::cout << "histogram, " << values << " values" << std::endl;
+
+    auto start = Clock::now();
+    std::vector<uint64_t> kept;
+    for (uint64_t sample : samples) {
+        kept.push_back(sample);
+    }
+    std::sort(kept.begin(), kept.end());
+    printRate("vector + sort", values, secondsSince(start), "values");
+
+    start = Clock::now();
+    LatencyHistogram histogram;
+    for (uint64_t sample : samples) {
+        histogram.record(sample);
+    }
+    auto snapshot = histogram.snapshot();
+    printRate("LatencyHistogram", values, secondsSince(start), "values");
+    for (double p : {50.0, 99.0, 99.9, 99.99}) {
+        uint64_t exact = kept[std::min(kept.size() - 1, static_cast<size_t>(std::max(1.0, p / 100.0 * double(kept.size()) + 0.5)) - 1)];
+        std::cout << "  p" << p << ": exact " << exact << ", histogram " << snapshot.percentile(p) << " ("
+                  << (double(snapshot.percentile(p)) / double(exact) - 1) * 100 << "%)" << std::endl;
+    }
+
+    size_t threads = std::max<size_t>(4, defaultThreadCount());
+    std::mutex mutex;
+    std::vector<uint64_t> shared;
+    start = Clock::now();
+    parallelSlices(values, threads, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            std::lock_guard<std::mutex> lock(mutex);
+            shared.push_back(samples[i]);
+        }
+    });
+    printRate("mutex + vector, " + std::to_string(threads) + " threads", values, secondsSince(start), "values");
+    LatencyHistogram concurrent;
+    start = Clock::now();
+    parallelSlices(values, threads, [&](size_t, size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            concurrent.record(samples[i]);
+        }
+    });
+    keep(concurrent.snapshot().count());
+    printRate("LatencyHistogram, " + std::to_string(threads) + " threads", values, secondsSince(start), "values");
+
+    // Last owner of a Post with comments, reset with and without timing
+    auto makePosts = [] {
+        std::vector<std::shared_ptr<Post>> posts(100000);
+        for (auto& post : posts) {
+            post = std::make_shared<Post>(Post{"Post", {}, 0});
+            for (size_t c = 0; c < 4; ++c) {
+                post->comments.push_back(std::make_shared<Comment>(Comment{"Nice!", post}));
+            }
+        }
+        return posts;
+    };
+    auto posts = makePosts();
+    start = Clock::now();
+    for (auto& post : posts) {
+        post.reset();
+    }
+    printRate("reset", posts.size(), secondsSince(start), "resets");
+    posts = makePosts();
+    start = Clock::now();
+    for (auto& post : posts) {
+        timedReset(post);
+    }
+    printRate("timedReset", posts.size(), secondsSince(start), "resets");
+    reportLatencies(std::cout);
+}
+
+
+// A feed on one thread: Posts created and commented on, readers taking and dropping them, watchers
+// holding weak_ptrs and locking them. With a recorder, every operation is also traced.
+size_t feedSession(size_t steps, uint64_t seed, TraceRecorder::Thread* trace) {
+    std::mt19937_64 random(seed);
+    std::vector<std::shared_ptr<Post>> posts(256);
+    std::vector<std::shared_ptr<Post>> readers(64);
+    std::vector<std::weak_ptr<Post>> watchers(256);
+    for (auto& post : posts) {
+        post = std::make_shared<Post>(Post{"Post", {}, 0});
+        if (trace != nullptr) {
+            trace->create(&post, post->content.size());
+        }
+    }
+    size_t checksum = 0;
+    for (size_t step = 0; step < steps; ++step) {
+        uint64_t r = random();
+        auto& post = posts[(r >> 8) % posts.size()];
+        auto& reader = readers[(r >> 24) % readers.size()];
+        auto& watcher = watchers[(r >> 40) % watchers.size()];
+        switch (r % 10) {
+            case 0:
+                post = std::make_shared<Post>(Post{"A new post", {}, 0});
+                if (trace != nullptr) {
+                    trace->create(&post, post->content.size());
+                }
+                break;
+            case 1:
+                post->comments.push_back(std::make_shared<Comment>(Comment{"Nice!", post}));
+                if (trace != nullptr) {
+                    trace->append(&post, 5);
+                }
+                break;
+            case 2:
+            case 3:
+            case 4:
+                reader = post;
+                if (trace != nullptr) {
+                    trace->copy(&reader, &post);
+                }
+                break;
+            case 5:
+                reader.reset();
+                if (trace != nullptr) {
+                    trace->reset(&reader);
+                }
+                break;
+            case 6:
+                watcher = post;
+                if (trace != nullptr) {
+                    trace->observe(&watcher, &post);
+                }
+                break;
+            default: {
+                std::shared_ptr<Post> locked = watcher.lock();
+                if (trace != nullptr) {
+                    trace->lock(&locked, &watcher);
+                }
+                checksum += locked != nullptr ? locked->comments.size() : 1;
+                if (trace != nullptr) {
+                    trace->reset(&locked);
+                }
+            }
+        }
+    }
+    return checksum;
+}
+
+// Records a feed on several threads, saves and loads the trace, and replays it against two backends
+void benchTrace(size_t steps) {
+    size_t threads = std::max<size_t>(4, defaultThreadCount());
+    std::cout << "trace, " << steps << " operations of a feed on " << threads << " threads" << std::endl;
+    auto run = [&](TraceRecorder* recorder) {
+        parallelSlices(threads, threads, [&](size_t thread, size_t, size_t) {
+            if (recorder == nullptr) {
+                keep(feedSession(steps / threads, thread + 1, nullptr));
+            } else {
+                TraceRecorder::Thread trace(*recorder);
+                keep(feedSession(steps / threads, thread + 1, &trace));
+            }
+        });
+    };
+
+    auto start = Clock::now();
+    run(nullptr);
+    double plain = secondsSince(start);
+    printRate("running the feed", steps, plain, "ops");
+    TraceRecorder recorder;
+    start = Clock::now();
+    run(&recorder);
+    double recording = secondsSince(start);
+    printRate("running the feed, recording", steps, recording, "ops");
+    std::cout << "  recording overhead " << (recording / plain - 1) * 100 << "%" << std::endl;
+
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerBench.trace").string();
+    Trace recorded = recorder.trace();
+    recorded.save(path);
+    Trace trace = Trace::load(path);
+    std::cout << "  " << trace.events() << " events in " << std::filesystem::file_size(path) << " bytes, "
+              << double(trace.bytes()) / double(trace.events()) << " bytes per event" << std::endl;
+    std::filesystem::remove(path);
+
+    auto replay = [&](auto& backend) {
+        ReplayResult result = replayTrace(trace, backend);
+        printRate("replay, " + result.backend, result.events, result.seconds, "events");
+        keep(result.lockFailures);
+    };
+    SharedOwnership shared;
+    replay(shared);
+    SlabOwnership slab;
+    replay(slab);
+}
+
+
+// What analysis mode of the ownership advisor costs: make, copy and lock with and without tracking
+void benchAdvisor(size_t objects) {
+    std::cout << "advisor, " << objects << " Posts made, copied and locked" << std::endl;
+    size_t checksum = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < objects; ++i) {
+        auto post = std::make_shared<Post>(Post{"Post", {}, i});
+        auto copy = post;
+        std::weak_ptr<Post> watcher = post;
+        if (auto locked = watcher.lock()) {
+            checksum += locked->authorId;
+        }
+    }
+    double plain = secondsSince(start);
+    printRate("make_shared, copy, lock", objects, plain, "objects");
+
+    // The same with the ADVISED_... macros, which this target builds with SMARTPOINTERCPP_OWNERSHIP_ADVISOR=1
+    start = Clock::now();
+    for (size_t i = 0; i < objects; ++i) {
+        auto post = ADVISED_MAKE_SHARED(Post)(Post{"Post", {}, i});
+        auto copy = ADVISED_COPY(post);
+        std::weak_ptr<Post> watcher = post;
+        if (auto locked = ADVISED_LOCK(watcher)) {
+            checksum += locked->authorId;
+        }
+    }
+    double advised = secondsSince(start);
+    printRate("advised", objects, advised, "objects");
+    std::cout << "  analysis overhead " << (advised / plain - 1) * 100 << "%" << std::endl;
+    keep(checksum);
+    reportOwnership(std::cout);
+}
+
+
+// The workload driver (workload.h) against every backend: Zipf popularity, read only and 90% reads.
+// The read only backends sit out the mix with writes.
+void benchWorkload(size_t operations) {
+    WorkloadOptions options;
+    options.threads = std::max<size_t>(4, defaultThreadCount());
+    options.operations = operations;
+    SocialGraph graph = generateGraph(options);
+    std::cout << "workload, " << options.persons << " persons, " << options.posts << " posts, Zipf " << options.zipfExponent
+              << ", " << operations << " operations on " << options.threads << " threads" << std::endl;
+
+    auto report = [](const WorkloadResult& result) {
+        printRate(result.backend, result.operations, result.seconds, "ops");
+        std::cout << "    latency us: p50 " << result.p50 << ", p90 " << result.p90 << ", p99 " << result.p99
+                  << ", p99.9 " << result.p999 << ", max " << result.max << std::endl;
+        keep(result.checksum);
+    };
+    auto run = [&](auto& backend, const WorkloadPlan& plan) {
+        backend.load(graph);
+        report(runWorkload(backend, plan, graph));
+    };
+
+    for (unsigned readPercent : {100u, 90u}) {
+        options.readPercent = readPercent;
+        WorkloadPlan plan = generateOperations(options);
+        std::cout << "  " << readPercent << "% reads" << std::endl;
+        SharedPtrBackend shared;
+        run(shared, plan);
+        CopyOnWriteBackend copyOnWrite;
+        run(copyOnWrite, plan);
+        if (readPercent < 100) {
+            continue;
+        }
+        size_t live = 0;
+        for (const auto& post : graph.posts) {
+            live += TieredPostStore::liveBytes(*post);
+        }
+        TieredBackend tiered((std::filesystem::temp_directory_path() / "smartPointerBench.workload.cold").string(),
+                             TieredStoreOptions{live / 30, live / 15});
+        run(tiered, plan);
+        SnapshotBackend snapshot((std::filesystem::temp_directory_path() / "smartPointerBench.workload.snapshot").string());
+        run(snapshot, plan);
+    }
+}
+
+
+int main(int argc, char* argv[]) {
+    // name -> (benchmark, default size)
+    std::map<std::string, std::pair<std::function<void(size_t)>, size_t>> benchmarks{
+            {"advisor", {benchAdvisor, 2000000}},
+            {"append", {benchAppendComments, 4000000}},
+            {"coldtext", {benchColdComments, 1000000}},
+            {"compact", {benchCompact, 2000000}},
+            {"histogram", {benchHistogram, 10000000}},
+            {"hotcold", {benchHotCold, 2000000}},
+            {"join", {benchHashJoin, 10000000}},
+            {"leftright", {benchLeftRight, 4000000}},
+            {"observer", {benchObserver, 2000000}},
+            {"output", {benchOrderedOutput, 2000000}},
+            {"pooled", {benchPooledNew, 5000000}},
+            {"prefetch", {benchPrefetch, 4000000}},
+            {"query", {benchQuery, 2000000}},
+            {"seqlock", {benchSeqlock, 10000000}},
+            {"skiplist", {benchSkipList, 2000000}},
+            {"slab", {benchSlab, 5000000}},
+            {"snapshot", {benchSnapshot, 200000}},
+            {"spill", {benchSpill, 20000}},
+            {"textstore", {benchTextStore, 2000000}},
+            {"tiered", {benchTiered, 200000}},
+            {"trace", {benchTrace, 4000000}},
+            {"workload", {benchWorkload, 1000000}},
+    };
+
+    if (argc > 1) {
+        auto found = benchmarks.find(argv[1]);
+        if (found == benchmarks.end()) {
+            std::cerr << "Unknown benchmark: " << argv[1] << std::endl;
+            return 1;
+        }
+        size_t size = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : found->second.second;
+        found->second.first(size);
+        return 0;
+    }
+    for (const auto& benchmark : benchmarks) {
+        benchmark.second.first(benchmark.second.second);
+    }
+    return 0;
+}
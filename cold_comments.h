@@ -0,0 +1,187 @@
+#ifndef SMARTPOINTERCPP_COLD_COMMENTS_H
+#define SMARTPOINTERCPP_COLD_COMMENTS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "lz_codec.h"
+#include "models.h"
+
+/*
+ *  Cold tier for comment text: old comments packed into compressed blocks.
+ *
+ *      ColdCommentStore archive;
+ *      std::vector<ColdCommentStore::Id> ids = archive.archive(*oldPost);  // Texts move to the archive
+ *      std::cout << archive.text(ids[0]);                                  // Decompresses its block if needed
+ *
+ *  Texts are appended to an open block; when it reaches BlockSize bytes it is compressed with the
+ *  built in LZ codec (lz_codec.h) and sealed. Comment text compresses well, because the same words and
+ *  phrases come back again and again within a block.
+ *  Reading a text decompresses its whole block into a small cache of CacheBlocks blocks (least recently
+ *  used goes first), so reading several comments of the same post costs one decompression.
+ *  Comments that are still read often stay in their Post, uncompressed; only archive() what is cold.
+ *
+ *  All members can be called from several threads, they take one mutex. Decompression runs outside of it.
+ */
+
+class ColdCommentStore {
+public:
+    static constexpr size_t BlockSize = 16 * 1024; // Bigger compresses better, smaller is faster to read one text from
+    static constexpr size_t CacheBlocks = 8;
+
+    using Id = size_t;
+
+    struct Stats {
+        size_t texts = 0;
+        size_t rawBytes = 0;        // Text stored, sealed and open
+        size_t compressedBytes = 0; // Sealed blocks after compression
+        size_t sealedRawBytes = 0;  // Sealed blocks before compression
+        size_t blocks = 0;
+        size_t cacheHits = 0;
+        size_t cacheMisses = 0;
+
+        double compressionRatio() const { return compressedBytes == 0 ? 1.0 : double(sealedRawBytes) / double(compressedBytes); }
+    };
+
+    Id add(std::string_view text) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        locations_.push_back(Location{static_cast<uint32_t>(blocks_.size()), static_cast<uint32_t>(open_.size()),
+                                      static_cast<uint32_t>(text.size())});
+        open_.append(text);
+        rawBytes_ += text.size();
+        if (open_.size() >= BlockSize) {
+            sealLocked();
+        }
+        return locations_.size() - 1;
+    }
+
+    // Moves the text of every comment of post into the store, the comments keep an empty text
+    std::vector<Id> archive(Post& post) {
+        std::vector<Id> ids;
+        ids.reserve(post.comments.size());
+        for (auto& comment : post.comments) {
+            ids.push_back(add(comment->text.view()));
+            comment->text = SharedText();
+        }
+        return ids;
+    }
+
+    std::string text(Id id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Location location = locations_.at(id);
+        if (location.block == blocks_.size()) {
+            return open_.substr(location.offset, location.size); // Still in the open block
+        }
+        std::shared_ptr<const std::string> block = cached(location.block);
+        if (block == nullptr) {
+            const Block& sealed = blocks_[location.block];
+            std::string_view compressed = sealed.compressed; // Sealed blocks never change
+            size_t rawSize = sealed.rawSize;
+            lock.unlock();
+            block = std::make_shared<const std::string>(lzDecompress(compressed, rawSize));
+            lock.lock();
+            remember(location.block, block);
+        }
+        return block->substr(location.offset, location.size);
+    }
+
+    // Compresses the open block now, for example before the store sits idle for a while
+    void seal() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        sealLocked();
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats;
+        stats.texts = locations_.size();
+        stats.rawBytes = rawBytes_;
+        stats.blocks = blocks_.size();
+        for (const auto& block : blocks_) {
+            stats.compressedBytes += block.compressed.size();
+            stats.sealedRawBytes += block.rawSize;
+        }
+        stats.cacheHits = cacheHits_;
+        stats.cacheMisses = cacheMisses_;
+        return stats;
+    }
+
+private:
+    // 12 bytes per text, next to the compressed text itself
+    struct Location {
+        uint32_t block; // blocks_.size() while the block is open
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    struct Block {
+        std::unique_ptr<const std::string> compressedText; // Stable address, text() reads it without the lock
+        std::string_view compressed;
+        size_t rawSize;
+    };
+
+    struct CachedBlock {
+        size_t block;
+        std::shared_ptr<const std::string> text;
+        uint64_t lastUse;
+    };
+
+    void sealLocked() {
+        if (open_.empty()) {
+            return;
+        }
+        auto compressed = std::make_unique<const std::string>(lzCompress(open_));
+        std::string_view view = *compressed;
+        blocks_.push_back(Block{std::move(compressed), view, open_.size()});
+        open_.clear();
+        open_.shrink_to_fit();
+    }
+
+    std::shared_ptr<const std::string> cached(size_t block) {
+        for (auto& entry : cache_) {
+            if (entry.block == block) {
+                entry.lastUse = ++clock_;
+                ++cacheHits_;
+                return entry.text;
+            }
+        }
+        ++cacheMisses_;
+        return nullptr;
+    }
+
+    void remember(size_t block, std::shared_ptr<const std::string> text) {
+        for (const auto& entry : cache_) {
+            if (entry.block == block) {
+                return; // Another thread decompressed it in the meantime
+            }
+        }
+        if (cache_.size() < CacheBlocks) {
+            cache_.push_back(CachedBlock{block, std::move(text), ++clock_});
+            return;
+        }
+        auto oldest = cache_.begin();
+        for (auto it = cache_.begin(); it != cache_.end(); ++it) {
+            if (it->lastUse < oldest->lastUse) {
+                oldest = it;
+            }
+        }
+        *oldest = CachedBlock{block, std::move(text), ++clock_};
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<Location> locations_;
+    std::vector<Block> blocks_;
+    std::string open_;
+    size_t rawBytes_ = 0;
+    std::vector<CachedBlock> cache_;
+    uint64_t clock_ = 0;
+    size_t cacheHits_ = 0;
+    size_t cacheMisses_ = 0;
+};
+
+#endif //SMARTPOINTERCPP_COLD_COMMENTS_H
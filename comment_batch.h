@@ -0,0 +1,126 @@
+#ifndef SMARTPOINTERCPP_COMMENT_BATCH_H
+#define SMARTPOINTERCPP_COMMENT_BATCH_H
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "left_right.h"
+#include "models.h"
+
+/*
+ *  Adding many comments to a Post at once.
+ *
+ *      std::vector<CommentInit> texts = {{"Beautiful shot!"}, {"I like it."}, {"Where was this?"}};
+ *      appendComments(post, texts.begin(), texts.end());
+ *
+ *  Adding comments one by one (make_shared + push_back) costs an allocation with a control block per
+ *  comment and, now and then, a regrowth of Post::comments. makeComments constructs the whole batch in
+ *  one array placed right behind its control block (allocate_shared with an allocator that asks for the
+ *  extra room), and hands out aliasing shared_ptrs into it; appendComments then grows Post::comments once
+ *  and inserts them all. That is one allocation for the batch plus at most one for the vector, whatever
+ *  the batch size.
+ *
+ *  The array is freed when the last comment of the batch is gone, so a single long lived comment keeps
+ *  its whole batch alive. Fine for comments that live and die with their Post.
+ *
+ *  Publication: readers that take the same lock as the writer see the batch completely or not at all,
+ *  since it is one insert. With a LeftRight<Post> (left_right.h) use the overload taking the batch: the
+ *  lock free readers also see all or nothing.
+ */
+
+struct CommentInit {
+    std::string text;
+};
+
+// The object allocate_shared makes for a batch: the Comments themselves follow the control block
+struct CommentArray {
+    Comment* comments = nullptr;
+    size_t count = 0; // Constructed so far
+
+    CommentArray() = default;
+    CommentArray(const CommentArray&) = delete;
+    CommentArray& operator=(const CommentArray&) = delete;
+
+    ~CommentArray() {
+        for (size_t i = count; i > 0; --i) {
+            comments[i - 1].~Comment();
+        }
+    }
+};
+
+// Allocates what allocate_shared asks for (its control block) with room for count Comments behind it,
+// and tells where they go through *comments
+template<typename T>
+struct CommentArrayAllocator {
+    using value_type = T;
+
+    size_t count;
+    Comment** comments;
+
+    CommentArrayAllocator(size_t count, Comment** comments) : count(count), comments(comments) {}
+
+    template<typename U>
+    CommentArrayAllocator(const CommentArrayAllocator<U>& other) : count(other.count), comments(other.comments) {}
+
+    T* allocate(size_t n) {
+        size_t offset = commentsOffset(n);
+        char* memory = static_cast<char*>(::operator new(offset + count * sizeof(Comment)));
+        *comments = reinterpret_cast<Comment*>(memory + offset);
+        return reinterpret_cast<T*>(memory);
+    }
+
+    void deallocate(T* pointer, size_t n) noexcept {
+        ::operator delete(pointer, commentsOffset(n) + count * sizeof(Comment));
+    }
+
+    static size_t commentsOffset(size_t n) {
+        return (n * sizeof(T) + alignof(Comment) - 1) / alignof(Comment) * alignof(Comment);
+    }
+
+    template<typename U>
+    bool operator==(const CommentArrayAllocator<U>& other) const { return comments == other.comments; }
+    template<typename U>
+    bool operator!=(const CommentArrayAllocator<U>& other) const { return comments != other.comments; }
+};
+
+static_assert(alignof(Comment) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, "the Comments follow the control block");
+
+// Comments for post, one per CommentInit in [first, last), constructed in one array in the allocation
+// of its control block
+template<typename It>
+std::vector<std::shared_ptr<Comment>> makeComments(const std::shared_ptr<Post>& post, It first, It last) {
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    std::vector<std::shared_ptr<Comment>> comments;
+    if (count == 0) {
+        return comments;
+    }
+    Comment* array = nullptr;
+    auto block = std::allocate_shared<CommentArray>(CommentArrayAllocator<CommentArray>(count, &array));
+    block->comments = array;
+    comments.reserve(count);
+    for (; block->count < count; ++first) {
+        Comment* comment = ::new(static_cast<void*>(array + block->count)) Comment{SharedText(first->text), post};
+        ++block->count;
+        comments.emplace_back(block, comment); // Shares the control block of the array
+    }
+    return comments;
+}
+
+// Appends one comment per CommentInit in [first, last) to post->comments, see above
+template<typename It>
+void appendComments(const std::shared_ptr<Post>& post, It first, It last) {
+    auto batch = makeComments(post, first, last);
+    post->comments.insert(post->comments.end(), std::make_move_iterator(batch.begin()),
+                          std::make_move_iterator(batch.end()));
+}
+
+// Publishes a batch from makeComments to the readers of a LeftRight<Post> in one write
+inline void appendComments(LeftRight<Post>& post, const std::vector<std::shared_ptr<Comment>>& batch) {
+    post.write([&](Post& p) { p.comments.insert(p.comments.end(), batch.begin(), batch.end()); });
+}
+
+#endif //SMARTPOINTERCPP_COMMENT_BATCH_H
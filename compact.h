@@ -0,0 +1,134 @@
+#ifndef SMARTPOINTERCPP_COMPACT_H
+#define SMARTPOINTERCPP_COMPACT_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "pooled_new.h"
+
+/*
+ *  Compaction of the objects owned by a std::vector<std::unique_ptr<T>>.
+ *
+ *      compact(persons);   // The Persons are now next to each other, in the order of the vector
+ *
+ *  After a lot of churn the objects behind the pointers are spread over the whole heap, and every step of
+ *  a scan is a cache miss. compact() moves every object into one contiguous block of memory, in iteration
+ *  order, and points the unique_ptrs at the new objects. The old objects are destroyed.
+ *
+ *  The unique_ptrs keep their std::default_delete, so `delete` must be able to free a single object of
+ *  that block: T has to use the pooled operator new (POOLED_NEW or PooledNew<T>, pooled_new.h), whose
+ *  pool can take such blocks back one by one. Person, Comment and Post do.
+ *  Pointers and references to the old objects are invalid afterwards, just like after a reallocation.
+ *
+ *  Each compaction normally takes a new block of memory from the pool, and the blocks of the old objects
+ *  go to the pool's free lists, where they serve later `new T`. Compacting the same vector again, while
+ *  its objects still fill exactly the block of the last compaction, reorders them within that block
+ *  instead, so compacting a vector over and over does not grow the pool.
+ */
+
+template<typename T, typename = void>
+struct HasTypePool : std::false_type {};
+
+template<typename T>
+struct HasTypePool<T, std::void_t<typename T::pool_type>> : std::is_same<typename T::pool_type, TypePool<T>> {};
+
+// The objects of owners (count of them) are the only ones in a block of an earlier compaction: puts them
+// in vector order within that block. False when they are not, or T cannot be moved without throwing.
+template<typename T>
+bool compactInPlace(std::vector<std::unique_ptr<T>>& owners, T* first, size_t count) {
+    using Pool = TypePool<T>;
+    size_t arenaCount = 0;
+    char* arena = Pool::contiguousOf(first, arenaCount);
+    if (!std::is_nothrow_move_constructible<T>::value || arena == nullptr || arenaCount != count) {
+        return false;
+    }
+    // count different objects in a block of count slots fill all of it
+    char* end = arena + count * Pool::BlockSize;
+    bool ordered = true;
+    size_t next = 0;
+    for (const auto& owner : owners) {
+        if (owner == nullptr) {
+            continue;
+        }
+        auto* address = reinterpret_cast<char*>(owner.get());
+        if (address < arena || address >= end) {
+            return false;
+        }
+        ordered = ordered && address == arena + next++ * Pool::BlockSize;
+    }
+    if (ordered) {
+        return true;
+    }
+    std::vector<T> moved;
+    moved.reserve(count);
+    for (auto& owner : owners) {
+        if (owner != nullptr) {
+            moved.push_back(std::move(*owner));
+        }
+    }
+    // Nothing below throws: destroy the old objects in place and build them again in order
+    next = 0;
+    for (auto& owner : owners) {
+        if (owner != nullptr) {
+            T* old = owner.release();
+            old->~T();
+            runDeleteHook(old);
+            owner.reset(reinterpret_cast<T*>(arena + next++ * Pool::BlockSize));
+        }
+    }
+    next = 0;
+    for (auto& owner : owners) {
+        if (owner != nullptr) {
+            ::new(static_cast<void*>(owner.get())) T(std::move(moved[next++]));
+        }
+    }
+    return true;
+}
+
+template<typename T>
+void compact(std::vector<std::unique_ptr<T>>& owners) {
+    static_assert(HasTypePool<T>::value, "compact() needs a type with a pooled operator new (POOLED_NEW)");
+    static_assert(std::is_nothrow_move_constructible<T>::value || std::is_copy_constructible<T>::value,
+                  "compact() moves (or copies) every object");
+    using Pool = TypePool<T>;
+
+    size_t count = 0;
+    T* first = nullptr;
+    for (const auto& owner : owners) {
+        if (owner != nullptr) {
+            first = first != nullptr ? first : owner.get();
+            ++count;
+        }
+    }
+    if (count == 0) {
+        return;
+    }
+    if (compactInPlace(owners, first, count)) {
+        return;
+    }
+    char* arena = Pool::allocateContiguous(count);
+
+    size_t next = 0;
+    try {
+        for (auto& owner : owners) {
+            if (owner == nullptr) {
+                continue;
+            }
+            T* moved = ::new(arena + next * Pool::BlockSize) T(std::move_if_noexcept(*owner));
+            ++next;
+            owner.reset(moved); // Destroys the old object and gives its memory back to the pool
+        }
+    } catch (...) {
+        // Hand the blocks that were not used to the pool, the owners moved so far stay valid
+        for (; next < count; ++next) {
+            Pool::deallocate(arena + next * Pool::BlockSize);
+        }
+        throw;
+    }
+}
+
+#endif //SMARTPOINTERCPP_COMPACT_H
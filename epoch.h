@@ -0,0 +1,151 @@
+#ifndef SMARTPOINTERCPP_EPOCH_H
+#define SMARTPOINTERCPP_EPOCH_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "read_indicator.h"
+
+/*
+ *  Epoch based reclamation: freeing nodes of a lock free structure while other threads may still read them.
+ *
+ *      EpochDomain epochs;
+ *      {
+ *          auto guard = epochs.pin();      // Nodes reachable now stay valid until the guard is gone
+ *          ... traverse, unlink a node ...
+ *          epochs.retire(node, [](void* p) { delete static_cast<Node*>(p); });
+ *      }
+ *
+ *  A global epoch counts up. A thread pins the current epoch while it touches shared nodes. A node that was
+ *  unlinked is retired with the epoch of that moment and freed once the global epoch is two further:
+ *  the epoch only moves from E to E + 1 when nobody is pinned at E - 1 any more, so by then every thread
+ *  that could have seen the node has left.
+ *  Pinned threads are counted per epoch (modulo 3) on a ReadIndicator, pinning is two loads and one
+ *  uncontended increment. Retired nodes wait in a few mutex protected lists, chosen by thread id.
+ */
+
+class EpochDomain {
+public:
+    using Deleter = void (*)(void*);
+
+    // Retirements in one list between two attempts to advance the epoch and free nodes
+    static constexpr size_t ScanEvery = 64;
+
+    class Guard {
+    public:
+        explicit Guard(ReadIndicator* indicator) : indicator_(indicator) {}
+        Guard(Guard&& other) noexcept : indicator_(std::exchange(other.indicator_, nullptr)) {}
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+        Guard& operator=(Guard&&) = delete;
+
+        ~Guard() {
+            if (indicator_ != nullptr) {
+                indicator_->depart();
+            }
+        }
+
+    private:
+        ReadIndicator* indicator_;
+    };
+
+    EpochDomain() = default;
+    EpochDomain(const EpochDomain&) = delete;
+    EpochDomain& operator=(const EpochDomain&) = delete;
+
+    // Nobody can be pinned any more: free everything
+    ~EpochDomain() {
+        for (auto& limbo : limbos_) {
+            for (auto& retired : limbo.retired) {
+                retired.deleter(retired.pointer);
+            }
+        }
+    }
+
+    Guard pin() {
+        for (;;) {
+            uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+            ReadIndicator& indicator = pinned_[epoch % 3];
+            indicator.arrive();
+            if (epoch_.load(std::memory_order_seq_cst) == epoch) {
+                return Guard(&indicator);
+            }
+            indicator.depart(); // The epoch moved on while arriving, pin the new one
+        }
+    }
+
+    // pointer is no longer reachable for threads that pin from now on; deleter(pointer) runs once no
+    // thread pinned before can still use it
+    void retire(void* pointer, Deleter deleter) {
+        Limbo& limbo = limbos_[std::hash<std::thread::id>()(std::this_thread::get_id()) % LimboCount];
+        std::lock_guard<std::mutex> lock(limbo.mutex);
+        limbo.retired.push_back(Retired{pointer, deleter, epoch_.load(std::memory_order_seq_cst)});
+        if (++limbo.sinceScan >= ScanEvery) {
+            limbo.sinceScan = 0;
+            tryAdvance();
+            freeExpired(limbo);
+        }
+    }
+
+    // Nodes retired but not freed yet
+    size_t pending() {
+        size_t total = 0;
+        for (auto& limbo : limbos_) {
+            std::lock_guard<std::mutex> lock(limbo.mutex);
+            total += limbo.retired.size();
+        }
+        return total;
+    }
+
+    size_t freed() const { return freed_.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr size_t LimboCount = 16;
+
+    struct Retired {
+        void* pointer;
+        Deleter deleter;
+        uint64_t epoch;
+    };
+
+    struct alignas(64) Limbo {
+        std::mutex mutex;
+        std::vector<Retired> retired;
+        size_t sinceScan = 0;
+    };
+
+    void tryAdvance() {
+        uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        if (pinned_[(epoch + 2) % 3].empty()) { // Nobody left in epoch - 1
+            epoch_.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+        }
+    }
+
+    void freeExpired(Limbo& limbo) {
+        uint64_t epoch = epoch_.load(std::memory_order_seq_cst);
+        size_t kept = 0;
+        for (auto& retired : limbo.retired) {
+            if (retired.epoch + 2 <= epoch) {
+                retired.deleter(retired.pointer);
+                freed_.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                limbo.retired[kept++] = retired;
+            }
+        }
+        limbo.retired.resize(kept);
+    }
+
+    std::atomic<uint64_t> epoch_{0};
+    ReadIndicator pinned_[3];
+    std::array<Limbo, LimboCount> limbos_;
+    std::atomic<size_t> freed_{0};
+};
+
+#endif //SMARTPOINTERCPP_EPOCH_H
@@ -0,0 +1,74 @@
+#ifndef SMARTPOINTERCPP_FACTORIES_H
+#define SMARTPOINTERCPP_FACTORIES_H
+
+#include <memory>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/*
+ *  Smart pointer factories that take their memory from a std::pmr::memory_resource,
+ *  for example a QuotaResource (quota_resource.h) or a SlabResource (slab_resource.h).
+ *
+ *      std::shared_ptr<Post> post = makeSharedIn<Post>(postCache);
+ *      PmrUniquePtr<Person> person = makeUniqueIn<Person>(people, "John Doe", "123 London St", 30);
+ *
+ *  makeSharedIn works like std::make_shared: one allocation holds the control block and the object,
+ *  and both are returned to the resource when the last shared_ptr (and weak_ptr) is gone.
+ *  makeUniqueIn returns a unique_ptr with a deleter that remembers the resource.
+ *  Aggregates like Person can be built from their members, as with Person{...}.
+ */
+
+// Builds a T in place, with T(args...) when T has such a constructor and T{args...} for aggregates
+template<typename T, typename... Args>
+T* constructAt(void* memory, Args&&... args) {
+    if constexpr (std::is_constructible<T, Args&&...>::value) {
+        return ::new(memory) T(std::forward<Args>(args)...);
+    } else {
+        return ::new(memory) T{std::forward<Args>(args)...};
+    }
+}
+
+template<typename T>
+class ResourceDeleter {
+public:
+    ResourceDeleter() = default;
+    explicit ResourceDeleter(std::pmr::memory_resource* resource) : resource_(resource) {}
+
+    void operator()(T* pointer) const {
+        pointer->~T();
+        resource_->deallocate(pointer, sizeof(T), alignof(T));
+    }
+
+    std::pmr::memory_resource* resource() const { return resource_; }
+
+private:
+    std::pmr::memory_resource* resource_ = std::pmr::get_default_resource();
+};
+
+template<typename T>
+using PmrUniquePtr = std::unique_ptr<T, ResourceDeleter<T>>;
+
+template<typename T, typename... Args>
+PmrUniquePtr<T> makeUniqueIn(std::pmr::memory_resource& resource, Args&&... args) {
+    void* memory = resource.allocate(sizeof(T), alignof(T));
+    try {
+        return PmrUniquePtr<T>(constructAt<T>(memory, std::forward<Args>(args)...), ResourceDeleter<T>(&resource));
+    } catch (...) {
+        resource.deallocate(memory, sizeof(T), alignof(T));
+        throw;
+    }
+}
+
+template<typename T, typename... Args>
+std::shared_ptr<T> makeSharedIn(std::pmr::memory_resource& resource, Args&&... args) {
+    std::pmr::polymorphic_allocator<T> allocator(&resource);
+    if constexpr (std::is_constructible<T, Args&&...>::value) {
+        return std::allocate_shared<T>(allocator, std::forward<Args>(args)...);
+    } else {
+        return std::allocate_shared<T>(allocator, T{std::forward<Args>(args)...});
+    }
+}
+
+#endif //SMARTPOINTERCPP_FACTORIES_H
@@ -0,0 +1,152 @@
+#ifndef SMARTPOINTERCPP_GROUP_BY_H
+#define SMARTPOINTERCPP_GROUP_BY_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "models.h"
+#include "parallel.h"
+
+/*
+ *  Parallel group-by aggregation.
+ *  Works on any random access range: std::vector<Person>, std::vector<std::unique_ptr<Person>>,
+ *  std::vector<std::shared_ptr<Person>> or a single column of a PersonTable.
+ *
+ *  parallelAggregate: every thread builds its own (thread-local) hash table over its
+ *  slice of the input, the partial tables are merged at the end. Good when there are few groups.
+ *
+ *  radixAggregate: for many groups (high cardinality) the merge step becomes the bottleneck.
+ *  Every thread first scatters its (key, value) pairs into partitions chosen by the key hash,
+ *  then every partition is aggregated by exactly one thread, so no merge is needed.
+ */
+
+template<typename It, typename KeyFn>
+using GroupKey = std::decay_t<decltype(std::declval<KeyFn&>()(elementRef(*std::declval<It&>())))>;
+
+template<typename It, typename ValueFn>
+using GroupValue = std::decay_t<decltype(std::declval<ValueFn&>()(elementRef(*std::declval<It&>())))>;
+
+// Aggregates value(element) per key(element), combining values of the same key with combine(a, b).
+template<typename It, typename KeyFn, typename ValueFn, typename Combine>
+std::unordered_map<GroupKey<It, KeyFn>, GroupValue<It, ValueFn>>
+parallelAggregate(It first, It last, KeyFn key, ValueFn value, Combine combine,
+                  size_t threads = defaultThreadCount()) {
+    using Table = std::unordered_map<GroupKey<It, KeyFn>, GroupValue<It, ValueFn>>;
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    threads = std::max<size_t>(1, std::min(threads, count));
+
+    // One partial table per thread, nobody shares a table so no locking is needed
+    std::vector<Table> partials(threads);
+    parallelSlices(count, threads, [&](size_t t, size_t begin, size_t end) {
+        Table& table = partials[t];
+        for (It it = first + begin; it != first + end; ++it) {
+            auto& element = elementRef(*it);
+            auto v = value(element);
+            // try_emplace leaves v alone when the key is already there
+            auto inserted = table.try_emplace(key(element), std::move(v));
+            if (!inserted.second) {
+                inserted.first->second = combine(inserted.first->second, v);
+            }
+        }
+    });
+
+    // Merge the partial tables into the first one
+    Table& result = partials.front();
+    for (size_t t = 1; t < partials.size(); ++t) {
+        for (auto& entry : partials[t]) {
+            auto inserted = result.try_emplace(entry.first, std::move(entry.second));
+            if (!inserted.second) {
+                inserted.first->second = combine(inserted.first->second, entry.second);
+            }
+        }
+    }
+    return std::move(result);
+}
+
+// Radix partitioned variant of parallelAggregate for inputs with many distinct keys.
+// 2^radixBits partitions, radixBits from 0 (one partition) to 16.
+template<typename It, typename KeyFn, typename ValueFn, typename Combine>
+std::unordered_map<GroupKey<It, KeyFn>, GroupValue<It, ValueFn>>
+radixAggregate(It first, It last, KeyFn key, ValueFn value, Combine combine,
+               size_t threads = defaultThreadCount(), size_t radixBits = 6) {
+    using Key = GroupKey<It, KeyFn>;
+    using Value = GroupValue<It, ValueFn>;
+    using Table = std::unordered_map<Key, Value>;
+    if (radixBits > 16) {
+        throw std::invalid_argument("radixAggregate: radixBits must be at most 16");
+    }
+    size_t count = static_cast<size_t>(std::distance(first, last));
+    threads = std::max<size_t>(1, std::min(threads, count));
+    const size_t partitions = size_t{1} << radixBits;
+    std::hash<Key> hasher;
+
+    // Phase 1: scatter. buckets[thread][partition] holds the pairs of one thread for one partition.
+    std::vector<std::vector<std::vector<std::pair<Key, Value>>>> buckets(
+            threads, std::vector<std::vector<std::pair<Key, Value>>>(partitions));
+    parallelSlices(count, threads, [&](size_t t, size_t begin, size_t end) {
+        auto& mine = buckets[t];
+        for (It it = first + begin; it != first + end; ++it) {
+            auto& element = elementRef(*it);
+            Key k = key(element);
+            // Use the high bits of the hash, the low bits are used by the hash table itself.
+            // A shift by 64 is undefined, one partition takes no bits.
+            size_t partition = radixBits == 0 ? 0 : static_cast<size_t>(
+                    (static_cast<unsigned long long>(hasher(k)) * 0x9E3779B97F4A7C15ull) >> (64 - radixBits));
+            mine[partition].emplace_back(std::move(k), value(element));
+        }
+    });
+
+    // Phase 2: every partition is owned by one thread, it aggregates the pairs of all threads
+    std::vector<Table> tables(partitions);
+    parallelSlices(partitions, threads, [&](size_t, size_t begin, size_t end) {
+        for (size_t p = begin; p < end; ++p) {
+            Table& table = tables[p];
+            for (auto& perThread : buckets) {
+                for (auto& pair : perThread[p]) {
+                    auto inserted = table.try_emplace(std::move(pair.first), pair.second);
+                    if (!inserted.second) {
+                        inserted.first->second = combine(inserted.first->second, pair.second);
+                    }
+                }
+                std::vector<std::pair<Key, Value>>().swap(perThread[p]); // Release the memory early
+            }
+        }
+    });
+
+    // Partitions have disjoint keys, so collecting them is a plain concatenation
+    Table result;
+    size_t total = 0;
+    for (const auto& table : tables) {
+        total += table.size();
+    }
+    result.reserve(total);
+    for (auto& table : tables) {
+        for (auto& entry : table) {
+            result.emplace(entry.first, std::move(entry.second));
+        }
+    }
+    return result;
+}
+
+// Counting is the most common report, for example "count per age bucket".
+template<typename It, typename KeyFn>
+std::unordered_map<GroupKey<It, KeyFn>, size_t>
+parallelCountBy(It first, It last, KeyFn key, size_t threads = defaultThreadCount()) {
+    return parallelAggregate(first, last, key, [](const auto&) { return size_t{1}; },
+                             std::plus<size_t>(), threads);
+}
+
+template<typename It, typename KeyFn>
+std::unordered_map<GroupKey<It, KeyFn>, size_t>
+radixCountBy(It first, It last, KeyFn key, size_t threads = defaultThreadCount()) {
+    return radixAggregate(first, last, key, [](const auto&) { return size_t{1}; },
+                          std::plus<size_t>(), threads);
+}
+
+#endif //SMARTPOINTERCPP_GROUP_BY_H
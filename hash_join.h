@@ -0,0 +1,213 @@
+#ifndef SMARTPOINTERCPP_HASH_JOIN_H
+#define SMARTPOINTERCPP_HASH_JOIN_H
+
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <vector>
+
+#include "models.h"
+#include "parallel.h"
+#include "prefetch.h"
+
+/*
+ *  Radix partitioned hash join.
+ *  Typical use: build on Persons (key Person::id) and probe with Posts (key Post::authorId),
+ *  so a feed can be rendered without a pointer lookup per Post.
+ *
+ *  Build: the build rows are partitioned by the high bits of the key hash, every partition gets
+ *  its own small open addressing table, sized to stay in cache while it is probed.
+ *  Both the partitioning and the per partition table build run in parallel.
+ *
+ *  Probe: keys are processed in batches (vectors) of ProbeBatch keys. All hashes of a batch are
+ *  computed and their slots prefetched first, then the batch is looked up, which hides the
+ *  memory latency of the table instead of waiting for every key on its own.
+ */
+
+// One result row: row index in the probe input and row index in the build input.
+struct JoinMatch {
+    size_t probeRow;
+    size_t buildRow;
+};
+
+class HashJoin {
+public:
+    static constexpr size_t ProbeBatch = 64;
+
+    // 2^radixBits partitions, radixBits from 0 (one table) to 16
+    explicit HashJoin(size_t radixBits = 8)
+            : radixBits_(checkedRadixBits(radixBits)), partitionCount_(size_t{1} << radixBits_) {}
+
+    // Builds the table from the rows in [first, last), key(element) must return an unsigned integer.
+    template<typename It, typename KeyFn>
+    void build(It first, It last, KeyFn key, size_t threads = defaultThreadCount()) {
+        size_t count = static_cast<size_t>(std::distance(first, last));
+        threads = std::max<size_t>(1, std::min(threads, count));
+
+        // Pass 1: every thread counts how many of its rows land in every partition
+        std::vector<std::vector<size_t>> histograms(threads, std::vector<size_t>(partitionCount_));
+        std::vector<uint64_t> keys(count);
+        parallelSlices(count, threads, [&](size_t t, size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                keys[row] = static_cast<uint64_t>(key(elementRef(*(first + row))));
+                ++histograms[t][partitionOf(hash(keys[row]))];
+            }
+        });
+
+        // Prefix sum gives every (thread, partition) pair its own write position, so the scatter needs no locks
+        std::vector<size_t> partitionStart(partitionCount_ + 1);
+        std::vector<std::vector<size_t>> writePos(threads, std::vector<size_t>(partitionCount_));
+        size_t offset = 0;
+        for (size_t p = 0; p < partitionCount_; ++p) {
+            partitionStart[p] = offset;
+            for (size_t t = 0; t < threads; ++t) {
+                writePos[t][p] = offset;
+                offset += histograms[t][p];
+            }
+        }
+        partitionStart[partitionCount_] = offset;
+
+        // Pass 2: scatter the (key, row) pairs into their partitions
+        std::vector<Slot> partitioned(count);
+        parallelSlices(count, threads, [&](size_t t, size_t begin, size_t end) {
+            for (size_t row = begin; row < end; ++row) {
+                partitioned[writePos[t][partitionOf(hash(keys[row]))]++] = Slot{keys[row], row};
+            }
+        });
+
+        // Pass 3: one open addressing table per partition, with at least twice as many slots as rows
+        tableStart_.assign(partitionCount_ + 1, 0);
+        masks_.assign(partitionCount_, 0);
+        size_t slots = 0;
+        for (size_t p = 0; p < partitionCount_; ++p) {
+            size_t rows = partitionStart[p + 1] - partitionStart[p];
+            size_t capacity = 1;
+            while (capacity < rows * 2) {
+                capacity <<= 1;
+            }
+            tableStart_[p] = slots;
+            masks_[p] = capacity - 1;
+            slots += capacity;
+        }
+        tableStart_[partitionCount_] = slots;
+        slots_.assign(slots, Slot{0, EmptyRow});
+        std::vector<char> duplicates(threads, 0);
+        parallelSlices(partitionCount_, threads, [&](size_t t, size_t begin, size_t end) {
+            for (size_t p = begin; p < end; ++p) {
+                Slot* table = slots_.data() + tableStart_[p];
+                for (size_t i = partitionStart[p]; i < partitionStart[p + 1]; ++i) {
+                    size_t slot = hash(partitioned[i].key) & masks_[p];
+                    while (table[slot].row != EmptyRow) {
+                        duplicates[t] |= table[slot].key == partitioned[i].key;
+                        slot = (slot + 1) & masks_[p];
+                    }
+                    table[slot] = partitioned[i];
+                }
+            }
+        });
+        // With unique build keys (like Person::id) a probe can stop at the first match
+        // instead of walking the whole cluster to the next empty slot.
+        uniqueKeys_ = std::find(duplicates.begin(), duplicates.end(), 1) == duplicates.end();
+        buildRows_ = count;
+    }
+
+    // Probes the table with key(element) for every row in [first, last) and returns all matches.
+    // Matches are ordered by probe row.
+    template<typename It, typename KeyFn>
+    std::vector<JoinMatch> probe(It first, It last, KeyFn key, size_t threads = defaultThreadCount()) const {
+        size_t count = static_cast<size_t>(std::distance(first, last));
+        threads = std::max<size_t>(1, std::min(threads, count));
+        std::vector<std::vector<JoinMatch>> perThread(threads);
+
+        parallelSlices(count, threads, [&](size_t t, size_t begin, size_t end) {
+            std::vector<JoinMatch>& out = perThread[t];
+            out.reserve(end - begin);
+            uint64_t batchKeys[ProbeBatch];
+            uint64_t batchHashes[ProbeBatch];
+            for (size_t batch = begin; batch < end; batch += ProbeBatch) {
+                size_t n = std::min(ProbeBatch, end - batch);
+                // Hash the whole batch and prefetch the first slot of every key
+                for (size_t i = 0; i < n; ++i) {
+                    batchKeys[i] = static_cast<uint64_t>(key(elementRef(*(first + (batch + i)))));
+                    batchHashes[i] = hash(batchKeys[i]);
+                    prefetchRead(firstSlot(batchHashes[i]));
+                }
+                // Then look the batch up, the slots are (hopefully) in cache by now
+                for (size_t i = 0; i < n; ++i) {
+                    size_t p = partitionOf(batchHashes[i]);
+                    const Slot* table = slots_.data() + tableStart_[p];
+                    size_t slot = batchHashes[i] & masks_[p];
+                    while (table[slot].row != EmptyRow) {
+                        if (table[slot].key == batchKeys[i]) {
+                            out.push_back(JoinMatch{batch + i, table[slot].row});
+                            if (uniqueKeys_) {
+                                break;
+                            }
+                        }
+                        slot = (slot + 1) & masks_[p];
+                    }
+                }
+            }
+        });
+
+        std::vector<JoinMatch> result = std::move(perThread.front());
+        for (size_t t = 1; t < perThread.size(); ++t) {
+            result.insert(result.end(), perThread[t].begin(), perThread[t].end());
+        }
+        return result;
+    }
+
+    size_t buildRows() const { return buildRows_; }
+
+    bool uniqueKeys() const { return uniqueKeys_; }
+
+    // Memory used by the hash tables in bytes.
+    size_t tableBytes() const { return slots_.size() * sizeof(Slot); }
+
+private:
+    struct Slot {
+        uint64_t key;
+        size_t row;
+    };
+
+    static constexpr size_t EmptyRow = std::numeric_limits<size_t>::max();
+
+    // Murmur3 finalizer, spreads ids that are close together over the whole table
+    static uint64_t hash(uint64_t key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    static size_t checkedRadixBits(size_t radixBits) {
+        if (radixBits > 16) {
+            throw std::invalid_argument("HashJoin: radixBits must be at most 16");
+        }
+        return radixBits;
+    }
+
+    size_t partitionOf(uint64_t hashValue) const {
+        // A shift by 64 is undefined, one partition takes no bits
+        return radixBits_ == 0 ? 0 : static_cast<size_t>(hashValue >> (64 - radixBits_));
+    }
+
+    const Slot* firstSlot(uint64_t hashValue) const {
+        size_t p = partitionOf(hashValue);
+        return slots_.data() + tableStart_[p] + (hashValue & masks_[p]);
+    }
+
+    size_t radixBits_;
+    size_t partitionCount_;
+    size_t buildRows_ = 0;
+    bool uniqueKeys_ = true;
+    std::vector<size_t> tableStart_ = std::vector<size_t>(partitionCount_ + 1, 0);
+    std::vector<size_t> masks_ = std::vector<size_t>(partitionCount_, 0);
+    std::vector<Slot> slots_ = std::vector<Slot>(partitionCount_, Slot{0, EmptyRow});
+};
+
+#endif //SMARTPOINTERCPP_HASH_JOIN_H
@@ -0,0 +1,158 @@
+#ifndef SMARTPOINTERCPP_HOT_COLD_H
+#define SMARTPOINTERCPP_HOT_COLD_H
+
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "models.h"
+
+/*
+ *  Hot/cold field splitting.
+ *
+ *  A Person is two 32 byte std::string headers plus two size_t, and a loop that only reads age still pulls
+ *  the whole record through the cache. SplitVector<Person> stores the hot fields (age, id) of all
+ *  Persons next to each other and the cold fields (name, address) out of line in a second vector.
+ *  A scan over age then reads 16 bytes per Person instead of 80.
+ *
+ *      SplitVector<Person> people;
+ *      people.push_back(Person{"John Doe", "123 London St", 30, 1});
+ *      for (auto person : people) {
+ *          total += person.age;                // Same accessor syntax as Person
+ *          person.address = "456 Oslo St";     // Writes go to the record in the container
+ *      }
+ *
+ *  Iterating gives a small proxy (PersonRef) holding references to the fields, so the syntax stays
+ *  `person.age`. Creating the proxy only computes the address of the cold part, it does not read it.
+ *  Which fields are hot is decided per type by a SplitTraits specialization.
+ */
+
+template<typename T>
+struct SplitTraits;
+
+// Person: the print and filter loops read age (and id for joins), the strings are cold
+struct PersonHot {
+    size_t age{};
+    size_t id{};
+};
+
+struct PersonCold {
+    std::string name{};
+    std::string address{};
+};
+
+struct PersonRef {
+    size_t& age;
+    size_t& id;
+    std::string& name;
+    std::string& address;
+
+    PersonRef(PersonHot& hot, PersonCold& cold)
+            : age(hot.age), id(hot.id), name(cold.name), address(cold.address) {}
+
+    operator Person() const { return Person{name, address, age, id}; }
+};
+
+template<>
+struct SplitTraits<Person> {
+    using Hot = PersonHot;
+    using Cold = PersonCold;
+    using Ref = PersonRef;
+
+    static Hot hot(const Person& person) { return Hot{person.age, person.id}; }
+    static Cold cold(const Person& person) { return Cold{person.name, person.address}; }
+    static Person join(const Hot& hot, const Cold& cold) { return Person{cold.name, cold.address, hot.age, hot.id}; }
+};
+
+// Comment: finding the post of a comment is the hot path, the text is only read when it is shown
+struct CommentHot {
+    std::weak_ptr<Post> post;
+};
+
+struct CommentCold {
+    SharedText text;
+};
+
+struct CommentRef {
+    std::weak_ptr<Post>& post;
+    SharedText& text;
+
+    CommentRef(CommentHot& hot, CommentCold& cold) : post(hot.post), text(cold.text) {}
+
+    operator Comment() const { return Comment{text, post}; }
+};
+
+template<>
+struct SplitTraits<Comment> {
+    using Hot = CommentHot;
+    using Cold = CommentCold;
+    using Ref = CommentRef;
+
+    static Hot hot(const Comment& comment) { return Hot{comment.post}; }
+    static Cold cold(const Comment& comment) { return Cold{comment.text}; }
+    static Comment join(const Hot& hot, const Cold& cold) { return Comment{cold.text, hot.post}; }
+};
+
+template<typename T>
+class SplitVector {
+public:
+    using Traits = SplitTraits<T>;
+    using Hot = typename Traits::Hot;
+    using Cold = typename Traits::Cold;
+    using Ref = typename Traits::Ref;
+
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = T;
+        using difference_type = std::ptrdiff_t;
+        using reference = Ref;
+        using pointer = void;
+
+        iterator(SplitVector* owner, size_t index) : owner_(owner), index_(index) {}
+
+        Ref operator*() const { return (*owner_)[index_]; }
+        iterator& operator++() {
+            ++index_;
+            return *this;
+        }
+        bool operator==(const iterator& other) const { return index_ == other.index_; }
+        bool operator!=(const iterator& other) const { return index_ != other.index_; }
+
+    private:
+        SplitVector* owner_;
+        size_t index_;
+    };
+
+    void reserve(size_t count) {
+        hot_.reserve(count);
+        cold_.reserve(count);
+    }
+
+    void push_back(const T& value) {
+        hot_.push_back(Traits::hot(value));
+        cold_.push_back(Traits::cold(value));
+    }
+
+    size_t size() const { return hot_.size(); }
+    bool empty() const { return hot_.empty(); }
+
+    Ref operator[](size_t index) { return Ref(hot_[index], cold_[index]); }
+
+    // A copy of the whole record
+    T at(size_t index) const { return Traits::join(hot_.at(index), cold_.at(index)); }
+
+    iterator begin() { return iterator(this, 0); }
+    iterator end() { return iterator(this, size()); }
+
+    // Direct access to the hot part, for scans that want nothing else
+    const std::vector<Hot>& hot() const { return hot_; }
+
+private:
+    std::vector<Hot> hot_;
+    std::vector<Cold> cold_;
+};
+
+#endif //SMARTPOINTERCPP_HOT_COLD_H
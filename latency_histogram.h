@@ -0,0 +1,301 @@
+#ifndef SMARTPOINTERCPP_LATENCY_HISTOGRAM_H
+#define SMARTPOINTERCPP_LATENCY_HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "thread_slots.h"
+
+/*
+ *  Latency distributions that cost a few nanoseconds to record, for operations far too short to log.
+ *
+ *      LatencyHistogram resets;
+ *      {
+ *          ScopedLatency timer(resets);                    // Records the time until the end of the scope
+ *          post.reset();                                    // Maybe the last owner: frees every Comment too
+ *      }
+ *      auto snapshot = resets.snapshot();
+ *      std::cout << snapshot.percentile(99.9) << " ns";
+ *
+ *  Log-linear buckets, as in HdrHistogram: values below 64 have a bucket each, above that every power of
+ *  two is split into 64 buckets, so a percentile is within 1/64 (1.6%) of the exact value whatever its
+ *  size. Values up to MaxValue (about 18 minutes in nanoseconds) fit in 2240 counters; larger ones
+ *  count as MaxValue.
+ *
+ *  Every thread records into counters of its own, allocated on its first record, with a plain load and
+ *  store: no lock, no read-modify-write, no cache line shared with another thread. snapshot() adds up the
+ *  counters of all threads without stopping them, so a snapshot taken during recording may miss the
+ *  records of the last moment, but never sees a torn counter. Threads beyond MaxThreads share one set
+ *  of counters with atomic increments.
+ *
+ *  Named histograms (latencyHistogram("name")) live as long as the program and are what the hooks in
+ *  the containers record into when SMARTPOINTERCPP_LATENCY_HOOKS is 1:
+ *      TextStore::intern, ConcurrentSkipList insert / erase / find, TieredPostStore::get, the Post
+ *      reloads of a SpillStore
+ *  Without the flag the hooks compile to nothing. timedReset and timedLock time single smart pointer
+ *  operations, into "shared_ptr::reset" and "weak_ptr::lock". reportLatencies prints them all.
+ */
+
+#ifndef SMARTPOINTERCPP_LATENCY_HOOKS
+#define SMARTPOINTERCPP_LATENCY_HOOKS 0
+#endif
+
+class LatencyHistogram {
+public:
+    static constexpr unsigned SubBucketBits = 6;
+    static constexpr uint64_t SubBuckets = uint64_t{1} << SubBucketBits;
+    static constexpr unsigned MaxBits = 40;
+    static constexpr uint64_t MaxValue = (uint64_t{1} << MaxBits) - 1;
+    static constexpr size_t Buckets = (MaxBits - SubBucketBits + 1) * SubBuckets;
+    static constexpr size_t MaxThreads = 64;
+
+    // The merged counters at one moment, with percentiles on demand
+    class Snapshot {
+    public:
+        Snapshot() : counts_(Buckets) {}
+
+        uint64_t count() const { return count_; }
+        uint64_t max() const { return max_; }
+        double mean() const { return count_ == 0 ? 0 : double(sum_) / double(count_); }
+
+        // Smallest value that p percent of the records are at or below (within the bucket precision)
+        uint64_t percentile(double p) const {
+            if (count_ == 0) {
+                return 0;
+            }
+            auto rank = static_cast<uint64_t>(std::max(1.0, p / 100.0 * double(count_) + 0.5));
+            uint64_t seen = 0;
+            for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+                seen += counts_[bucket];
+                if (seen >= std::min(rank, count_)) {
+                    return std::min(highestIn(bucket), max_);
+                }
+            }
+            return max_;
+        }
+
+        // Adds the records of another snapshot, e.g. from another histogram
+        Snapshot& operator+=(const Snapshot& other) {
+            for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+                counts_[bucket] += other.counts_[bucket];
+            }
+            count_ += other.count_;
+            sum_ += other.sum_;
+            max_ = std::max(max_, other.max_);
+            return *this;
+        }
+
+    private:
+        friend class LatencyHistogram;
+
+        std::vector<uint64_t> counts_;
+        uint64_t count_ = 0;
+        uint64_t sum_ = 0;
+        uint64_t max_ = 0;
+    };
+
+    LatencyHistogram() = default;
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    ~LatencyHistogram() {
+        for (auto& recorder : recorders_) {
+            delete recorder.load(std::memory_order_acquire);
+        }
+    }
+
+    // One value, in nanoseconds for the timing helpers; any unit works
+    void record(uint64_t value) {
+        size_t slot = Slots::current();
+        Recorder* recorder = recorders_[slot].load(std::memory_order_acquire);
+        if (recorder == nullptr) {
+            recorder = attach(slot);
+        }
+        value = std::min(value, MaxValue);
+        if (slot == SharedSlot) {
+            recorder->counts[bucketOf(value)].fetch_add(1, std::memory_order_relaxed);
+            recorder->sum.fetch_add(value, std::memory_order_relaxed);
+            uint64_t max = recorder->max.load(std::memory_order_relaxed);
+            while (value > max && !recorder->max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+            }
+            return;
+        }
+        // Only this thread writes these counters: a load and a store, no lock prefix
+        auto& count = recorder->counts[bucketOf(value)];
+        count.store(count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        recorder->sum.store(recorder->sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        if (value > recorder->max.load(std::memory_order_relaxed)) {
+            recorder->max.store(value, std::memory_order_relaxed);
+        }
+    }
+
+    void record(std::chrono::nanoseconds duration) { record(static_cast<uint64_t>(std::max<int64_t>(0, duration.count()))); }
+
+    // Sums the counters of every thread, while they keep recording
+    Snapshot snapshot() const {
+        Snapshot snapshot;
+        for (const auto& slot : recorders_) {
+            const Recorder* recorder = slot.load(std::memory_order_acquire);
+            if (recorder == nullptr) {
+                continue;
+            }
+            for (size_t bucket = 0; bucket < Buckets; ++bucket) {
+                uint64_t count = recorder->counts[bucket].load(std::memory_order_relaxed);
+                snapshot.counts_[bucket] += count;
+                snapshot.count_ += count;
+            }
+            snapshot.sum_ += recorder->sum.load(std::memory_order_relaxed);
+            snapshot.max_ = std::max(snapshot.max_, recorder->max.load(std::memory_order_relaxed));
+        }
+        return snapshot;
+    }
+
+    static size_t bucketOf(uint64_t value) {
+        if (value < SubBuckets) {
+            return static_cast<size_t>(value);
+        }
+        unsigned exponent = highestBit(value); // At least SubBucketBits
+        return static_cast<size_t>((exponent - SubBucketBits + 1) * SubBuckets + (value >> (exponent - SubBucketBits)) - SubBuckets);
+    }
+
+    // Largest value that lands in bucket
+    static uint64_t highestIn(size_t bucket) {
+        if (bucket < SubBuckets) {
+            return bucket;
+        }
+        unsigned exponent = static_cast<unsigned>(bucket / SubBuckets) + SubBucketBits - 1;
+        uint64_t lowest = (SubBuckets + bucket % SubBuckets) << (exponent - SubBucketBits);
+        return lowest + (uint64_t{1} << (exponent - SubBucketBits)) - 1;
+    }
+
+private:
+    static constexpr size_t SharedSlot = ThreadSlots<MaxThreads>::Shared;
+
+    struct Recorder {
+        std::array<std::atomic<uint64_t>, Buckets> counts{};
+        std::atomic<uint64_t> sum{0};
+        std::atomic<uint64_t> max{0};
+    };
+
+    // Slot numbers of the live threads: the next thread with a slot continues on the same counters
+    using Slots = ThreadSlots<MaxThreads>;
+
+    static unsigned highestBit(uint64_t value) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanReverse64(&index, value);
+        return static_cast<unsigned>(index);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(value));
+#endif
+    }
+
+    // The first record of a thread in this histogram; lock free, the loser of a race deletes its copy
+    Recorder* attach(size_t slot) {
+        auto recorder = std::make_unique<Recorder>();
+        Recorder* expected = nullptr;
+        if (recorders_[slot].compare_exchange_strong(expected, recorder.get(), std::memory_order_acq_rel)) {
+            return recorder.release();
+        }
+        return expected;
+    }
+
+    std::array<std::atomic<Recorder*>, MaxThreads + 1> recorders_{};
+};
+
+// Records the time from construction to destruction
+class ScopedLatency {
+public:
+    explicit ScopedLatency(LatencyHistogram& histogram) : histogram_(histogram), start_(std::chrono::steady_clock::now()) {}
+    ScopedLatency(const ScopedLatency&) = delete;
+    ScopedLatency& operator=(const ScopedLatency&) = delete;
+
+    ~ScopedLatency() { histogram_.record(std::chrono::steady_clock::now() - start_); }
+
+private:
+    LatencyHistogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+namespace latency {
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> histograms;
+};
+
+// Never destroyed: threads may still record while static objects are torn down
+inline Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+} // namespace latency
+
+// The histogram with this name, created on first use; keep the reference, the lookup takes a lock
+inline LatencyHistogram& latencyHistogram(const std::string& name) {
+    latency::Registry& registry = latency::registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto& histogram = registry.histograms[name];
+    if (histogram == nullptr) {
+        histogram = std::make_unique<LatencyHistogram>();
+    }
+    return *histogram;
+}
+
+// One line per named histogram with records: count, mean and percentiles in microseconds
+inline void reportLatencies(std::ostream& out) {
+    latency::Registry& registry = latency::registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& [name, histogram] : registry.histograms) {
+        auto snapshot = histogram->snapshot();
+        if (snapshot.count() == 0) {
+            continue;
+        }
+        out << name << ": " << snapshot.count() << " ops, mean " << snapshot.mean() / 1e3 << " us, p50 "
+            << double(snapshot.percentile(50)) / 1e3 << ", p99 " << double(snapshot.percentile(99)) / 1e3 << ", p99.9 "
+            << double(snapshot.percentile(99.9)) / 1e3 << ", max " << double(snapshot.max()) / 1e3 << " us\n";
+    }
+}
+
+template<typename T>
+void timedReset(std::shared_ptr<T>& pointer) {
+    static LatencyHistogram& histogram = latencyHistogram("shared_ptr::reset");
+    ScopedLatency timer(histogram);
+    pointer.reset();
+}
+
+template<typename T>
+std::shared_ptr<T> timedLock(const std::weak_ptr<T>& pointer) {
+    static LatencyHistogram& histogram = latencyHistogram("weak_ptr::lock");
+    ScopedLatency timer(histogram);
+    return pointer.lock();
+}
+
+#define SMARTPOINTERCPP_LATENCY_JOIN2(a, b) a##b
+#define SMARTPOINTERCPP_LATENCY_JOIN(a, b) SMARTPOINTERCPP_LATENCY_JOIN2(a, b)
+
+// Times the rest of the enclosing scope into latencyHistogram(name), with SMARTPOINTERCPP_LATENCY_HOOKS
+#if SMARTPOINTERCPP_LATENCY_HOOKS
+#define SMARTPOINTERCPP_LATENCY_SCOPE(name)                                                                      \
+    static LatencyHistogram& SMARTPOINTERCPP_LATENCY_JOIN(latencyHistogram_, __LINE__) = latencyHistogram(name); \
+    ScopedLatency SMARTPOINTERCPP_LATENCY_JOIN(scopedLatency_, __LINE__)(SMARTPOINTERCPP_LATENCY_JOIN(latencyHistogram_, __LINE__))
+#else
+#define SMARTPOINTERCPP_LATENCY_SCOPE(name) ((void) 0)
+#endif
+
+#endif //SMARTPOINTERCPP_LATENCY_HISTOGRAM_H
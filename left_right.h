@@ -0,0 +1,88 @@
+#ifndef SMARTPOINTERCPP_LEFT_RIGHT_H
+#define SMARTPOINTERCPP_LEFT_RIGHT_H
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+#include "read_indicator.h"
+
+/*
+ *  Left-right: wait free reads of a structure that is read far more often than it is written.
+ *
+ *      LeftRight<Post> post(Post{"Holiday", {}, 1});
+ *      size_t count = post.read([](const Post& p) { return p.comments.size(); });
+ *      post.write([&](Post& p) { p.comments.push_back(comment); });
+ *
+ *  Two copies of the structure are kept. Readers always read the copy that is currently published, they
+ *  never take a lock, never retry and never wait for a writer. A writer (one at a time, behind a mutex):
+ *      1. applies the change to the copy nobody reads,
+ *      2. publishes that copy,
+ *      3. waits until no reader is left on the old copy,
+ *      4. applies the same change to the old copy, so both are equal again.
+ *  The change is run twice, once per copy, so it must do the same thing both times (no moving out of a
+ *  captured variable, no random numbers).
+ *
+ *  Readers announce themselves on a read indicator (read_indicator.h), so concurrent readers do not
+ *  write to the same cache line. Which of the two indicators a reader uses is switched by the writer
+ *  (versionIndex_), so a steady stream of new readers cannot keep the writer waiting forever.
+ *  The price is twice the memory and writes that are more than twice as expensive. See
+ *  smartPointerBench leftright for a comparison with a reader-writer lock and an atomic shared_ptr (RCU style).
+ */
+
+template<typename T>
+class LeftRight {
+public:
+    explicit LeftRight(const T& value = T{}) : instances_{value, value} {}
+
+    LeftRight(const LeftRight&) = delete;
+    LeftRight& operator=(const LeftRight&) = delete;
+
+    // Calls reader(const T&) on the published copy and returns its result
+    template<typename Reader>
+    decltype(auto) read(Reader&& reader) const {
+        size_t version = versionIndex_.load(std::memory_order_seq_cst);
+        ReadGuard guard(indicators_[version]);
+        return std::forward<Reader>(reader)(instances_[leftRight_.load(std::memory_order_seq_cst)]);
+    }
+
+    // Calls writer(T&) on both copies, one after the other, see above
+    template<typename Writer>
+    void write(Writer&& writer) {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        size_t published = leftRight_.load(std::memory_order_relaxed);
+        writer(instances_[1 - published]);
+        leftRight_.store(1 - published, std::memory_order_seq_cst);
+        toggleVersionAndWait();
+        writer(instances_[published]);
+    }
+
+private:
+    class ReadGuard {
+    public:
+        explicit ReadGuard(ReadIndicator& indicator) : indicator_(indicator) { indicator_.arrive(); }
+        ~ReadGuard() { indicator_.depart(); }
+
+    private:
+        ReadIndicator& indicator_;
+    };
+
+    // Moves new readers to the other indicator, then waits until both indicators drained in turn.
+    // Afterwards no reader can still be on the copy that was published before.
+    void toggleVersionAndWait() {
+        size_t previous = versionIndex_.load(std::memory_order_relaxed);
+        size_t next = 1 - previous;
+        indicators_[next].waitUntilEmpty();
+        versionIndex_.store(next, std::memory_order_seq_cst);
+        indicators_[previous].waitUntilEmpty();
+    }
+
+    T instances_[2];
+    std::atomic<size_t> leftRight_{0};     // The copy readers read
+    std::atomic<size_t> versionIndex_{0};  // The indicator new readers arrive on
+    mutable ReadIndicator indicators_[2];
+    std::mutex writeMutex_;
+};
+
+#endif //SMARTPOINTERCPP_LEFT_RIGHT_H
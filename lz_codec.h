@@ -0,0 +1,234 @@
+#ifndef SMARTPOINTERCPP_LZ_CODEC_H
+#define SMARTPOINTERCPP_LZ_CODEC_H
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+/*
+ *  A small LZ77 codec, in the spirit of LZ4, without external dependencies.
+ *
+ *      std::string packed = lzCompress(text);
+ *      std::string again = lzDecompress(packed, text.size());  // The caller keeps the original size
+ *
+ *  The compressed data is a list of sequences: a token byte (literal count in the high nibble, match
+ *  length - 4 in the low one, 15 means "more length bytes follow"), the literals, and a 2 byte offset
+ *  back into the output where the match is copied from. The last sequence only has literals.
+ *  The compressor finds matches through a hash table of the last position of every 4 byte prefix: one
+ *  probe per byte, no search, so it is fast and compresses repetitive text (comments, serialized
+ *  objects) well, but not as tight as zlib.
+ *
+ *  Small inputs (one serialized object) compress much better against an LzDictionary of typical content:
+ *
+ *      LzDictionary dictionary(samples);                 // Some earlier inputs, concatenated
+ *      std::string packed = lzCompress(text, dictionary);
+ *      std::string again = lzDecompress(packed, text.size(), dictionary);
+ *
+ *  lzDecompress checks every length and offset against both buffers and throws std::runtime_error on
+ *  corrupt input instead of reading or writing out of bounds.
+ */
+
+namespace lz {
+
+constexpr size_t MinMatch = 4;
+constexpr size_t LastLiterals = 5;  // The input always ends with literals, matches stop before them
+constexpr size_t MaxOffset = 65535;
+constexpr unsigned HashBits = 12;
+constexpr size_t WildCopy = 16;
+
+inline uint32_t read32(const char* p) {
+    uint32_t value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+inline uint32_t hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - HashBits); }
+
+inline void writeLength(std::string& out, size_t length) {
+    for (; length >= 255; length -= 255) {
+        out.push_back(static_cast<char>(255));
+    }
+    out.push_back(static_cast<char>(length));
+}
+
+inline void writeSequence(std::string& out, const char* literals, size_t literalCount, size_t offset, size_t matchLength) {
+    size_t matchCode = matchLength == 0 ? 0 : matchLength - MinMatch;
+    out.push_back(static_cast<char>((std::min<size_t>(literalCount, 15) << 4) | std::min<size_t>(matchCode, 15)));
+    if (literalCount >= 15) {
+        writeLength(out, literalCount - 15);
+    }
+    out.append(literals, literalCount);
+    if (matchLength == 0) {
+        return; // The last sequence
+    }
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (matchCode >= 15) {
+        writeLength(out, matchCode - 15);
+    }
+}
+
+inline size_t readLength(std::string_view in, size_t& position, size_t length) {
+    if (length != 15) {
+        return length;
+    }
+    for (;;) {
+        if (position >= in.size()) {
+            throw std::runtime_error("lzDecompress: truncated length");
+        }
+        auto byte = static_cast<unsigned char>(in[position++]);
+        length += byte;
+        if (byte != 255) {
+            return length;
+        }
+    }
+}
+
+using Table = std::array<uint32_t, size_t{1} << HashBits>;
+
+// Compresses data[start, size). Matches may reach back into data[0, start), a dictionary whose
+// positions are already in table.
+inline std::string compress(const char* data, size_t start, size_t size, Table& table) {
+    std::string out;
+    out.reserve(size - start + (size - start) / 255 + 16);
+    size_t anchor = start;
+    if (size - start >= MinMatch + LastLiterals) {
+        size_t matchEnd = size - LastLiterals;
+        for (size_t i = start; i + MinMatch <= matchEnd;) {
+            uint32_t sequence = read32(data + i);
+            uint32_t& slot = table[hash(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(i);
+            if (candidate == UINT32_MAX || i - candidate > MaxOffset || read32(data + candidate) != sequence) {
+                ++i;
+                continue;
+            }
+            size_t length = MinMatch;
+            while (i + length < matchEnd && data[candidate + length] == data[i + length]) {
+                ++length;
+            }
+            writeSequence(out, data + anchor, i - anchor, i - candidate, length);
+            i += length;
+            anchor = i;
+        }
+    }
+    writeSequence(out, data + anchor, size - anchor, 0, 0);
+    return out;
+}
+
+// Decompresses in into out[0, size). Matches reaching back before out continue into the end of
+// dictionary. out has WildCopy bytes of slack after size, so short copies can always move whole 8 byte words.
+inline void decompress(std::string_view in, char* out, size_t size, std::string_view dictionary) {
+    size_t ip = 0;
+    size_t op = 0;
+    while (ip < in.size()) {
+        auto token = static_cast<unsigned char>(in[ip++]);
+        size_t literals = readLength(in, ip, token >> 4);
+        if (literals > in.size() - ip || literals > size - op) {
+            throw std::runtime_error("lzDecompress: literals out of bounds");
+        }
+        if (literals <= WildCopy && in.size() - ip >= WildCopy) {
+            std::memcpy(out + op, in.data() + ip, WildCopy); // Most literal runs are short
+        } else {
+            std::memcpy(out + op, in.data() + ip, literals);
+        }
+        ip += literals;
+        op += literals;
+        if (ip == in.size()) {
+            break; // The last sequence has no match
+        }
+        if (in.size() - ip < 2) {
+            throw std::runtime_error("lzDecompress: truncated offset");
+        }
+        size_t offset = static_cast<unsigned char>(in[ip]) | static_cast<size_t>(static_cast<unsigned char>(in[ip + 1])) << 8;
+        ip += 2;
+        size_t length = readLength(in, ip, token & 15) + MinMatch;
+        if (offset == 0 || offset > op + dictionary.size() || length > size - op) {
+            throw std::runtime_error("lzDecompress: match out of bounds");
+        }
+        char* target = out + op;
+        if (offset > op) {
+            // Starts in the dictionary, may run on into the start of out
+            size_t back = offset - op;
+            size_t fromDictionary = std::min(length, back);
+            std::memcpy(target, dictionary.data() + dictionary.size() - back, fromDictionary);
+            for (size_t i = fromDictionary; i < length; ++i) {
+                target[i] = out[i - back];
+            }
+        } else if (offset >= 8) {
+            const char* source = target - offset;
+            for (size_t i = 0; i < length; i += 8) {
+                std::memcpy(target + i, source + i, 8); // May write up to 7 bytes past the match, into the slack
+            }
+        } else {
+            const char* source = target - offset;
+            for (size_t i = 0; i < length; ++i) {
+                target[i] = source[i]; // Overlapping: repeats the last `offset` bytes
+            }
+        }
+        op += length;
+    }
+    if (op != size) {
+        throw std::runtime_error("lzDecompress: size does not match");
+    }
+}
+
+} // namespace lz
+
+// Typical content that small inputs are compressed against, see lzCompress(input, dictionary).
+// One input alone is too short to repeat itself much; against a dictionary its words and phrases
+// become matches. Only the last MaxOffset bytes of the text are kept, older ones are out of reach.
+class LzDictionary {
+public:
+    explicit LzDictionary(std::string_view text)
+            : text_(text.substr(text.size() > lz::MaxOffset ? text.size() - lz::MaxOffset : 0)) {
+        table_.fill(UINT32_MAX);
+        for (size_t i = 0; i + lz::MinMatch <= text_.size(); ++i) {
+            table_[lz::hash(lz::read32(text_.data() + i))] = static_cast<uint32_t>(i);
+        }
+    }
+
+    const std::string& text() const { return text_; }
+    const lz::Table& table() const { return table_; }
+
+private:
+    std::string text_;
+    lz::Table table_; // Filled once, every compression starts from a copy
+};
+
+inline std::string lzCompress(std::string_view input) {
+    lz::Table table;
+    table.fill(UINT32_MAX);
+    return lz::compress(input.data(), 0, input.size(), table);
+}
+
+// Decompress with the same dictionary
+inline std::string lzCompress(std::string_view input, const LzDictionary& dictionary) {
+    std::string data;
+    data.reserve(dictionary.text().size() + input.size());
+    data.append(dictionary.text());
+    data.append(input);
+    lz::Table table = dictionary.table();
+    return lz::compress(data.data(), dictionary.text().size(), data.size(), table);
+}
+
+inline std::string lzDecompress(std::string_view in, size_t originalSize) {
+    std::string out(originalSize + lz::WildCopy, '\0');
+    lz::decompress(in, &out[0], originalSize, {});
+    out.resize(originalSize);
+    return out;
+}
+
+inline std::string lzDecompress(std::string_view in, size_t originalSize, const LzDictionary& dictionary) {
+    std::string out(originalSize + lz::WildCopy, '\0');
+    lz::decompress(in, &out[0], originalSize, dictionary.text());
+    out.resize(originalSize);
+    return out;
+}
+
+#endif //SMARTPOINTERCPP_LZ_CODEC_H
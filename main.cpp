@@ -1,7 +1,41 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
 #include <iostream>
 #include <memory>
+#include <optional>
+#include <thread>
 #include <vector>
 
+#include "cold_comments.h"
+#include "comment_batch.h"
+#include "compact.h"
+#include "factories.h"
+#include "group_by.h"
+#include "hash_join.h"
+#include "hot_cold.h"
+#include "latency_histogram.h"
+#include "left_right.h"
+#include "models.h"
+#include "observer_ptr.h"
+#include "ordered_output.h"
+#include "ownership_advisor.h"
+#include "parallel.h"
+#include "pipeline.h"
+#include "prefetch.h"
+#include "query.h"
+#include "quota_resource.h"
+#include "seqlock.h"
+#include "skip_list.h"
+#include "slab_resource.h"
+#include "snapshot.h"
+#include "spill.h"
+#include "text_store.h"
+#include "tiered_store.h"
+#include "trace.h"
+#include "workload_backends.h"
+
 /*
  * Auther: Aman Arabzadeh
  * Date: 2023-07-09
@@ -10,42 +44,6 @@
  *  https://github.com/AMAN-ARABZADEH/Smart_Pointers_Cpp/tree/main
  */
 
-struct Person {
-    std::string name{};
-    std::string address{};
-    size_t age{};
-
-};
-// Overloading the stream insertion operator (<<) for Person
-std::ostream& operator<<(std::ostream& os, const Person& person) {
-    os << "Name: " << person.name << std::endl;
-    os << "Address: " << person.address << std::endl;
-    os << "Age: " << person.age << std::endl;
-    return os;
-}
-
-// Example for using weak_ptr
-// Imagine the chicken and egg problem, Which one came first?
-
-// Forward declaration of Post to assure the compiler that it exists.
-struct Post;
-
-// Comment struct with a weak reference to the corresponding post
-struct Comment {
-    std::string text;
-    std::weak_ptr<Post> post;
-};
-
-// Post struct with a vector of shared pointers to comments
-struct Post {
-    std::string content;
-    std::vector<std::shared_ptr<Comment>> comments;
-};
-
-
-
-
-
 // Problem with Raw Pointers:
 // Raw pointers require manual memory management, leading to potential memory leaks and dangling pointers.
 template<typename T>
@@ -115,6 +113,527 @@ void weakPtrExample(T value) {
     // weakPtr becomes empty if the object is deleted
 }
 
+// Example 4: Parallel group-by over Persons
+// Count Persons per age bucket (10 years) and per address, using several threads.
+// The same operator works on a vector of smart pointers and on one column of a PersonTable.
+void groupByExample() {
+    std::vector<std::shared_ptr<Person>> people;
+    PersonTable table;
+    for (size_t i = 0; i < 1000; ++i) {
+        auto person = std::make_shared<Person>(Person{"Person " + std::to_string(i),
+                                                      "Address " + std::to_string(i % 7), 18 + i % 60});
+        table.push_back(*person);
+        people.push_back(std::move(person));
+    }
+
+    auto perBucket = parallelCountBy(people.begin(), people.end(),
+                                     [](const Person& person) { return person.age / 10 * 10; });
+    for (size_t bucket = 10; bucket < 80; bucket += 10) {
+        std::cout << "Age " << bucket << "-" << bucket + 9 << ": " << perBucket[bucket] << std::endl;
+    }
+
+    // High cardinality keys go through the radix partitioned variant
+    auto perAddress = radixCountBy(people.begin(), people.end(),
+                                   [](const Person& person) { return person.address; });
+    std::cout << "Distinct addresses: " << perAddress.size() << std::endl;
+
+    // Columnar input: only the age column is read
+    auto perAge = parallelCountBy(table.age.begin(), table.age.end(), [](size_t age) { return age; });
+    std::cout << "Distinct ages: " << perAge.size() << std::endl;
+}
+
+// Example 5: Hash join between Posts and Persons
+// Every Post stores the id of its author. Instead of looking up the author of every Post on its own,
+// the join builds one hash table over the Persons and probes it with all Posts at once.
+void hashJoinExample() {
+    std::vector<std::unique_ptr<Person>> authors;
+    authors.push_back(std::make_unique<Person>(Person{"John Doe", "123 London St", 30, 1}));
+    authors.push_back(std::make_unique<Person>(Person{"Jane Smith", "456 Oslo St", 25, 2}));
+
+    std::vector<std::shared_ptr<Post>> feed;
+    for (size_t authorId : {2, 1, 2}) {
+        auto post = std::make_shared<Post>();
+        post->content = "Post number " + std::to_string(feed.size() + 1);
+        post->authorId = authorId;
+        feed.push_back(std::move(post));
+    }
+
+    HashJoin join;
+    join.build(authors.begin(), authors.end(), [](const Person& person) { return person.id; });
+    auto matches = join.probe(feed.begin(), feed.end(), [](const Post& post) { return post.authorId; });
+    for (const auto& match : matches) {
+        std::cout << feed[match.probeRow]->content << " by " << authors[match.buildRow]->name << std::endl;
+    }
+}
+
+// Example 6: Fused predicate expressions
+// where(...) turns an expression over Person attributes into one query that filters in a single pass,
+// instead of chaining one lambda (and one pass) per condition.
+void queryExample() {
+    using namespace query;
+    std::vector<std::unique_ptr<Person>> people;
+    PersonTable table;
+    for (const auto& person : {Person{"John Doe", "123 London St", 30, 1}, Person{"Jane Smith", "456 Oslo St", 45, 2},
+                               Person{"Mona Lisa", "Paris", 520, 3}, Person{"Jack Black", "789 Rome St", 52, 4}}) {
+        people.push_back(std::make_unique<Person>(person));
+        table.push_back(person);
+    }
+
+    auto olderJs = where(age > 30 && name.startsWith("J"));
+    for (size_t row : olderJs.rows(people.begin(), people.end())) {
+        std::cout << *people[row] << std::endl;
+    }
+
+    // The same query on the columnar table runs block by block over the columns
+    std::cout << "Matching rows in the table: " << olderJs.count(table) << std::endl;
+    // And it can be used as a plain predicate
+    std::cout << "Not from Paris: "
+              << std::count_if(people.begin(), people.end(), where(!(address == "Paris"))) << std::endl;
+}
+
+// Example 7: Streaming Persons in batches
+// The records are produced, filtered and consumed batch by batch, so only a few batches are in memory
+// at any time instead of all Persons at once. Batches are handed between the stages as std::unique_ptr.
+void pipelineExample() {
+    using namespace query;
+    size_t produced = 0;
+    auto readPerson = [&produced]() -> std::optional<Person> {
+        if (produced == 10000) {
+            return std::nullopt; // End of the input
+        }
+        ++produced;
+        return Person{"Person " + std::to_string(produced), "Address", produced % 90, produced};
+    };
+
+    size_t batches = 0;
+    size_t names = Stream<Person>::generate(readPerson, 1000)
+            .filter(where(age >= 65))
+            .map([](Person person) { return std::move(person.name); })
+            .rebatch(500)
+            .sink([&batches](std::vector<std::string>&) { ++batches; });
+    std::cout << "Read " << produced << " Persons, " << names << " are 65 or older, delivered in "
+              << batches << " batches of at most 500" << std::endl;
+}
+
+// Example 8: Memory budgets per subsystem
+// The post cache gets its own budget inside the budget of the process. When the cache grows past its soft
+// limit it is asked to shed load, and past its hard limit only the cache fails, not the whole process.
+void quotaExample() {
+    QuotaResource process("process", 8 << 20, 16 << 20);
+    QuotaResource postCache("post cache", 256 << 10, 512 << 10, &process);
+
+    std::vector<std::shared_ptr<Post>> cache;
+    postCache.onSoftLimit([&cache](QuotaResource& resource) {
+        std::cout << resource.name() << " is over its soft limit with " << cache.size()
+                  << " posts, dropping the oldest half" << std::endl;
+        cache.erase(cache.begin(), cache.begin() + static_cast<std::ptrdiff_t>(cache.size() / 2));
+    });
+
+    try {
+        for (size_t i = 0; i < 10000; ++i) {
+            auto post = makeSharedIn<Post>(postCache);
+            post->content = "Post " + std::to_string(i);
+            cache.push_back(std::move(post));
+        }
+    } catch (const std::bad_alloc&) {
+        std::cout << postCache.name() << " hit its hard limit" << std::endl;
+    }
+    std::cout << "Posts in the cache: " << cache.size() << ", bytes reserved by the process: "
+              << process.reserved() << std::endl;
+}
+
+// Example 9: Slab allocator for the smart pointer factories
+// Person, Comment and Post only need a few different block sizes. The slab keeps blocks of the same
+// size together in pages per thread, and returns pages to the operating system when they are empty again.
+void slabExample() {
+    SlabResource slab;
+    {
+        std::vector<std::shared_ptr<Person>> people;
+        for (size_t i = 0; i < 10000; ++i) {
+            people.push_back(makeSharedIn<Person>(slab, "Person " + std::to_string(i), "Address", i % 90, i));
+        }
+        auto post = makeSharedIn<Post>(slab);
+        auto comment = makeSharedIn<Comment>(slab, "I like it.", post);
+        post->comments.push_back(comment);
+        std::cout << "Pages mapped for 10000 Persons: " << slab.stats().pagesMapped << std::endl;
+    }
+    auto stats = slab.stats();
+    std::cout << "Pages returned after they were destroyed: " << stats.pagesReturned << " of " << stats.pagesMapped
+              << std::endl;
+}
+
+// Example 10: Pooled operator new
+// Person, Comment and Post declare their own operator new (POOLED_NEW in models.h), so even a plain
+// std::make_unique<Person>() takes its memory from a per type pool with a free list per thread.
+void pooledNewExample() {
+    size_t before = TypePool<Person>::blocksCreated();
+    std::vector<std::unique_ptr<Person>> people;
+    for (size_t i = 0; i < 1000; ++i) {
+        people.push_back(std::make_unique<Person>());
+    }
+    people.clear(); // The blocks go back to this thread's free list ...
+    for (size_t i = 0; i < 1000; ++i) {
+        people.push_back(std::make_unique<Person>()); // ... and are used again here
+    }
+    std::cout << "Pool blocks created for 2 x 1000 Persons: " << TypePool<Person>::blocksCreated() - before
+              << std::endl;
+}
+
+// Example 11: Hot/cold field splitting
+// SplitVector<Person> keeps age and id of all Persons together and the strings in a second vector,
+// while person.age, person.name ... still work as with a plain Person.
+void hotColdExample() {
+    SplitVector<Person> people;
+    people.push_back(Person{"John Doe", "123 London St", 30, 1});
+    people.push_back(Person{"Jane Smith", "456 Oslo St", 25, 2});
+
+    size_t totalAge = 0;
+    for (auto person : people) {
+        totalAge += person.age; // Only the hot part is read
+    }
+    people[1].address = "789 Paris St"; // Writes go to the stored record
+    std::cout << "Total age: " << totalAge << std::endl;
+    std::cout << people.at(1);
+}
+
+// Example 12: Prefetching while iterating over pointers
+// The Persons behind the shared pointers can be anywhere on the heap. prefetched(...) asks the CPU to load
+// the Person a few elements ahead, so it is already in cache when the loop reaches it.
+void prefetchExample() {
+    std::vector<std::shared_ptr<Person>> people;
+    for (size_t i = 0; i < 100000; ++i) {
+        people.push_back(std::make_shared<Person>(Person{"Person " + std::to_string(i), "Address", i % 90, i}));
+    }
+    size_t longNames = 0;
+    auto view = prefetched(people); // No distance: tuned while iterating
+    for (const auto& person : view) {
+        longNames += person->name.size() > 11;
+    }
+    std::cout << "Persons with a long name: " << longNames << ", prefetch distance used: " << view.distance()
+              << std::endl;
+}
+
+// Example 13: Moving the Persons behind a vector of unique_ptr next to each other
+void compactExample() {
+    std::vector<std::unique_ptr<Person>> people;
+    std::vector<std::unique_ptr<Person>> temporary;
+    for (size_t i = 0; i < 1000; ++i) {
+        people.push_back(std::make_unique<Person>(Person{"Person " + std::to_string(i), "Address", i % 90, i}));
+        temporary.push_back(std::make_unique<Person>()); // Allocated in between, so the Persons are spread out
+    }
+    temporary.clear();
+    auto distance = [&] { return reinterpret_cast<char*>(people[1].get()) - reinterpret_cast<char*>(people[0].get()); };
+    std::cout << "Distance between the first two Persons before: " << distance() << " bytes" << std::endl;
+    compact(people);
+    std::cout << "Distance between the first two Persons after: " << distance() << " bytes" << std::endl;
+    std::cout << "Still the same Person: " << *people[1] << std::endl;
+}
+
+// Example 14: A non owning pointer that knows when its object is gone (in checked builds)
+void observerExample() {
+    auto person = std::make_unique<Person>(Person{"John Doe", "123 London St", 30});
+    observer_ptr<Person> observer = make_observer(person); // Instead of Person* rawPtr = person.get()
+    std::cout << "Observed: " << observer->name << ", alive: " << observer.alive() << std::endl;
+    person.reset();
+    if (observer_ptr<Person>::Checked) {
+        // Dereferencing now would print "observer_ptr: use after free" and abort
+        std::cout << "After reset, alive: " << observer.alive() << std::endl;
+    } else {
+        std::cout << "Release build: observer_ptr is a bare pointer, nothing is checked" << std::endl;
+    }
+}
+
+// Example 15: Readers that never wait for the writer of a Post
+void leftRightExample() {
+    LeftRight<Post> post(Post{"A photo of the mountains", {}, 1});
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        for (int i = 0; i < 100; ++i) {
+            auto comment = std::make_shared<Comment>(Comment{"Beautiful shot!", {}});
+            post.write([&](Post& p) { p.comments.push_back(comment); }); // Runs on both copies
+            std::this_thread::yield(); // Let the reader in between the writes, even on one core
+        }
+        done.store(true);
+    });
+    size_t seen = 0;
+    while (!done.load()) { // Read for as long as the writer writes
+        seen = std::max(seen, post.read([](const Post& p) { return p.comments.size(); }));
+    }
+    writer.join();
+    std::cout << "Most comments seen while writing: " << seen << ", at the end: "
+              << post.read([](const Post& p) { return p.comments.size(); }) << std::endl;
+}
+
+// Example 16: Reading age and id together without a lock
+void seqlockExample() {
+    Seqlock<PersonHot> scalars(PersonHot{30, 1}); // The trivially copyable part of a Person (hot_cold.h)
+    std::atomic<bool> done{false};
+    std::thread birthday([&] {
+        for (int i = 0; i < 1000; ++i) {
+            scalars.update([](PersonHot& person) { ++person.age; ++person.id; }); // id stays age - 29
+            std::this_thread::yield(); // Let the reader in between the writes, even on one core
+        }
+        done.store(true);
+    });
+    size_t reads = 0;
+    bool consistent = true;
+    while (!done.load()) {
+        PersonHot seen = scalars.load(); // Always a whole record, never half of a write
+        consistent = consistent && seen.id == seen.age - 29;
+        ++reads;
+    }
+    birthday.join();
+    std::cout << reads << " reads while writing, " << (consistent ? "all" : "not all") << " consistent, final age "
+              << scalars.load().age << " after " << scalars.version() << " writes" << std::endl;
+}
+
+// Example 17: An ordered index on age that writers and readers use at the same time
+void skipListExample() {
+    PersonAgeIndex index;
+    std::atomic<bool> done{false};
+    std::thread writer([&] {
+        for (size_t i = 0; i < 1000; ++i) {
+            auto person = std::make_shared<Person>(Person{"Person " + std::to_string(i), "Address", 20 + i % 50, i});
+            index.insert(ageKey(*person), person);
+            std::this_thread::yield(); // Let the reader in between the inserts, even on one core
+        }
+        done.store(true);
+    });
+    size_t scans = 0;
+    size_t thirties = 0;
+    while (!done.load()) { // Scan for as long as the writer inserts
+        size_t now = 0;
+        for (const auto& entry : index.range(AgeKey{30, 0}, AgeKey{40, 0})) { // Whatever is there right now
+            now += entry.value->age / 10 == 3;
+        }
+        thirties = std::max(thirties, now);
+        ++scans;
+    }
+    writer.join();
+    std::cout << "Most persons in their thirties seen in " << scans << " scans while inserting: " << thirties
+              << ", afterwards: ";
+    thirties = 0;
+    for (const auto& entry : index.range(AgeKey{30, 0}, AgeKey{40, 0})) {
+        thirties += entry.value->age / 10 == 3;
+    }
+    std::cout << thirties << " of " << index.size() << std::endl;
+}
+
+// Example 18: Adding a batch of comments with one allocation
+void appendCommentsExample() {
+    auto post = std::make_shared<Post>(Post{"A photo of the mountains", {}, 1});
+    std::vector<CommentInit> texts = {{"Beautiful shot!"}, {"I like it."}, {"Where was this?"}};
+    appendComments(post, texts.begin(), texts.end());
+    for (const auto& comment : post->comments) {
+        std::cout << comment->text << " (on \"" << comment->post.lock()->content << "\")" << std::endl;
+    }
+    // All three share one control block
+    std::cout << "use_count of the batch: " << post->comments.front().use_count() << std::endl;
+
+    // The batch for the sea photo points to that Post, not to the mountains
+    auto sea = std::make_shared<Post>(Post{"A photo of the sea", {}, 1});
+    LeftRight<Post> shared(*sea);
+    appendComments(shared, makeComments(sea, texts.begin(), texts.end())); // Readers see all three or none
+    std::cout << "Comments published: " << shared.read([](const Post& p) { return p.comments.size(); }) << std::endl;
+}
+
+// Example 19: Equal comment texts share one buffer
+void textStoreExample() {
+    auto post = std::make_shared<Post>(Post{"A photo of the mountains", {}, 1});
+    auto other = std::make_shared<Post>(Post{"A photo of the sea", {}, 1});
+    auto first = std::make_shared<Comment>(Comment{"Beautiful shot!", post});
+    auto second = std::make_shared<Comment>(Comment{"Beautiful shot!", other});
+    std::cout << first->text << " / " << second->text << ", one buffer: "
+              << first->text.sharesBufferWith(second->text) << std::endl;
+
+    TextStoreStats stats = TextStore::global().stats();
+    std::cout << "Texts stored: " << stats.uniqueTexts << ", dedup ratio: " << stats.dedupRatio() << std::endl;
+}
+
+// Example 20: Moving the text of old comments into compressed blocks
+void coldCommentsExample() {
+    auto post = std::make_shared<Post>(Post{"A photo from last year", {}, 1});
+    std::vector<CommentInit> texts = {{"Beautiful shot!"}, {"I like it."}, {"Beautiful colors, I like it!"}};
+    appendComments(post, texts.begin(), texts.end());
+
+    ColdCommentStore archive;
+    std::vector<ColdCommentStore::Id> ids = archive.archive(*post); // The comments now hold an empty text
+    archive.seal();
+    for (auto id : ids) {
+        std::cout << archive.text(id) << std::endl; // The first read decompresses the block
+    }
+    auto stats = archive.stats();
+    std::cout << stats.rawBytes << " bytes of text in " << stats.compressedBytes << " compressed bytes, cache hits: "
+              << stats.cacheHits << std::endl;
+}
+
+// Example 21: Spilling a Post to disk when its last owner lets go, and fetching it back
+void spillExample() {
+    SpillStore spill((std::filesystem::temp_directory_path() / "smartPointerCpp.spill").string());
+    std::shared_ptr<Post> post = spill.make(Post{"Holiday pictures", {}, 1});
+    std::vector<CommentInit> texts = {{"Nice beach!"}, {"Where is this?"}};
+    appendComments(post, texts.begin(), texts.end());
+
+    SpillRef<Post> ref(post);
+    post.reset(); // Written to the spill file instead of being lost
+    std::cout << "In memory: " << (ref.lock() != nullptr) << ", spilled: " << ref.spilled() << std::endl;
+
+    std::shared_ptr<Post> again = ref.fetch().get(); // Read back by the loader thread of the store
+    std::cout << again->content << " with " << again->comments.size() << " comments:" << std::endl;
+    for (const auto& comment : again->comments) {
+        std::cout << comment->text << " (on " << comment->post.lock()->content << ")" << std::endl;
+    }
+    // again goes before spill: every Post of a store must be gone before the store
+}
+
+// Example 22: Keeping Posts hot, warm (compressed) or cold (in a mapped file) by how often they are read
+void tieredStoreExample() {
+    TieredStoreOptions options;
+    options.hotBytes = 2048; // Room for a few Posts only, to see them move
+    options.warmBytes = 512;
+    TieredPostStore store((std::filesystem::temp_directory_path() / "smartPointerCpp.cold").string(), options);
+    std::vector<TieredPostStore::Id> ids;
+    for (size_t i = 0; i < 20; ++i) {
+        Post post{"Post number " + std::to_string(i), {}, 1};
+        post.comments.push_back(std::make_shared<Comment>(Comment{"Nice one!", {}}));
+        ids.push_back(store.add(std::move(post)));
+    }
+    for (int round = 0; round < 3; ++round) {
+        store.get(ids[0]); // Popular: promoted back to hot
+    }
+    const char* names[] = {"hot", "warm", "cold"};
+    for (size_t i : {size_t{0}, size_t{1}, size_t{19}}) {
+        auto tier = static_cast<int>(store.tier(ids[i]));
+        std::cout << store.get(ids[i])->content << " was " << names[tier] << std::endl; // Unpacked if it was not hot
+    }
+    auto stats = store.stats();
+    std::cout << stats.hot << " hot, " << stats.warm << " warm, " << stats.cold << " cold Posts" << std::endl;
+}
+
+// Example 23: Writing the objects to a snapshot and starting from it instead of building them again
+void snapshotExample() {
+    std::vector<std::shared_ptr<Person>> persons = {std::make_shared<Person>(Person{"John Doe", "123 London St", 30, 1}),
+                                                    std::make_shared<Person>(Person{"Jane Doe", "123 London St", 28, 2})};
+    auto post = std::make_shared<Post>(Post{"Our new house", {}, 2});
+    post->comments.push_back(std::make_shared<Comment>(Comment{"Congratulations!", post}));
+    post->comments.push_back(std::make_shared<Comment>(Comment{"Looks great", post}));
+    std::vector<std::shared_ptr<Post>> posts = {post};
+
+    std::string path = (std::filesystem::temp_directory_path() / "smartPointerCpp.snapshot").string();
+    std::cout << "Snapshot of " << writeSnapshot(path, persons, posts) << " bytes written" << std::endl;
+
+    auto snapshot = Snapshot::open(path); // What the next start would do: map it and fix the pointers up
+    for (const SnapshotPost& item : snapshot->posts()) {
+        std::cout << item.content << " by " << item.author->name << ":" << std::endl;
+        for (size_t c = 0; c < item.commentCount; ++c) {
+            std::cout << "  " << item.comments[c].text << " (on " << item.comments[c].post->content << ")" << std::endl;
+        }
+    }
+    std::remove(path.c_str()); // The mapping stays valid until snapshot is gone
+}
+
+// Example 24: Printing from several threads, in the same order every time
+void orderedOutputExample() {
+    std::vector<Person> persons;
+    for (size_t i = 0; i < 6; ++i) {
+        persons.push_back(Person{"Person " + std::to_string(i), "123 London St", 20 + i, i});
+    }
+    OrderedOutput out(std::cout);
+    parallelSlices(persons.size(), 3, [&](size_t thread, size_t begin, size_t end) {
+        OrderedOutput::Producer producer(out); // One per thread, formats without touching std::cout
+        for (size_t i = begin; i < end; ++i) {
+            producer.record(i) << "(from thread " << thread << ") " << persons[i];
+        }
+    });
+    out.finish(); // Person 0 to 5, in order, whichever thread finished first
+}
+
+// Example 25: A small synthetic load: Zipf popular Posts, 90% reads and 10% new comments, on 2 threads
+void workloadExample() {
+    WorkloadOptions options;
+    options.persons = 100;
+    options.posts = 1000;
+    options.threads = 2;
+    options.operations = 20000;
+    SocialGraph graph = generateGraph(options);
+    WorkloadPlan plan = generateOperations(options); // The same options give the same operations
+
+    SharedPtrBackend backend;
+    backend.load(graph);
+    WorkloadResult result = runWorkload(backend, plan, graph);
+    std::cout << result.backend << ": " << result.reads << " reads, " << result.writes << " comments on "
+              << result.threads << " threads" << std::endl;
+    std::cout << "  " << static_cast<size_t>(result.throughput()) << " operations/s, p50 " << result.p50
+              << " us, p99 " << result.p99 << " us" << std::endl;
+}
+
+// Example 26: Recording what happens to the smart pointers, and replaying it against another backend
+void traceExample() {
+    TraceRecorder recorder;
+    {
+        TraceRecorder::Thread trace(recorder);
+        auto post = std::make_shared<Post>(Post{"Holiday in Rome", {}, 1});
+        trace.create(&post, post->content.size());
+        std::weak_ptr<Post> watcher = post;
+        trace.observe(&watcher, &post);
+        post->comments.push_back(std::make_shared<Comment>(Comment{"Beautiful!", post}));
+        trace.append(&post, 10);
+        auto reader = post;
+        trace.copy(&reader, &post);
+        post.reset();
+        trace.reset(&post);
+        reader.reset();
+        trace.reset(&reader);
+        auto locked = watcher.lock(); // Fails, the last owner is gone
+        trace.lock(&locked, &watcher);
+    }
+    Trace trace = recorder.trace();
+    std::cout << "Recorded " << trace.events() << " operations in " << trace.bytes() << " bytes" << std::endl;
+
+    SlabOwnership slab;
+    ReplayResult result = replayTrace(trace, slab);
+    std::cout << "Replayed with " << result.backend << ": " << result.locks << " lock, "
+              << result.lockFailures << " failed" << std::endl;
+}
+
+// Example 27: The distribution of reset() times, cheap enough to record every single one
+void latencyHistogramExample() {
+    LatencyHistogram resets;
+    for (size_t i = 0; i < 1000; ++i) {
+        auto post = std::make_shared<Post>(Post{"Post " + std::to_string(i), {}, 0});
+        for (size_t c = 0; c < i % 20; ++c) { // The last owner frees all comments too
+            post->comments.push_back(std::make_shared<Comment>(Comment{"Comment " + std::to_string(c), post}));
+        }
+        ScopedLatency timer(resets);
+        post.reset();
+    }
+    auto snapshot = resets.snapshot(); // Any time, also while other threads record
+    std::cout << snapshot.count() << " resets: p50 " << snapshot.percentile(50) << " ns, p99 " << snapshot.percentile(99)
+              << " ns, max " << snapshot.max() << " ns" << std::endl;
+}
+
+// Example 28: Asking which shared_ptrs could be something cheaper
+void ownershipAdvisorExample() {
+    // The ADVISED_... macros pick their site themselves, with SMARTPOINTERCPP_OWNERSHIP_ADVISOR=1
+    auto& personSite = ownershipSite(__FILE__, __LINE__, "personPtrSimple2", OwnershipSite::Kind::MakeShared);
+    auto& postSite = ownershipSite(__FILE__, __LINE__, "post", OwnershipSite::Kind::MakeShared);
+    auto& lockSite = ownershipSite(__FILE__, __LINE__, "comment->post.lock()", OwnershipSite::Kind::Lock);
+    size_t commentCount = 0;
+    for (size_t i = 0; i < 100; ++i) {
+        auto personPtrSimple2 = advisedMakeShared<Person>(personSite)(Person{"Jane Smith", "456 Elm St", 25, i});
+        auto post = advisedMakeShared<Post>(postSite)(Post{"Post by " + personPtrSimple2->name, {}, personPtrSimple2->id});
+        post->comments.push_back(std::make_shared<Comment>(Comment{"Nice!", post}));
+        auto feed = advisedCopy(post); // A second owner, on the same thread
+        for (const auto& comment : feed->comments) {
+            if (auto owner = advisedLock(lockSite, comment->post)) {
+                commentCount += owner->comments.size();
+            }
+        }
+    }
+    std::cout << commentCount << " comments read" << std::endl;
+    reportOwnership(std::cout);
+}
+
 int main() {
     rawPointerExample<int>(5);
 
@@ -364,5 +883,81 @@ int main() {
      https://en.cppreference.com/w/cpp/memory/weak_ptr
      https://en.cppreference.com/w/cpp/memory/shared_ptr
      */
+
+    std::cout << "\n=========== Example using parallel group-by ===========\n\n";
+    groupByExample();
+
+    std::cout << "\n=========== Example using a hash join ===========\n\n";
+    hashJoinExample();
+
+    std::cout << "\n=========== Example using fused query expressions ===========\n\n";
+    queryExample();
+
+    std::cout << "\n=========== Example using a streaming pipeline ===========\n\n";
+    pipelineExample();
+
+    std::cout << "\n=========== Example using memory budgets ===========\n\n";
+    quotaExample();
+
+    std::cout << "\n=========== Example using a slab allocator ===========\n\n";
+    slabExample();
+
+    std::cout << "\n=========== Example using a pooled operator new ===========\n\n";
+    pooledNewExample();
+
+    std::cout << "\n=========== Example using hot/cold field splitting ===========\n\n";
+    hotColdExample();
+
+    std::cout << "\n=========== Example using prefetching iteration ===========\n\n";
+    prefetchExample();
+
+    std::cout << "\n=========== Example using compaction ===========\n\n";
+    compactExample();
+
+    std::cout << "\n=========== Example using observer_ptr ===========\n\n";
+    observerExample();
+
+    std::cout << "\n=========== Example using left-right ===========\n\n";
+    leftRightExample();
+
+    std::cout << "\n=========== Example using a seqlock ===========\n\n";
+    seqlockExample();
+
+    std::cout << "\n=========== Example using a concurrent skip list ===========\n\n";
+    skipListExample();
+
+    std::cout << "\n=========== Example using batched comments ===========\n\n";
+    appendCommentsExample();
+
+    std::cout << "\n=========== Example using deduplicated comment text ===========\n\n";
+    textStoreExample();
+
+    std::cout << "\n=========== Example using compressed cold comments ===========\n\n";
+    coldCommentsExample();
+
+    std::cout << "\n=========== Example using spilled Posts ===========\n\n";
+    spillExample();
+
+    std::cout << "\n=========== Example using tiered Post storage ===========\n\n";
+    tieredStoreExample();
+
+    std::cout << "\n=========== Example using a snapshot ===========\n\n";
+    snapshotExample();
+
+    std::cout << "\n=========== Example using ordered output from threads ===========\n\n";
+    orderedOutputExample();
+
+    std::cout << "\n=========== Example using a synthetic workload ===========\n\n";
+    workloadExample();
+
+    std::cout << "\n=========== Example using a recorded trace ===========\n\n";
+    traceExample();
+
+    std::cout << "\n=========== Example using a latency histogram ===========\n\n";
+    latencyHistogramExample();
+
+    std::cout << "\n=========== Example using the ownership advisor ===========\n\n";
+    ownershipAdvisorExample();
+
     return 0;
 }
@@ -0,0 +1,108 @@
+#ifndef SMARTPOINTERCPP_MODELS_H
+#define SMARTPOINTERCPP_MODELS_H
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "pooled_new.h"
+#include "text_store.h"
+
+/*
+ *  The data model shared by the examples in main.cpp and the helper headers.
+ *  Person is the record we allocate with the different smart pointers,
+ *  Post and Comment show the shared_ptr / weak_ptr relationship.
+ */
+
+struct Person {
+    POOLED_NEW(Person) // new Person and std::make_unique<Person> take their memory from a pool
+
+    std::string name{};
+    std::string address{};
+    size_t age{};
+    size_t id{}; // Unique key, used to join Posts to their author
+
+};
+// Overloading the stream insertion operator (<<) for Person
+inline std::ostream& operator<<(std::ostream& os, const Person& person) {
+    os << "Name: " << person.name << std::endl;
+    os << "Address: " << person.address << std::endl;
+    os << "Age: " << person.age << std::endl;
+    return os;
+}
+
+// Example for using weak_ptr
+// Imagine the chicken and egg problem, Which one came first?
+
+// Forward declaration of Post to assure the compiler that it exists.
+struct Post;
+
+// Comment struct with a weak reference to the corresponding post
+struct Comment {
+    POOLED_NEW(Comment)
+
+    SharedText text; // Interned: equal texts share one buffer (text_store.h)
+    std::weak_ptr<Post> post;
+};
+
+// Post struct with a vector of shared pointers to comments
+struct Post {
+    POOLED_NEW(Post)
+
+    std::string content;
+    std::vector<std::shared_ptr<Comment>> comments;
+    size_t authorId{}; // Person::id of the author
+};
+
+
+// Columnar (structure of arrays) view of many Persons.
+// Every attribute lives in its own contiguous vector, so a scan over one
+// attribute (for example age) never touches the others.
+struct PersonTable {
+    std::vector<std::string> name;
+    std::vector<std::string> address;
+    std::vector<size_t> age;
+    std::vector<size_t> id;
+
+    size_t size() const { return age.size(); }
+
+    void push_back(const Person& person) {
+        name.push_back(person.name);
+        address.push_back(person.address);
+        age.push_back(person.age);
+        id.push_back(person.id);
+    }
+
+    Person at(size_t row) const {
+        return Person{name.at(row), address.at(row), age.at(row), id.at(row)};
+    }
+};
+
+
+// elementRef lets the algorithms in the helper headers accept containers of
+// values as well as containers of (smart) pointers:
+// Person, Person*, std::unique_ptr<Person> and std::shared_ptr<Person> all give a Person&.
+template<typename T>
+struct IsPointerLike : std::false_type {};
+
+template<typename T>
+struct IsPointerLike<T*> : std::true_type {};
+
+template<typename T, typename D>
+struct IsPointerLike<std::unique_ptr<T, D>> : std::true_type {};
+
+template<typename T>
+struct IsPointerLike<std::shared_ptr<T>> : std::true_type {};
+
+template<typename T>
+decltype(auto) elementRef(T& element) {
+    if constexpr (IsPointerLike<std::remove_cv_t<T>>::value) {
+        return *element;
+    } else {
+        return (element); // Parentheses keep decltype(auto) a reference
+    }
+}
+
+#endif //SMARTPOINTERCPP_MODELS_H
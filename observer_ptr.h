@@ -0,0 +1,219 @@
+#ifndef SMARTPOINTERCPP_OBSERVER_PTR_H
+#define SMARTPOINTERCPP_OBSERVER_PTR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <type_traits>
+#include <unordered_map>
+
+#include "pooled_new.h"
+
+/*
+ *  A non owning pointer that catches use after free in checked builds.
+ *
+ *      auto person = std::make_unique<Person>(Person{"John Doe", "123 London St", 30});
+ *      observer_ptr<Person> observer = make_observer(person);
+ *      std::cout << observer->name;    // Fine
+ *      person.reset();
+ *      std::cout << observer->name;    // Checked build: prints "observer_ptr: use after free" and aborts
+ *
+ *  The interface follows std::experimental::observer_ptr. It says "I do not own this" where a raw pointer
+ *  (rawPointerExample in main.cpp) says nothing.
+ *
+ *  Checked builds (SMARTPOINTERCPP_CHECKED_POINTERS=1, the default without NDEBUG) keep a side table with a
+ *  generation per observed address. The first observer of an address registers it with a generation never
+ *  used before; freeing the object (retireObserved) drops the entry, so every later dereference through an
+ *  old observer finds no or a different generation and traps, even when the address was reused for a new
+ *  object. Person, Comment and Post retire themselves in their pooled operator delete (pooled_new.h) once
+ *  an observer exists, which covers new and std::make_unique but not std::make_shared. For other objects
+ *  call retireObserved(pointer) before the memory is freed.
+ *
+ *  Release builds hold only the pointer: observer_ptr<T> has the size of T*, is trivially copyable and
+ *  every member is an inline one liner, so it compiles to the same code as a raw pointer
+ *  (smartPointerBench observer compares both).
+ */
+
+#ifndef SMARTPOINTERCPP_CHECKED_POINTERS
+#ifdef NDEBUG
+#define SMARTPOINTERCPP_CHECKED_POINTERS 0
+#else
+#define SMARTPOINTERCPP_CHECKED_POINTERS 1
+#endif
+#endif
+
+#if SMARTPOINTERCPP_CHECKED_POINTERS
+
+// Generation of every address an observer_ptr currently watches. An address is registered by the
+// first observer of it and dropped again when the object is freed, so a free of an object nobody
+// observed costs one atomic load. Sharded, so threads freeing different objects rarely wait for each
+// other.
+class GenerationTable {
+public:
+    static GenerationTable& instance() {
+        static GenerationTable* table = new GenerationTable(); // Never destroyed, frees happen until the very end
+        return *table;
+    }
+
+    // Registers address and returns its generation, a number never handed out before
+    uint64_t observe(const void* address) {
+        Shard& shard = shardOf(address);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto inserted = shard.generations.emplace(address, 0);
+        if (inserted.second) {
+            inserted.first->second = nextGeneration_.fetch_add(1, std::memory_order_relaxed);
+            observed_.fetch_add(1, std::memory_order_release);
+            pooledDeleteHook.store(&retireHook, std::memory_order_release);
+        }
+        return inserted.first->second;
+    }
+
+    // 0 for an address that is not observed (any more), which matches no observer
+    uint64_t generation(const void* address) {
+        Shard& shard = shardOf(address);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.generations.find(address);
+        return found == shard.generations.end() ? 0 : found->second;
+    }
+
+    // Called from operator delete: only looks up and erases, never allocates
+    void retire(const void* address) noexcept {
+        if (observed_.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        Shard& shard = shardOf(address);
+        try {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            if (shard.generations.erase(address) != 0) {
+                observed_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        } catch (const std::system_error&) {
+            // The lock could not be taken: observers of this object cannot tell it is gone
+        }
+    }
+
+private:
+    static constexpr size_t ShardCount = 64;
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<const void*, uint64_t> generations;
+    };
+
+    static void retireHook(const void* address) noexcept { instance().retire(address); }
+
+    Shard& shardOf(const void* address) {
+        return shards_[(std::hash<const void*>()(address) >> 4) % ShardCount];
+    }
+
+    std::array<Shard, ShardCount> shards_;
+    std::atomic<uint64_t> nextGeneration_{1};
+    std::atomic<size_t> observed_{0};
+};
+
+// Marks the object at address as freed: every observer created before now is dangling
+inline void retireObserved(const void* address) noexcept {
+    if (address != nullptr) {
+        GenerationTable::instance().retire(address);
+    }
+}
+
+#else
+
+inline void retireObserved(const void*) noexcept {}
+
+#endif
+
+template<typename T>
+class observer_ptr {
+public:
+    static constexpr bool Checked = SMARTPOINTERCPP_CHECKED_POINTERS;
+
+    constexpr observer_ptr() noexcept = default;
+    constexpr observer_ptr(std::nullptr_t) noexcept {}
+
+    // Checked builds register the address, which allocates and may throw
+    explicit observer_ptr(T* pointer) noexcept(!Checked) : pointer_(pointer) {
+#if SMARTPOINTERCPP_CHECKED_POINTERS
+        generation_ = pointer_ == nullptr ? 0 : GenerationTable::instance().observe(pointer_);
+#endif
+    }
+
+    T* get() const noexcept { return pointer_; }
+
+    T& operator*() const {
+        check();
+        return *pointer_;
+    }
+
+    T* operator->() const {
+        check();
+        return pointer_;
+    }
+
+    explicit operator bool() const noexcept { return pointer_ != nullptr; }
+
+    // Checked builds: false once the object was freed. Release builds cannot know and only test for null.
+    bool alive() const {
+#if SMARTPOINTERCPP_CHECKED_POINTERS
+        return pointer_ != nullptr && current() == generation_;
+#else
+        return pointer_ != nullptr;
+#endif
+    }
+
+    void reset(T* pointer = nullptr) noexcept(!Checked) { *this = observer_ptr(pointer); }
+
+    T* release() noexcept {
+        T* pointer = pointer_;
+        reset();
+        return pointer;
+    }
+
+    friend bool operator==(const observer_ptr& a, const observer_ptr& b) { return a.pointer_ == b.pointer_; }
+    friend bool operator!=(const observer_ptr& a, const observer_ptr& b) { return a.pointer_ != b.pointer_; }
+    friend bool operator==(const observer_ptr& a, std::nullptr_t) { return a.pointer_ == nullptr; }
+    friend bool operator!=(const observer_ptr& a, std::nullptr_t) { return a.pointer_ != nullptr; }
+
+private:
+#if SMARTPOINTERCPP_CHECKED_POINTERS
+    uint64_t current() const { return GenerationTable::instance().generation(pointer_); }
+
+    void check() const {
+        if (pointer_ != nullptr && current() != generation_) {
+            std::cerr << "observer_ptr: use after free of " << static_cast<const void*>(pointer_) << std::endl;
+            std::abort();
+        }
+    }
+
+    T* pointer_ = nullptr;
+    uint64_t generation_ = 0;
+#else
+    void check() const {}
+
+    T* pointer_ = nullptr;
+#endif
+};
+
+template<typename T>
+observer_ptr<T> make_observer(T* pointer) noexcept(!observer_ptr<T>::Checked) { return observer_ptr<T>(pointer); }
+
+template<typename T, typename Deleter>
+observer_ptr<T> make_observer(const std::unique_ptr<T, Deleter>& owner) noexcept(!observer_ptr<T>::Checked) { return observer_ptr<T>(owner.get()); }
+
+template<typename T>
+observer_ptr<T> make_observer(const std::shared_ptr<T>& owner) noexcept(!observer_ptr<T>::Checked) { return observer_ptr<T>(owner.get()); }
+
+#if !SMARTPOINTERCPP_CHECKED_POINTERS
+static_assert(sizeof(observer_ptr<int>) == sizeof(int*), "a release observer_ptr is a bare pointer");
+static_assert(std::is_trivially_copyable<observer_ptr<int>>::value, "a release observer_ptr is a bare pointer");
+#endif
+
+#endif //SMARTPOINTERCPP_OBSERVER_PTR_H
@@ -0,0 +1,324 @@
+#ifndef SMARTPOINTERCPP_ORDERED_OUTPUT_H
+#define SMARTPOINTERCPP_ORDERED_OUTPUT_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ *  Output from several threads, in a fixed order, without every thread waiting for the stream.
+ *
+ *      OrderedOutput out(std::cout);
+ *      parallelSlices(persons.size(), threads, [&](size_t, size_t begin, size_t end) {
+ *          OrderedOutput::Producer producer(out);          // One per thread
+ *          for (size_t i = begin; i < end; ++i) {
+ *              producer.record(i) << *persons[i];          // Record i, formatted on this thread
+ *          }
+ *      });
+ *      out.finish();                                        // Records 0, 1, 2, ... as if printed by one thread
+ *
+ *  Every record carries a sequence number. A Producer formats its records into its own buffer, no lock
+ *  and no shared stream involved (std::endl flushes nothing but that buffer), and hands the buffer to
+ *  the OrderedOutput in chunks of ChunkBytes. A merger thread puts the records of all chunks in
+ *  sequence order and writes them to the stream in batches of up to BatchBytes, one write per batch.
+ *  The output is the same whatever the number of threads or their timing.
+ *
+ *  Sequence numbers start at firstSequence and must all be used, each once, and every Producer must
+ *  write its records in increasing order (a slice of a loop does). The merger waits for the next
+ *  number in line, so a record that is never written holds back the ones after it until finish():
+ *  finish() writes what is left in order, skipping the missing numbers, and counts them in Stats::gaps.
+ *  A Producer hands over what it has when it is destroyed; destroy them all before finish().
+ *
+ *  Backpressure: a Producer with MaxChunksAhead chunks handed over and not yet written waits until the
+ *  merger wrote one of them, so with parallelSlices the merger holds at most MaxChunksAhead chunks of
+ *  each slice that is ahead of the output. When every live Producer would wait (for a number nobody
+ *  writes) they go on instead, so a gap cannot block them.
+ */
+
+class OrderedOutput {
+public:
+    static constexpr size_t ChunkBytes = 64 * 1024;
+    static constexpr size_t BatchBytes = 256 * 1024;
+    static constexpr size_t MaxChunksAhead = 16; // Per Producer, handed over and not yet written
+
+    struct Stats {
+        size_t records = 0;
+        size_t bytes = 0;
+        size_t batches = 0; // Writes to the stream
+        size_t gaps = 0;    // Sequence numbers never written
+    };
+
+    class Producer;
+
+    explicit OrderedOutput(std::ostream& out, uint64_t firstSequence = 0)
+            : out_(out), next_(firstSequence), merger_([this] { merge(); }) {}
+
+    OrderedOutput(const OrderedOutput&) = delete;
+    OrderedOutput& operator=(const OrderedOutput&) = delete;
+
+    ~OrderedOutput() { finish(); }
+
+    // Writes everything handed over so far and stops the merger; call once all Producers are gone
+    void finish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishing_ = true;
+        }
+        ready_.notify_one();
+        if (merger_.joinable()) {
+            merger_.join();
+        }
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return stats_;
+    }
+
+private:
+    struct Record {
+        uint64_t sequence;
+        size_t end; // Offset in Chunk::text one past its last character
+    };
+
+    struct Chunk {
+        std::string text;
+        std::vector<Record> records;
+    };
+
+    // What the merger has taken over from one Producer
+    struct Queue {
+        std::deque<Chunk> chunks;
+        size_t record = 0; // Next record of chunks.front()
+        size_t written = 0; // Chunks written since the merger last took the lock
+
+        bool empty() const { return chunks.empty(); }
+        uint64_t front() const { return chunks.front().records[record].sequence; }
+    };
+
+    size_t attach() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        handedOver_.emplace_back();
+        inFlight_.push_back(0);
+        ++active_;
+        return handedOver_.size() - 1;
+    }
+
+    void detach() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --active_;
+        }
+        room_.notify_all(); // The Producers left may all be waiting now
+    }
+
+    void handOver(size_t producer, Chunk chunk) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (inFlight_[producer] >= MaxChunksAhead) {
+                ++waiting_;
+                room_.notify_all();
+                room_.wait(lock, [&] { return inFlight_[producer] < MaxChunksAhead || waiting_ >= active_; });
+                --waiting_;
+            }
+            handedOver_[producer].push_back(std::move(chunk));
+            ++inFlight_[producer];
+        }
+        ready_.notify_one();
+    }
+
+    void merge() {
+        std::vector<Queue> queues;
+        std::string batch;
+        batch.reserve(BatchBytes);
+        Stats stats;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (;;) {
+            // Take over the chunks handed over since the last round, in one go
+            bool finishing = finishing_;
+            queues.resize(handedOver_.size());
+            for (size_t p = 0; p < handedOver_.size(); ++p) {
+                for (auto& chunk : handedOver_[p]) {
+                    queues[p].chunks.push_back(std::move(chunk));
+                }
+                handedOver_[p].clear();
+            }
+            lock.unlock();
+
+            bool progress = emitInOrder(queues, batch, stats);
+            if (!progress && finishing) {
+                // Nothing more will come: skip the numbers that are missing
+                Queue* lowest = nullptr;
+                for (auto& queue : queues) {
+                    if (!queue.empty() && (lowest == nullptr || queue.front() < lowest->front())) {
+                        lowest = &queue;
+                    }
+                }
+                if (lowest != nullptr) {
+                    stats.gaps += lowest->front() - next_;
+                    next_ = lowest->front();
+                    lock.lock();
+                    continue;
+                }
+            }
+            if (!batch.empty() && (!progress || batch.size() >= BatchBytes)) {
+                out_.write(batch.data(), static_cast<std::streamsize>(batch.size()));
+                batch.clear();
+                ++stats.batches;
+            }
+
+            lock.lock();
+            stats_ = stats;
+            bool room = false;
+            for (size_t p = 0; p < queues.size(); ++p) {
+                room = room || queues[p].written > 0;
+                inFlight_[p] -= queues[p].written;
+                queues[p].written = 0;
+            }
+            if (room) {
+                room_.notify_all();
+            }
+            if (!progress) {
+                if (finishing) {
+                    out_.flush();
+                    return;
+                }
+                ready_.wait(lock, [&] { return finishing_ || anyHandedOver(); });
+            }
+        }
+    }
+
+    // Appends every record that is next in line to batch; false when none was
+    bool emitInOrder(std::vector<Queue>& queues, std::string& batch, Stats& stats) {
+        bool progress = false;
+        bool found = true;
+        while (found && batch.size() < BatchBytes) {
+            found = false;
+            for (auto& queue : queues) {
+                // A run of consecutive numbers from one Producer is one append
+                while (!queue.empty() && queue.front() == next_) {
+                    Chunk& chunk = queue.chunks.front();
+                    size_t first = queue.record;
+                    size_t last = first;
+                    while (last < chunk.records.size() && chunk.records[last].sequence == next_) {
+                        ++next_;
+                        ++last;
+                    }
+                    size_t begin = first == 0 ? 0 : chunk.records[first - 1].end;
+                    size_t end = chunk.records[last - 1].end;
+                    batch.append(chunk.text, begin, end - begin);
+                    stats.records += last - first;
+                    stats.bytes += end - begin;
+                    queue.record = last;
+                    if (last == chunk.records.size()) {
+                        queue.chunks.pop_front();
+                        queue.record = 0;
+                        ++queue.written;
+                    }
+                    found = progress = true;
+                }
+            }
+        }
+        return progress;
+    }
+
+    bool anyHandedOver() const {
+        for (const auto& chunks : handedOver_) {
+            if (!chunks.empty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    std::ostream& out_;
+    mutable std::mutex mutex_;
+    std::condition_variable ready_;
+    std::condition_variable room_; // A waiting Producer may go on
+    std::vector<std::vector<Chunk>> handedOver_; // Per Producer, taken over by the merger
+    std::vector<size_t> inFlight_;               // Per Producer, chunks handed over and not yet written
+    size_t active_ = 0;                          // Producers not yet destroyed
+    size_t waiting_ = 0;                         // Producers waiting for room
+    bool finishing_ = false;
+    Stats stats_;
+    uint64_t next_; // Merger only
+    std::thread merger_;
+};
+
+// Formats records on the calling thread, see OrderedOutput. Not shared between threads.
+class OrderedOutput::Producer : private std::streambuf {
+public:
+    explicit Producer(OrderedOutput& output) : output_(output), index_(output.attach()), stream_(this) {
+        chunk_.text.reserve(ChunkBytes + ChunkBytes / 4);
+    }
+
+    Producer(const Producer&) = delete;
+    Producer& operator=(const Producer&) = delete;
+
+    ~Producer() {
+        handOver();
+        output_.detach();
+    }
+
+    // Starts record sequence; what is written to the returned stream until the next record() belongs to it
+    std::ostream& record(uint64_t sequence) {
+        closeRecord();
+        if (chunk_.text.size() >= ChunkBytes) {
+            handOver();
+        }
+        chunk_.records.push_back(Record{sequence, 0});
+        open_ = true;
+        return stream_;
+    }
+
+    // The whole record at once
+    void write(uint64_t sequence, std::string_view text) { record(sequence).write(text.data(), static_cast<std::streamsize>(text.size())); }
+
+private:
+    int_type overflow(int_type c) override {
+        if (!traits_type::eq_int_type(c, traits_type::eof())) {
+            chunk_.text.push_back(traits_type::to_char_type(c));
+        }
+        return traits_type::not_eof(c);
+    }
+
+    std::streamsize xsputn(const char* text, std::streamsize count) override {
+        chunk_.text.append(text, static_cast<size_t>(count));
+        return count;
+    }
+
+    void closeRecord() {
+        if (open_) {
+            chunk_.records.back().end = chunk_.text.size();
+            open_ = false;
+        }
+    }
+
+    void handOver() {
+        closeRecord();
+        if (chunk_.records.empty()) {
+            return;
+        }
+        output_.handOver(index_, std::move(chunk_));
+        chunk_ = Chunk();
+        chunk_.text.reserve(ChunkBytes + ChunkBytes / 4);
+    }
+
+    OrderedOutput& output_;
+    size_t index_;
+    std::ostream stream_;
+    Chunk chunk_;
+    bool open_ = false;
+};
+
+#endif //SMARTPOINTERCPP_ORDERED_OUTPUT_H
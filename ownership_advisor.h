@@ -0,0 +1,372 @@
+#ifndef SMARTPOINTERCPP_OWNERSHIP_ADVISOR_H
+#define SMARTPOINTERCPP_OWNERSHIP_ADVISOR_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ *  Finds the shared_ptrs that do not need to be shared_ptrs, by watching what the program does with them.
+ *
+ *      auto person = ADVISED_MAKE_SHARED(Person)(Person{"Jane Smith", "456 Elm St", 25});
+ *      auto reader = ADVISED_COPY(person);                 // A new owner
+ *      std::weak_ptr<Person> watcher = person;
+ *      if (auto locked = ADVISED_LOCK(watcher)) { ... }
+ *      ...
+ *      reportOwnership(std::cout);                         // One recommendation per call site
+ *
+ *  With SMARTPOINTERCPP_OWNERSHIP_ADVISOR=1 the macros record, per call site (file and line), how the
+ *  objects made there are used; without it they are std::make_shared<T>, a plain copy and weak_ptr::lock()
+ *  and cost nothing. The functions behind them (advisedMakeShared, advisedCopy, advisedLock with an
+ *  OwnershipSite) work in every build.
+ *
+ *  An advised object gets a deleter that remembers its call site and the thread that made it. Every
+ *  advised copy or successful lock reads use_count(), and notes when it happens on another thread than the
+ *  one that made the object. Copies made without the macro (a push_back into a vector) are seen through
+ *  use_count() too, as long as they are alive at such a moment: the site also keeps a weak_ptr to each of
+ *  its live objects and reads their use_count() every time that list fills up and when the advice is
+ *  made. When an object is destroyed its numbers are added to its site; objects still alive only count
+ *  when they are shared. Lock sites count their attempts and failures.
+ *
+ *  Recommendations, with what they would save for the objects seen so far:
+ *      never a second owner seen               unique_ptr: no control block, no count updates (owners
+ *                                              that a lock adds for the moment do not count)
+ *      shared, but only ever on one thread     non-atomic reference counts
+ *      a lock site that never failed           a borrowed reference (T& or observer_ptr): the object always
+ *                                              outlived the observer, the lock is two count updates for nothing
+ *  Savings are estimates: ControlBlockBytes per object, and count updates at the cost of an uncontended
+ *  atomic read-modify-write on this machine (measured once) against a plain increment.
+ *  Analysis mode allocates the object and the control block separately, which make_shared does not.
+ */
+
+#ifndef SMARTPOINTERCPP_OWNERSHIP_ADVISOR
+#define SMARTPOINTERCPP_OWNERSHIP_ADVISOR 0
+#endif
+
+// What the advisor knows about one call site
+struct OwnershipSite {
+    enum class Kind { MakeShared, Lock };
+
+    OwnershipSite(std::string where, Kind kind) : where(std::move(where)), kind(kind) {}
+
+    const std::string where; // file:line and what happens there
+    const Kind kind;
+    std::atomic<uint64_t> made{0};
+    std::atomic<uint64_t> destroyed{0};
+    std::atomic<uint64_t> sharedObjects{0};   // Destroyed objects that had more than one owner at some point
+    std::atomic<uint64_t> crossingObjects{0}; // ... that were copied, locked or destroyed on another thread
+    std::atomic<uint64_t> observedObjects{0}; // ... that were locked through a weak_ptr
+    std::atomic<uint64_t> copies{0};          // Advised copies of destroyed objects (their locks count at the lock site)
+    std::atomic<uint64_t> transfers{0};       // Copies, locks and destruction on another thread than the maker
+    std::atomic<long> maxUseCount{0};
+    std::atomic<uint64_t> lockAttempts{0};    // Lock sites
+    std::atomic<uint64_t> lockFailures{0};
+    std::mutex liveMutex;
+    std::vector<std::weak_ptr<void>> live;    // Objects made here, some maybe gone, to sample use_count()
+};
+
+namespace ownership {
+
+inline void raise(std::atomic<long>& maximum, long value) {
+    long current = maximum.load(std::memory_order_relaxed);
+    while (value > current && !maximum.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+    }
+}
+
+struct Registry {
+    std::mutex mutex;
+    std::map<std::string, std::unique_ptr<OwnershipSite>> sites;
+};
+
+// Never destroyed: advised objects may die while static objects are torn down
+inline Registry& registry() {
+    static Registry* registry = new Registry();
+    return *registry;
+}
+
+// Reads use_count() of every live object of site, drops the ones that are gone; returns how many of
+// the live ones had a second owner at some point. Called with site.liveMutex held.
+inline uint64_t sampleLive(OwnershipSite& site);
+
+} // namespace ownership
+
+// The site with this location, created on first use; keep the reference, the lookup takes a lock
+// The full path of file, so sites in files with the same name in different directories stay apart
+inline OwnershipSite& ownershipSite(const std::string& file, int line, const std::string& what, OwnershipSite::Kind kind) {
+    std::string where = file + ":" + std::to_string(line) + " " + what;
+    ownership::Registry& registry = ownership::registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    auto& site = registry.sites[where];
+    if (site == nullptr) {
+        site = std::make_unique<OwnershipSite>(where, kind);
+    }
+    return *site;
+}
+
+// Deleter of an advised object: its site and what happened to it, added to the site when it dies
+class OwnershipTracker {
+public:
+    explicit OwnershipTracker(OwnershipSite& site) : site_(&site), maker_(std::this_thread::get_id()) {}
+
+    // shared_ptr copies its deleter once while it is built, before anybody can observe it
+    OwnershipTracker(const OwnershipTracker& other)
+            : site_(other.site_), maker_(other.maker_), maxUseCount_(other.maxUseCount_.load()), copies_(other.copies_.load()),
+              transfers_(other.transfers_.load()), locks_(other.locks_.load()) {}
+
+    template<typename T>
+    void operator()(T* object) {
+        bool crossed = transfers_.load() > 0 || std::this_thread::get_id() != maker_;
+        site_->destroyed.fetch_add(1, std::memory_order_relaxed);
+        site_->sharedObjects.fetch_add(maxUseCount_.load() > 1 ? 1 : 0, std::memory_order_relaxed);
+        site_->crossingObjects.fetch_add(crossed ? 1 : 0, std::memory_order_relaxed);
+        site_->observedObjects.fetch_add(locks_.load() > 0 ? 1 : 0, std::memory_order_relaxed);
+        site_->copies.fetch_add(copies_.load(), std::memory_order_relaxed);
+        site_->transfers.fetch_add(transfers_.load() + (std::this_thread::get_id() != maker_ ? 1 : 0), std::memory_order_relaxed);
+        ownership::raise(site_->maxUseCount, maxUseCount_.load());
+        delete object;
+    }
+
+    // use_count() seen from outside, without a new owner
+    void sampled(long useCount) { ownership::raise(maxUseCount_, useCount); }
+
+    long maxUseCount() const { return maxUseCount_.load(); }
+
+    // A new owner of the object, use_count() counted after it was added. The owner a lock adds lives
+    // only as long as the observer uses it, so it does not count as sharing.
+    void owned(long useCount, bool locked) {
+        ownership::raise(maxUseCount_, locked ? useCount - 1 : useCount);
+        (locked ? locks_ : copies_).fetch_add(1, std::memory_order_relaxed);
+        if (std::this_thread::get_id() != maker_) {
+            transfers_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    OwnershipSite* site_;
+    std::thread::id maker_;
+    std::atomic<long> maxUseCount_{1};
+    std::atomic<uint64_t> copies_{0};
+    std::atomic<uint64_t> transfers_{0};
+    std::atomic<uint64_t> locks_{0};
+};
+
+inline uint64_t ownership::sampleLive(OwnershipSite& site) {
+    uint64_t shared = 0;
+    auto alive = site.live.begin();
+    for (auto& entry : site.live) {
+        std::shared_ptr<void> object = entry.lock();
+        if (object == nullptr) {
+            continue;
+        }
+        auto* tracker = std::get_deleter<OwnershipTracker>(object);
+        tracker->sampled(object.use_count() - 1); // Without the owner lock() just added
+        shared += tracker->maxUseCount() > 1 ? 1 : 0;
+        raise(site.maxUseCount, tracker->maxUseCount());
+        if (&*alive != &entry) {
+            *alive = std::move(entry);
+        }
+        ++alive;
+    }
+    site.live.erase(alive, site.live.end());
+    return shared;
+}
+
+// advisedMakeShared<T>(site)(args...): like std::make_shared<T>(args...), tracked
+template<typename T>
+class AdvisedFactory {
+public:
+    explicit AdvisedFactory(OwnershipSite& site) : site_(site) {}
+
+    template<typename... Args>
+    std::shared_ptr<T> operator()(Args&&... args) const {
+        T* object;
+        if constexpr (std::is_constructible<T, Args&&...>::value) {
+            object = new T(std::forward<Args>(args)...);
+        } else {
+            object = new T{std::forward<Args>(args)...};
+        }
+        site_.made.fetch_add(1, std::memory_order_relaxed);
+        std::shared_ptr<T> result(object, OwnershipTracker(site_));
+        std::lock_guard<std::mutex> lock(site_.liveMutex);
+        if (site_.live.size() == site_.live.capacity()) {
+            ownership::sampleLive(site_); // Before the list grows: drop the dead, catch plain copies of the living
+        }
+        site_.live.push_back(result);
+        return result;
+    }
+
+private:
+    OwnershipSite& site_;
+};
+
+template<typename T>
+AdvisedFactory<T> advisedMakeShared(OwnershipSite& site) {
+    return AdvisedFactory<T>(site);
+}
+
+// A copy of pointer; counted when it points to an advised object
+template<typename T>
+std::shared_ptr<T> advisedCopy(const std::shared_ptr<T>& pointer) {
+    std::shared_ptr<T> copy = pointer;
+    if (auto* tracker = std::get_deleter<OwnershipTracker>(copy)) {
+        tracker->owned(copy.use_count(), false);
+    }
+    return copy;
+}
+
+template<typename T>
+std::shared_ptr<T> advisedLock(OwnershipSite& site, const std::weak_ptr<T>& pointer) {
+    std::shared_ptr<T> locked = pointer.lock();
+    site.lockAttempts.fetch_add(1, std::memory_order_relaxed);
+    if (locked == nullptr) {
+        site.lockFailures.fetch_add(1, std::memory_order_relaxed);
+    } else if (auto* tracker = std::get_deleter<OwnershipTracker>(locked)) {
+        tracker->owned(locked.use_count(), true);
+    }
+    return locked;
+}
+
+struct OwnershipAdvice {
+    std::string site;
+    std::string recommendation;
+    std::string reason;
+    size_t savedBytes = 0;
+    double savedNanoseconds = 0;
+};
+
+namespace ownership {
+
+// Extra bytes of a shared_ptr over a unique_ptr per object: the control block of make_shared (vtable
+// pointer, use and weak count) on the usual 64 bit standard libraries
+constexpr size_t ControlBlockBytes = sizeof(void*) + 2 * sizeof(int);
+
+// Nanoseconds an uncontended atomic count update costs more than a plain one, measured once
+inline double countUpdateNanoseconds() {
+    static const double cost = [] {
+        constexpr size_t Rounds = 1 << 20;
+        std::atomic<long> atomicCount{0};
+        volatile long plainCount = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < Rounds; ++i) {
+            atomicCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        auto middle = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < Rounds; ++i) {
+            plainCount = plainCount + 1;
+        }
+        auto end = std::chrono::steady_clock::now();
+        double atomic = std::chrono::duration<double, std::nano>(middle - start).count();
+        double plain = std::chrono::duration<double, std::nano>(end - middle).count();
+        return std::max(0.0, (atomic - plain) / double(Rounds));
+    }();
+    return cost;
+}
+
+} // namespace ownership
+
+// One recommendation per site with something to go on, biggest savings first
+inline std::vector<OwnershipAdvice> ownershipAdvice() {
+    std::vector<OwnershipAdvice> advice;
+    double updateCost = ownership::countUpdateNanoseconds();
+    ownership::Registry& registry = ownership::registry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    for (const auto& [where, site] : registry.sites) {
+        OwnershipAdvice entry;
+        entry.site = where;
+        if (site->kind == OwnershipSite::Kind::Lock) {
+            uint64_t attempts = site->lockAttempts.load();
+            uint64_t failures = site->lockFailures.load();
+            if (attempts == 0) {
+                continue;
+            }
+            if (failures == 0) {
+                entry.recommendation = "borrowed reference (T& or observer_ptr)";
+                entry.reason = "all " + std::to_string(attempts) + " locks succeeded";
+                entry.savedNanoseconds = double(attempts) * 2 * updateCost; // The lock and the release
+            } else {
+                entry.recommendation = "keep weak_ptr";
+                entry.reason = std::to_string(failures) + " of " + std::to_string(attempts) + " locks failed ("
+                               + std::to_string(failures * 100 / attempts) + "%)";
+            }
+            advice.push_back(std::move(entry));
+            continue;
+        }
+
+        uint64_t liveShared;
+        {
+            std::lock_guard<std::mutex> liveLock(site->liveMutex);
+            liveShared = ownership::sampleLive(*site);
+        }
+        uint64_t destroyed = site->destroyed.load();
+        if (destroyed == 0 && liveShared == 0) {
+            continue;
+        }
+        uint64_t shared = site->sharedObjects.load() + liveShared;
+        uint64_t crossing = site->crossingObjects.load();
+        // Every object counts up when it is made and down when it dies, every further owner once more each
+        uint64_t updates = 2 * (destroyed + site->copies.load());
+        std::string seen = std::to_string(destroyed) + " objects, use_count up to " + std::to_string(site->maxUseCount.load())
+                           + ", " + std::to_string(site->transfers.load()) + " cross-thread transfers";
+        if (liveShared > 0) {
+            seen += ", " + std::to_string(liveShared) + " live objects shared";
+        }
+        if (shared == 0) {
+            entry.recommendation = site->observedObjects.load() == 0 ? "unique_ptr" : "unique_ptr, weak_ptrs as observer_ptr where their locks never fail";
+            entry.reason = seen;
+            entry.savedBytes = destroyed * ownership::ControlBlockBytes;
+            entry.savedNanoseconds = double(updates) * updateCost;
+        } else if (crossing == 0) {
+            entry.recommendation = "non-atomic reference counts";
+            entry.reason = seen + ", all on the thread that made them";
+            entry.savedNanoseconds = double(updates) * updateCost;
+        } else {
+            entry.recommendation = "keep shared_ptr";
+            entry.reason = seen + " (" + std::to_string(crossing) + " objects crossed threads)";
+        }
+        advice.push_back(std::move(entry));
+    }
+    std::stable_sort(advice.begin(), advice.end(), [](const OwnershipAdvice& a, const OwnershipAdvice& b) {
+        return std::make_tuple(a.savedNanoseconds, a.savedBytes) > std::make_tuple(b.savedNanoseconds, b.savedBytes);
+    });
+    return advice;
+}
+
+inline void reportOwnership(std::ostream& out) {
+    for (const auto& entry : ownershipAdvice()) {
+        out << entry.site << ": " << entry.recommendation << " - " << entry.reason;
+        if (entry.savedBytes > 0 || entry.savedNanoseconds > 0) {
+            out << "; saves about " << entry.savedBytes << " bytes and " << entry.savedNanoseconds / 1e3 << " us";
+        }
+        out << "\n";
+    }
+}
+
+#define SMARTPOINTERCPP_OWNERSHIP_SITE(what, kind)                                                    \
+    ([]() -> OwnershipSite& {                                                                         \
+        static OwnershipSite& site = ownershipSite(__FILE__, __LINE__, what, OwnershipSite::Kind::kind); \
+        return site;                                                                                  \
+    }())
+
+#if SMARTPOINTERCPP_OWNERSHIP_ADVISOR
+#define ADVISED_MAKE_SHARED(T) advisedMakeShared<T>(SMARTPOINTERCPP_OWNERSHIP_SITE("make_shared<" #T ">", MakeShared))
+#define ADVISED_COPY(pointer) advisedCopy(pointer)
+#define ADVISED_LOCK(pointer) advisedLock(SMARTPOINTERCPP_OWNERSHIP_SITE("lock " #pointer, Lock), pointer)
+#else
+#define ADVISED_MAKE_SHARED(T) std::make_shared<T>
+#define ADVISED_COPY(pointer) (pointer)
+#define ADVISED_LOCK(pointer) (pointer).lock()
+#endif
+
+#endif //SMARTPOINTERCPP_OWNERSHIP_ADVISOR_H
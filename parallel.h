@@ -0,0 +1,41 @@
+#ifndef SMARTPOINTERCPP_PARALLEL_H
+#define SMARTPOINTERCPP_PARALLEL_H
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+/*
+ *  Small helpers to split a loop over several std::threads.
+ */
+
+// Number of worker threads used when the caller does not ask for a specific count.
+inline size_t defaultThreadCount() {
+    size_t threads = std::thread::hardware_concurrency();
+    return threads == 0 ? 1 : threads;
+}
+
+// Runs work(threadIndex, begin, end) on `threads` threads, each getting one contiguous slice of [0, count).
+template<typename Work>
+void parallelSlices(size_t count, size_t threads, Work work) {
+    threads = std::max<size_t>(1, std::min(threads, count));
+    if (threads == 1) {
+        work(size_t{0}, size_t{0}, count);
+        return;
+    }
+    std::vector<std::thread> workers;
+    workers.reserve(threads - 1);
+    size_t slice = (count + threads - 1) / threads;
+    for (size_t t = 1; t < threads; ++t) {
+        size_t begin = std::min(count, t * slice);
+        size_t end = std::min(count, begin + slice);
+        workers.emplace_back(work, t, begin, end);
+    }
+    work(size_t{0}, size_t{0}, std::min(count, slice)); // The calling thread takes the first slice
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+#endif //SMARTPOINTERCPP_PARALLEL_H
@@ -0,0 +1,190 @@
+#ifndef SMARTPOINTERCPP_PIPELINE_H
+#define SMARTPOINTERCPP_PIPELINE_H
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "parallel.h"
+
+/*
+ *  Lazy, pull based streaming of records in fixed size batches.
+ *
+ *      Stream<Person>::generate(readPerson, 1024)      // source
+ *          .filter(where(age > 30))                    // drop records
+ *          .map([](Person p) { return p.name; })       // change the record type
+ *          .rebatch(4096)                              // change the batch size
+ *          .sink([](std::vector<std::string>& names) { ... });
+ *
+ *  Nothing happens until the sink pulls. Every stage asks the stage before it for one batch, works on it
+ *  and hands it on, so only a few batches are alive at any time, no matter how many records flow through.
+ *  A batch is a std::unique_ptr<std::vector<T>>: moving it to the next stage moves one pointer, the
+ *  records themselves are never copied (filter works in place, map moves every record into its result).
+ */
+
+template<typename T>
+using Batch = std::vector<T>;
+
+template<typename T>
+using BatchPtr = std::unique_ptr<Batch<T>>;
+
+template<typename T>
+class Stream {
+public:
+    // Returns the next batch, or nullptr at the end of the stream.
+    using Pull = std::function<BatchPtr<T>()>;
+
+    explicit Stream(Pull pull) : pull_(std::move(pull)) {}
+
+    // Source: calls next() until it returns std::nullopt, batchSize records per batch
+    template<typename Next>
+    static Stream generate(Next next, size_t batchSize) {
+        if (batchSize == 0) {
+            throw std::invalid_argument("generate: batchSize must not be 0");
+        }
+        return Stream([next = std::move(next), batchSize, done = false]() mutable -> BatchPtr<T> {
+            if (done) {
+                return nullptr;
+            }
+            auto batch = std::make_unique<Batch<T>>();
+            batch->reserve(batchSize);
+            while (batch->size() < batchSize) {
+                std::optional<T> record = next();
+                if (!record) {
+                    done = true;
+                    break;
+                }
+                batch->push_back(std::move(*record));
+            }
+            return batch->empty() ? nullptr : std::move(batch);
+        });
+    }
+
+    // Source: copies the records of an existing range, batchSize at a time
+    template<typename It>
+    static Stream fromRange(It first, It last, size_t batchSize) {
+        return generate([first, last]() mutable -> std::optional<T> {
+            if (first == last) {
+                return std::nullopt;
+            }
+            return T(*first++);
+        }, batchSize);
+    }
+
+    // Transforms every record. With threads > 1 every batch is split over that many threads.
+    template<typename Fn, typename U = std::decay_t<std::invoke_result_t<Fn&, T&&>>>
+    Stream<U> map(Fn fn, size_t threads = 1) && {
+        return Stream<U>([pull = std::move(pull_), fn = std::move(fn), threads]() -> BatchPtr<U> {
+            BatchPtr<T> in = pull();
+            if (!in) {
+                return nullptr;
+            }
+            if constexpr (std::is_same<T, U>::value) {
+                // Same record type: transform in place and hand on the same batch
+                parallelSlices(in->size(), threads, [&](size_t, size_t begin, size_t end) {
+                    for (size_t i = begin; i < end; ++i) {
+                        (*in)[i] = fn(std::move((*in)[i]));
+                    }
+                });
+                return in;
+            } else {
+                auto out = std::make_unique<Batch<U>>();
+                out->reserve(in->size());
+                if (threads <= 1) {
+                    for (auto& record : *in) {
+                        out->push_back(fn(std::move(record)));
+                    }
+                } else {
+                    std::vector<std::optional<U>> results(in->size());
+                    parallelSlices(in->size(), threads, [&](size_t, size_t begin, size_t end) {
+                        for (size_t i = begin; i < end; ++i) {
+                            results[i].emplace(fn(std::move((*in)[i])));
+                        }
+                    });
+                    for (auto& result : results) {
+                        out->push_back(std::move(*result));
+                    }
+                }
+                return out;
+            }
+        });
+    }
+
+    // Keeps the records for which keep(record) is true. Works in place, empty batches are skipped.
+    template<typename Pred>
+    Stream filter(Pred keep) && {
+        return Stream([pull = std::move(pull_), keep = std::move(keep)]() -> BatchPtr<T> {
+            while (BatchPtr<T> batch = pull()) {
+                batch->erase(std::remove_if(batch->begin(), batch->end(),
+                                            [&](const T& record) { return !keep(record); }),
+                             batch->end());
+                if (!batch->empty()) {
+                    return batch;
+                }
+            }
+            return nullptr;
+        });
+    }
+
+    // Regroups the records into batches of exactly batchSize records (the last one may be smaller).
+    // Useful after a filter, which leaves small batches behind. batchSize must not be 0.
+    Stream rebatch(size_t batchSize) && {
+        if (batchSize == 0) {
+            throw std::invalid_argument("rebatch: batchSize must not be 0");
+        }
+        // std::function needs a copyable callable, so the leftover records live behind a shared_ptr
+        auto leftover = std::make_shared<BatchPtr<T>>();
+        return Stream([pull = std::move(pull_), batchSize, leftover]() -> BatchPtr<T> {
+            BatchPtr<T>& carry = *leftover;
+            auto out = std::move(carry);
+            while (!out || out->size() < batchSize) {
+                BatchPtr<T> in = pull();
+                if (!in) {
+                    break;
+                }
+                if (!out) {
+                    out = std::move(in);
+                    continue;
+                }
+                size_t take = std::min(batchSize - out->size(), in->size());
+                std::move(in->begin(), in->begin() + static_cast<std::ptrdiff_t>(take), std::back_inserter(*out));
+                if (take < in->size()) {
+                    in->erase(in->begin(), in->begin() + static_cast<std::ptrdiff_t>(take));
+                    carry = std::move(in);
+                }
+            }
+            if (out && out->size() > batchSize) {
+                // The first batch pulled was larger than batchSize, keep the rest for the next call
+                carry = std::make_unique<Batch<T>>(std::make_move_iterator(out->begin() + static_cast<std::ptrdiff_t>(batchSize)),
+                                                   std::make_move_iterator(out->end()));
+                out->resize(batchSize);
+            }
+            return out && !out->empty() ? std::move(out) : nullptr;
+        });
+    }
+
+    // Pulls the next batch, nullptr at the end. Lets a caller drive the stream by hand.
+    BatchPtr<T> next() { return pull_(); }
+
+    // Drains the stream, calling consume(batch) for every batch. Returns the number of records.
+    template<typename Consume>
+    size_t sink(Consume consume) && {
+        size_t records = 0;
+        while (BatchPtr<T> batch = pull_()) {
+            records += batch->size();
+            consume(*batch);
+        }
+        return records;
+    }
+
+private:
+    Pull pull_;
+};
+
+#endif //SMARTPOINTERCPP_PIPELINE_H
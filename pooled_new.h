@@ -0,0 +1,296 @@
+#ifndef SMARTPOINTERCPP_POOLED_NEW_H
+#define SMARTPOINTERCPP_POOLED_NEW_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <map>
+#include <mutex>
+#include <new>
+#include <vector>
+
+/*
+ *  Class level operator new / delete routed to a pool per type.
+ *
+ *      struct Widget : PooledNew<Widget> { ... };      // as a base class (mixin)
+ *      struct Person { POOLED_NEW(Person) ... };       // as a macro, keeps Person an aggregate
+ *
+ *  A class specific operator new is used by every `new T`, so also by plain std::make_unique<T>() in code
+ *  we do not control. The pool hands out blocks of exactly sizeof(T) from a small free list per thread,
+ *  no lock is taken until a thread needs a whole batch of new blocks (or has too many free ones).
+ *
+ *  std::make_shared<T>() is not affected: it allocates the control block and the object together through
+ *  std::allocator, which never calls the class operator new. Use makeSharedIn with a SlabResource
+ *  (slab_resource.h) for that case.
+ *
+ *  Requests for another size (a class derived from T) or a larger alignment than the pool provides are
+ *  passed on to the global operator new.
+ *
+ *  The deletes call pooledDeleteHook first when it is set. observer_ptr.h sets it in checked builds once
+ *  the first observer exists; the allocator itself knows nothing about observers.
+ */
+
+using PooledDeleteHook = void (*)(const void* address) noexcept;
+
+inline std::atomic<PooledDeleteHook> pooledDeleteHook{nullptr};
+
+inline void runDeleteHook(const void* address) noexcept {
+    if (PooledDeleteHook hook = pooledDeleteHook.load(std::memory_order_acquire)) {
+        hook(address);
+    }
+}
+
+template<typename T>
+class TypePool {
+public:
+    static constexpr size_t BlockAlign = alignof(T) > alignof(std::max_align_t) ? alignof(T) : alignof(std::max_align_t);
+    static constexpr size_t BlockSize = (std::max(sizeof(T), sizeof(void*)) + BlockAlign - 1) / BlockAlign * BlockAlign;
+    static constexpr size_t BatchSize = 64;        // Blocks moved between a thread and the shared depot at once
+    static constexpr size_t ChunkBlocks = 1024;    // Blocks taken from the global operator new at once
+
+    static void* allocate() {
+        if (!Cache::usable()) {
+            return Depot::instance().take();
+        }
+        Cache& cache = Cache::local();
+        if (cache.free == nullptr) {
+            cache.free = Depot::instance().takeBatch();
+            cache.count = BatchSize;
+        }
+        Block* block = cache.free;
+        cache.free = block->next;
+        --cache.count;
+        return block;
+    }
+
+    static void deallocate(void* pointer) {
+        auto* block = static_cast<Block*>(pointer);
+        if (!Cache::usable()) {
+            Depot::instance().give(block);
+            return;
+        }
+        Cache& cache = Cache::local();
+        block->next = cache.free;
+        cache.free = block;
+        if (++cache.count == 2 * BatchSize) {
+            // Keep one batch, hand the other one to the threads that need it
+            Block* batch = cache.free;
+            for (size_t i = 1; i < BatchSize; ++i) {
+                cache.free = cache.free->next;
+            }
+            Block* rest = cache.free->next;
+            cache.free->next = nullptr;
+            cache.free = rest;
+            cache.count = BatchSize;
+            Depot::instance().giveBatch(batch);
+        }
+    }
+
+    // Blocks carved out of chunks so far, for statistics
+    static size_t blocksCreated() { return Depot::instance().created(); }
+
+    // count blocks in one piece of memory, BlockSize bytes apart (see compact.h).
+    // Every block is later given back on its own with deallocate, like any other block of the pool.
+    static char* allocateContiguous(size_t count) { return Depot::instance().takeContiguous(count); }
+
+    // The piece of memory from allocateContiguous that contains pointer and its number of blocks,
+    // nullptr when pointer is not in one
+    static char* contiguousOf(const void* pointer, size_t& count) { return Depot::instance().arenaOf(pointer, count); }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    // Shared between all threads, guarded by a mutex. Holds whole batches of free blocks.
+    class Depot {
+    public:
+        // Never destroyed on purpose: objects may still be deleted during static destruction
+        static Depot& instance() {
+            static Depot* depot = new Depot();
+            return *depot;
+        }
+
+        Block* takeBatch() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (!batches_.empty()) {
+                Block* batch = batches_.back();
+                batches_.pop_back();
+                return batch;
+            }
+            return carveBatch();
+        }
+
+        void giveBatch(Block* batch) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batches_.push_back(batch);
+        }
+
+        // Single blocks, used while a thread has no cache (during thread exit)
+        void* take() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (loose_ == nullptr) {
+                if (batches_.empty()) {
+                    loose_ = carveBatch();
+                } else {
+                    loose_ = batches_.back();
+                    batches_.pop_back();
+                }
+            }
+            Block* block = loose_;
+            loose_ = block->next;
+            return block;
+        }
+
+        void give(Block* block) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            block->next = loose_;
+            loose_ = block;
+        }
+
+        size_t created() const { return created_.load(std::memory_order_relaxed); }
+
+        char* takeContiguous(size_t count) {
+            if (count == 0) {
+                return nullptr;
+            }
+            auto* memory = static_cast<char*>(::operator new(count * BlockSize, std::align_val_t(BlockAlign)));
+            std::lock_guard<std::mutex> lock(mutex_);
+            arenas_.emplace(memory, count);
+            created_.fetch_add(count, std::memory_order_relaxed);
+            return memory;
+        }
+
+        char* arenaOf(const void* pointer, size_t& count) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto found = arenas_.upper_bound(static_cast<char*>(const_cast<void*>(pointer)));
+            if (found == arenas_.begin()) {
+                return nullptr;
+            }
+            --found;
+            if (static_cast<const char*>(pointer) >= found->first + found->second * BlockSize) {
+                return nullptr;
+            }
+            count = found->second;
+            return found->first;
+        }
+
+    private:
+        // Links BatchSize new blocks, taking a new chunk when the current one is used up
+        Block* carveBatch() {
+            if (chunkUsed_ + BatchSize > ChunkBlocks || chunks_.empty()) {
+                chunks_.push_back(static_cast<char*>(::operator new(ChunkBlocks * BlockSize, std::align_val_t(BlockAlign))));
+                chunkUsed_ = 0;
+            }
+            char* first = chunks_.back() + chunkUsed_ * BlockSize;
+            for (size_t i = 0; i < BatchSize; ++i) {
+                auto* block = reinterpret_cast<Block*>(first + i * BlockSize);
+                block->next = i + 1 < BatchSize ? reinterpret_cast<Block*>(first + (i + 1) * BlockSize) : nullptr;
+            }
+            chunkUsed_ += BatchSize;
+            created_.fetch_add(BatchSize, std::memory_order_relaxed);
+            return reinterpret_cast<Block*>(first);
+        }
+
+        std::mutex mutex_;
+        std::vector<char*> chunks_;
+        std::map<char*, size_t> arenas_; // From takeContiguous with their block counts, kept (like the chunks) for the life of the program
+        size_t chunkUsed_ = 0;
+        std::vector<Block*> batches_;
+        Block* loose_ = nullptr;
+        std::atomic<size_t> created_{0};
+    };
+
+    // The free list of one thread. Its blocks go back to the depot when the thread ends.
+    struct Cache {
+        Block* free = nullptr;
+        size_t count = 0;
+
+        Cache() { state() = Alive; }
+
+        static Cache& local() {
+            static thread_local Cache cache;
+            return cache;
+        }
+
+        // False once the cache of this thread was destroyed (objects deleted at thread or program exit)
+        static bool usable() { return state() != Destroyed; }
+
+        ~Cache() {
+            state() = Destroyed;
+            while (free != nullptr) {
+                Block* next = free->next;
+                Depot::instance().give(free);
+                free = next;
+            }
+        }
+
+    private:
+        enum State : unsigned char { Unused, Alive, Destroyed };
+
+        // A trivially destructible thread_local, still readable after the Cache is gone
+        static State& state() {
+            static thread_local State value = Unused;
+            return value;
+        }
+    };
+};
+
+// Mixin with the class specific allocation functions of T, routed to TypePool<T>
+template<typename T>
+struct PooledNew {
+    using pool_type = TypePool<T>;
+
+    static void* operator new(size_t size) {
+        return size == sizeof(T) ? TypePool<T>::allocate() : ::operator new(size);
+    }
+
+    static void* operator new(size_t size, std::align_val_t alignment) {
+        if (size == sizeof(T) && static_cast<size_t>(alignment) <= TypePool<T>::BlockAlign) {
+            return TypePool<T>::allocate();
+        }
+        return ::operator new(size, alignment);
+    }
+
+    // Both deletes report the address first, so observer_ptrs to the object trap in checked builds
+    static void operator delete(void* pointer, size_t size) noexcept {
+        runDeleteHook(pointer);
+        if (size == sizeof(T)) {
+            TypePool<T>::deallocate(pointer);
+        } else {
+            ::operator delete(pointer, size);
+        }
+    }
+
+    static void operator delete(void* pointer, size_t size, std::align_val_t alignment) noexcept {
+        runDeleteHook(pointer);
+        if (size == sizeof(T) && static_cast<size_t>(alignment) <= TypePool<T>::BlockAlign) {
+            TypePool<T>::deallocate(pointer);
+        } else {
+            ::operator delete(pointer, size, alignment);
+        }
+    }
+
+    // Arrays are not pooled
+    static void* operator new[](size_t size) { return ::operator new[](size); }
+    static void operator delete[](void* pointer) noexcept { ::operator delete[](pointer); }
+};
+
+// The same allocation functions for a type that cannot have a base class, for example because it is
+// an aggregate built with Person{"name", "address", 30}. Put it inside the class body.
+#define POOLED_NEW(Type) \
+    using pool_type = TypePool<Type>; \
+    static void* operator new(size_t size) { return PooledNew<Type>::operator new(size); } \
+    static void* operator new(size_t size, std::align_val_t alignment) { \
+        return PooledNew<Type>::operator new(size, alignment); \
+    } \
+    static void operator delete(void* pointer, size_t size) noexcept { \
+        PooledNew<Type>::operator delete(pointer, size); \
+    } \
+    static void operator delete(void* pointer, size_t size, std::align_val_t alignment) noexcept { \
+        PooledNew<Type>::operator delete(pointer, size, alignment); \
+    } \
+    static void* operator new[](size_t size) { return ::operator new[](size); } \
+    static void operator delete[](void* pointer) noexcept { ::operator delete[](pointer); }
+
+#endif //SMARTPOINTERCPP_POOLED_NEW_H
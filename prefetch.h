@@ -0,0 +1,165 @@
+#ifndef SMARTPOINTERCPP_PREFETCH_H
+#define SMARTPOINTERCPP_PREFETCH_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <type_traits>
+
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+#include "models.h"
+
+/*
+ *  Software prefetching.
+ *  Asks the CPU to start loading a cache line before we need it, so the later access does not stall.
+ *  It is only a hint: it never faults, even for an invalid address.
+ */
+
+inline void prefetchRead(const void* address) {
+#if defined(__GNUC__) || defined(__clang__)
+    __builtin_prefetch(address, 0, 3);
+#elif defined(_MSC_VER)
+    _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+    (void)address;
+#endif
+}
+
+/*
+ *  Prefetching iteration over containers of pointers.
+ *
+ *      for (const auto& person : prefetched(people, 16)) { total += person->age; }
+ *      for (const auto& person : prefetched(people)) { ... }      // distance tuned while iterating
+ *
+ *  In a std::vector<std::shared_ptr<Person>> the pointers are next to each other, but every Person can be
+ *  anywhere on the heap, so every element is a cache miss the loop waits for. The adaptor prefetches the
+ *  object `distance` elements ahead, so it is (nearly) in cache by the time the loop gets there.
+ *  It pays off when the loop does some work per element; a loop that only adds one field already
+ *  overlaps its misses out of order, and the extra instructions make it slower (see smartPointerBench prefetch).
+ *
+ *  Without a distance the adaptor measures the time per element every TuneWindow elements and moves the
+ *  distance in the direction that made it faster (a simple hill climb between 1 and MaxDistance).
+ */
+
+// Address of the object an element refers to, without reading the object
+template<typename T>
+const void* pointeeAddress(const T& element) {
+    if constexpr (std::is_pointer<T>::value) {
+        return element;
+    } else if constexpr (IsPointerLike<T>::value) {
+        return element.get();
+    } else {
+        return std::addressof(element);
+    }
+}
+
+class PrefetchTuner {
+public:
+    static constexpr size_t TuneWindow = 4096;
+    static constexpr size_t MaxDistance = 128;
+
+    explicit PrefetchTuner(size_t distance) : distance_(distance) {}
+
+    size_t distance() const { return distance_; }
+
+    void tick() {
+        if (++count_ < TuneWindow) {
+            return;
+        }
+        count_ = 0;
+        auto now = std::chrono::steady_clock::now();
+        double cost = std::chrono::duration<double>(now - windowStart_).count();
+        windowStart_ = now;
+        if (lastCost_ > 0 && cost > lastCost_) {
+            direction_ = -direction_; // The last step made it slower, turn around
+        }
+        lastCost_ = cost;
+        size_t step = std::max<size_t>(1, distance_ / 4);
+        distance_ = direction_ > 0 ? std::min(MaxDistance, distance_ + step)
+                                   : std::max<size_t>(1, distance_ > step ? distance_ - step : 1);
+    }
+
+private:
+    size_t distance_;
+    size_t count_ = 0;
+    int direction_ = 1;
+    double lastCost_ = 0;
+    std::chrono::steady_clock::time_point windowStart_ = std::chrono::steady_clock::now();
+};
+
+template<typename It>
+class PrefetchIterator {
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = typename std::iterator_traits<It>::value_type;
+    using difference_type = typename std::iterator_traits<It>::difference_type;
+    using reference = typename std::iterator_traits<It>::reference;
+    using pointer = typename std::iterator_traits<It>::pointer;
+
+    PrefetchIterator(It current, It last, size_t distance, PrefetchTuner* tuner)
+            : current_(current), last_(last), distance_(distance), tuner_(tuner) {
+        // Warm up: prefetch the first `distance` objects
+        for (It it = current_; it != last_ && static_cast<size_t>(it - current_) < distance_; ++it) {
+            prefetchRead(pointeeAddress(*it));
+        }
+    }
+
+    reference operator*() const { return *current_; }
+    It operator->() const { return current_; }
+
+    PrefetchIterator& operator++() {
+        ++current_;
+        if (tuner_ != nullptr) {
+            tuner_->tick();
+            distance_ = tuner_->distance();
+        }
+        if (static_cast<size_t>(last_ - current_) > distance_) {
+            prefetchRead(pointeeAddress(current_[static_cast<difference_type>(distance_)]));
+        }
+        return *this;
+    }
+
+    bool operator==(const PrefetchIterator& other) const { return current_ == other.current_; }
+    bool operator!=(const PrefetchIterator& other) const { return current_ != other.current_; }
+
+private:
+    It current_;
+    It last_;
+    size_t distance_;
+    PrefetchTuner* tuner_;
+};
+
+template<typename It>
+class PrefetchRange {
+public:
+    // distance 0: tune the distance while iterating
+    PrefetchRange(It first, It last, size_t distance)
+            : first_(first), last_(last), distance_(distance == 0 ? 8 : distance), tuner_(distance_),
+              adaptive_(distance == 0) {}
+
+    PrefetchIterator<It> begin() { return PrefetchIterator<It>(first_, last_, distance_, adaptive_ ? &tuner_ : nullptr); }
+    PrefetchIterator<It> end() { return PrefetchIterator<It>(last_, last_, 0, nullptr); }
+
+    // The distance the tuner arrived at (or the fixed distance)
+    size_t distance() const { return adaptive_ ? tuner_.distance() : distance_; }
+
+private:
+    It first_;
+    It last_;
+    size_t distance_;
+    PrefetchTuner tuner_;
+    bool adaptive_;
+};
+
+// Prefetching view over a random access container, see above. distance 0 tunes the distance itself.
+template<typename Container>
+auto prefetched(Container& container, size_t distance = 0) {
+    return PrefetchRange<decltype(std::begin(container))>(std::begin(container), std::end(container), distance);
+}
+
+#endif //SMARTPOINTERCPP_PREFETCH_H
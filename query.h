@@ -0,0 +1,273 @@
+#ifndef SMARTPOINTERCPP_QUERY_H
+#define SMARTPOINTERCPP_QUERY_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "models.h"
+
+/*
+ *  Fused predicate expressions for Person queries.
+ *
+ *      using namespace query;
+ *      auto adultsNamedJ = where(age > 30 && name.startsWith("J"));
+ *      std::vector<size_t> rows = adultsNamedJ.rows(persons.begin(), persons.end());
+ *
+ *  The expression is an expression template: `age > 30 && name.startsWith("J")` builds a small tree of
+ *  types instead of evaluating anything, and the whole tree is inlined into one loop over the input.
+ *  There is one pass over the data instead of one pass per chained lambda, && and || evaluate both
+ *  sides without short circuit, and matching rows are collected without a branch.
+ *
+ *  On a PersonTable (columnar input) every node is evaluated for a block of rows into a byte mask.
+ *  Those loops read one contiguous column and have no branches, so the compiler turns them into
+ *  SIMD instructions (for example -O2 on GCC 12+, -O3 on older compilers).
+ */
+
+namespace query {
+
+constexpr size_t BlockRows = 256;
+
+// Base of all expression nodes, used to find out which operands are part of an expression.
+struct Node {};
+
+template<typename T>
+constexpr bool isNode = std::is_base_of<Node, std::decay_t<T>>::value;
+
+// A constant in an expression, for example the 30 in `age > 30`
+template<typename T>
+struct Literal : Node {
+    T value;
+
+    explicit Literal(T v) : value(std::move(v)) {}
+
+    const T& get(const Person&) const { return value; }
+    const T& at(const PersonTable&, size_t) const { return value; }
+};
+
+template<typename Prefix>
+struct StartsWith;
+
+// A Person attribute together with the matching column of a PersonTable
+template<typename T, T Person::* Member, std::vector<T> PersonTable::* Column>
+struct Field : Node {
+    using Type = T;
+
+    const T& get(const Person& person) const { return person.*Member; }
+    const T& at(const PersonTable& table, size_t row) const { return (table.*Column)[row]; }
+
+    template<typename U = T, typename = std::enable_if_t<std::is_same<U, std::string>::value>>
+    StartsWith<Field> startsWith(std::string prefix) const { return StartsWith<Field>{*this, std::move(prefix)}; }
+};
+
+using AgeField = Field<size_t, &Person::age, &PersonTable::age>;
+using IdField = Field<size_t, &Person::id, &PersonTable::id>;
+using NameField = Field<std::string, &Person::name, &PersonTable::name>;
+using AddressField = Field<std::string, &Person::address, &PersonTable::address>;
+
+constexpr AgeField age{};
+constexpr IdField id{};
+constexpr NameField name{};
+constexpr AddressField address{};
+
+// Leaf values (fields and literals) are turned into predicates by comparing them
+template<typename Op, typename L, typename R>
+struct Compare : Node {
+    L left;
+    R right;
+
+    Compare(L l, R r) : left(std::move(l)), right(std::move(r)) {}
+
+    bool operator()(const Person& person) const { return Op()(left.get(person), right.get(person)); }
+
+    void block(const PersonTable& table, size_t begin, size_t n, uint8_t* mask) const {
+        for (size_t i = 0; i < n; ++i) {
+            mask[i] = Op()(left.at(table, begin + i), right.at(table, begin + i));
+        }
+    }
+};
+
+template<typename F>
+struct StartsWith : Node {
+    F field;
+    std::string prefix;
+
+    StartsWith(F f, std::string p) : field(f), prefix(std::move(p)) {}
+
+    bool operator()(const Person& person) const { return matches(field.get(person)); }
+
+    void block(const PersonTable& table, size_t begin, size_t n, uint8_t* mask) const {
+        for (size_t i = 0; i < n; ++i) {
+            mask[i] = matches(field.at(table, begin + i));
+        }
+    }
+
+private:
+    bool matches(const std::string& value) const {
+        return value.size() >= prefix.size() && value.compare(0, prefix.size(), prefix) == 0;
+    }
+};
+
+// Bitwise combination of two predicates, both sides are always evaluated (no branch)
+template<typename Op, typename L, typename R>
+struct Combine : Node {
+    L left;
+    R right;
+
+    Combine(L l, R r) : left(std::move(l)), right(std::move(r)) {}
+
+    bool operator()(const Person& person) const {
+        return Op()(static_cast<unsigned>(left(person)), static_cast<unsigned>(right(person))) != 0;
+    }
+
+    void block(const PersonTable& table, size_t begin, size_t n, uint8_t* mask) const {
+        uint8_t other[BlockRows];
+        left.block(table, begin, n, mask);
+        right.block(table, begin, n, other);
+        for (size_t i = 0; i < n; ++i) {
+            mask[i] = static_cast<uint8_t>(Op()(mask[i], other[i]));
+        }
+    }
+};
+
+template<typename E>
+struct Negate : Node {
+    E inner;
+
+    explicit Negate(E e) : inner(std::move(e)) {}
+
+    bool operator()(const Person& person) const { return !inner(person); }
+
+    void block(const PersonTable& table, size_t begin, size_t n, uint8_t* mask) const {
+        inner.block(table, begin, n, mask);
+        for (size_t i = 0; i < n; ++i) {
+            mask[i] ^= 1;
+        }
+    }
+};
+
+// Turns the operand of a comparison into a node. Plain values become a Literal of the
+// type of the field they are compared with, so `age > 30` compares size_t with size_t.
+template<typename Other, typename T>
+auto operand(T&& value) {
+    if constexpr (isNode<T>) {
+        return std::forward<T>(value);
+    } else {
+        return Literal<typename std::decay_t<Other>::Type>(std::forward<T>(value));
+    }
+}
+
+template<typename Op, typename L, typename R>
+auto compare(L&& left, R&& right) {
+    auto l = operand<R>(std::forward<L>(left));
+    auto r = operand<L>(std::forward<R>(right));
+    return Compare<Op, decltype(l), decltype(r)>(std::move(l), std::move(r));
+}
+
+template<typename L, typename R>
+using EnableIfNode = std::enable_if_t<isNode<L> || isNode<R>, int>;
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator==(L&& l, R&& r) { return compare<std::equal_to<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator!=(L&& l, R&& r) { return compare<std::not_equal_to<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator<(L&& l, R&& r) { return compare<std::less<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator<=(L&& l, R&& r) { return compare<std::less_equal<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator>(L&& l, R&& r) { return compare<std::greater<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, EnableIfNode<L, R> = 0>
+auto operator>=(L&& l, R&& r) { return compare<std::greater_equal<>>(std::forward<L>(l), std::forward<R>(r)); }
+
+template<typename L, typename R, std::enable_if_t<isNode<L> && isNode<R>, int> = 0>
+auto operator&&(L&& l, R&& r) {
+    return Combine<std::bit_and<>, std::decay_t<L>, std::decay_t<R>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template<typename L, typename R, std::enable_if_t<isNode<L> && isNode<R>, int> = 0>
+auto operator||(L&& l, R&& r) {
+    return Combine<std::bit_or<>, std::decay_t<L>, std::decay_t<R>>(std::forward<L>(l), std::forward<R>(r));
+}
+
+template<typename E, std::enable_if_t<isNode<E>, int> = 0>
+auto operator!(E&& e) { return Negate<std::decay_t<E>>(std::forward<E>(e)); }
+
+// A compiled query, evaluates its predicate in one fused pass
+template<typename E>
+class Query {
+public:
+    explicit Query(E predicate) : predicate_(std::move(predicate)) {}
+
+    // Usable as a plain predicate, for example with std::copy_if or std::count_if.
+    // Accepts Person as well as (smart) pointers to Person.
+    template<typename Element>
+    bool operator()(const Element& element) const { return predicate_(elementRef(element)); }
+
+    // Row indices of all matching elements in [first, last)
+    template<typename It>
+    std::vector<size_t> rows(It first, It last) const {
+        size_t count = static_cast<size_t>(std::distance(first, last));
+        std::vector<size_t> out(count + 1);
+        size_t found = 0;
+        for (size_t row = 0; row < count; ++row, ++first) {
+            // Always write, only advance when it matched: no branch on the predicate
+            out[found] = row;
+            found += predicate_(elementRef(*first));
+        }
+        out.resize(found);
+        return out;
+    }
+
+    // Row indices of all matching rows of a columnar table, evaluated block by block
+    std::vector<size_t> rows(const PersonTable& table) const {
+        std::vector<size_t> out(table.size() + 1);
+        size_t found = 0;
+        uint8_t mask[BlockRows];
+        for (size_t begin = 0; begin < table.size(); begin += BlockRows) {
+            size_t n = std::min(BlockRows, table.size() - begin);
+            predicate_.block(table, begin, n, mask);
+            for (size_t i = 0; i < n; ++i) {
+                out[found] = begin + i;
+                found += mask[i];
+            }
+        }
+        out.resize(found);
+        return out;
+    }
+
+    size_t count(const PersonTable& table) const {
+        size_t found = 0;
+        uint8_t mask[BlockRows];
+        for (size_t begin = 0; begin < table.size(); begin += BlockRows) {
+            size_t n = std::min(BlockRows, table.size() - begin);
+            predicate_.block(table, begin, n, mask);
+            for (size_t i = 0; i < n; ++i) {
+                found += mask[i];
+            }
+        }
+        return found;
+    }
+
+private:
+    E predicate_;
+};
+
+template<typename E, std::enable_if_t<isNode<E>, int> = 0>
+Query<std::decay_t<E>> where(E&& predicate) {
+    return Query<std::decay_t<E>>(std::forward<E>(predicate));
+}
+
+} // namespace query
+
+#endif //SMARTPOINTERCPP_QUERY_H
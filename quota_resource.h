@@ -0,0 +1,275 @@
+#ifndef SMARTPOINTERCPP_QUOTA_RESOURCE_H
+#define SMARTPOINTERCPP_QUOTA_RESOURCE_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/*
+ *  Memory budgets per subsystem.
+ *
+ *      QuotaResource process("process", 1 << 30, 2 << 30);                  // soft 1 GB, hard 2 GB
+ *      QuotaResource postCache("post cache", 64 << 20, 128 << 20, &process);
+ *      postCache.onSoftLimit([&](QuotaResource&) { cache.shrink(); });
+ *      auto post = makeSharedIn<Post>(postCache);                            // see factories.h
+ *
+ *  A QuotaResource is a std::pmr::memory_resource, so it works with every pmr container and allocator.
+ *  Resources form a tree: every allocation is charged to the resource and all of its parents, and the
+ *  memory itself comes from the upstream resource (by default the upstream of the parent, at the root new/delete).
+ *
+ *  Going over the soft limit calls the soft limit callback, which gives a cache the chance to shed load.
+ *  An allocation that would go over the hard limit calls the hard limit callback once and, when there
+ *  is still no room, throws std::bad_alloc. Only that subsystem fails, instead of the whole process.
+ *
+ *  Accounting is lock free. Threads do not update one shared counter for every allocation: every
+ *  thread works on its own slot (a cache line) with a small credit reserved from the shared counter
+ *  in chunks of CreditChunk bytes, so most allocations only touch memory nobody else writes to.
+ *  The chunk shrinks with the smallest hard limit of the resource and its parents, so all slots together
+ *  hold at most half of it as credit, and an allocation that does not fit takes the credit of the other
+ *  slots back, those of the children included, before it fails.
+ */
+
+class QuotaResource : public std::pmr::memory_resource {
+public:
+    using Callback = std::function<void(QuotaResource&)>;
+
+    // Most bytes a thread reserves from the shared counter at once
+    static constexpr size_t CreditChunk = 64 * 1024;
+    static constexpr size_t Unlimited = ~size_t{0};
+
+    explicit QuotaResource(std::string name, size_t softLimit = Unlimited, size_t hardLimit = Unlimited,
+                           QuotaResource* parent = nullptr, std::pmr::memory_resource* upstream = nullptr)
+            : name_(std::move(name)), softLimit_(softLimit), hardLimit_(hardLimit), parent_(parent),
+              upstream_(upstream ? upstream : parent ? parent->upstream_ : std::pmr::new_delete_resource()),
+              creditChunk_(std::min(CreditChunk, smallestHardLimit(hardLimit, parent) / (4 * SlotCount))) {
+        if (parent_) {
+            std::lock_guard<std::mutex> lock(parent_->childrenMutex_);
+            parent_->children_.push_back(this);
+        }
+    }
+
+    QuotaResource(const QuotaResource&) = delete;
+    QuotaResource& operator=(const QuotaResource&) = delete;
+
+    ~QuotaResource() override {
+        if (parent_) {
+            std::lock_guard<std::mutex> lock(parent_->childrenMutex_);
+            auto& siblings = parent_->children_;
+            siblings.erase(std::find(siblings.begin(), siblings.end(), this));
+        }
+        // Give the unused credit of every slot back to the parents
+        reclaimCredit();
+    }
+
+    void onSoftLimit(Callback callback) { softCallback_ = std::move(callback); }
+    void onHardLimit(Callback callback) { hardCallback_ = std::move(callback); }
+
+    const std::string& name() const { return name_; }
+    QuotaResource* parent() const { return parent_; }
+    size_t softLimit() const { return softLimit_; }
+    size_t hardLimit() const { return hardLimit_; }
+
+    // Bytes currently allocated directly through this resource.
+    // A thread may free on another slot than it allocated on, the sum wraps back to the right value.
+    size_t used() const {
+        size_t total = 0;
+        for (const auto& slot : slots_) {
+            total += slot.used.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    // Bytes charged against the limits: what is used plus the credit the threads hold,
+    // including everything reserved by the children
+    size_t reserved() const { return reserved_.load(std::memory_order_relaxed); }
+
+    // Number of allocations refused because of the hard limit
+    size_t refusals() const { return refusals_.load(std::memory_order_relaxed); }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        charge(bytes);
+        try {
+            return upstream_->allocate(bytes, alignment);
+        } catch (...) {
+            uncharge(bytes);
+            throw;
+        }
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        upstream_->deallocate(p, bytes, alignment);
+        uncharge(bytes);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    static constexpr size_t SlotCount = 16;
+
+    // One cache line per slot, so threads on different slots do not share a cache line
+    struct alignas(64) Slot {
+        std::atomic<size_t> credit{0}; // Reserved from reserved_ but not yet used
+        std::atomic<size_t> used{0};   // Bytes allocated by the threads on this slot
+    };
+
+    static size_t slotIndex() {
+        static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % SlotCount;
+        return index;
+    }
+
+    // Charges bytes to this resource, taking them from the credit of this thread's slot when possible
+    void charge(size_t bytes) {
+        Slot& slot = slots_[slotIndex()];
+        size_t credit = slot.credit.load(std::memory_order_relaxed);
+        while (credit >= bytes) {
+            if (slot.credit.compare_exchange_weak(credit, credit - bytes, std::memory_order_relaxed)) {
+                slot.used.fetch_add(bytes, std::memory_order_relaxed);
+                return;
+            }
+        }
+        // Not enough credit: reserve the allocation plus a new chunk of credit
+        size_t request = bytes + creditChunk_;
+        if (!reserve(request, false)) {
+            request = bytes; // Close to the limit, only reserve what is needed right now
+            if (!reserve(request)) {
+                refusals_.fetch_add(1, std::memory_order_relaxed);
+                throw std::bad_alloc();
+            }
+        }
+        slot.used.fetch_add(bytes, std::memory_order_relaxed);
+        // A limit callback may have freed memory into this slot in the meantime
+        addCredit(slot, request - bytes);
+    }
+
+    void uncharge(size_t bytes) {
+        Slot& slot = slots_[slotIndex()];
+        slot.used.fetch_sub(bytes, std::memory_order_relaxed);
+        addCredit(slot, bytes);
+    }
+
+    void addCredit(Slot& slot, size_t bytes) {
+        size_t credit = slot.credit.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        // Keep at most two chunks of credit per slot, give the rest back
+        if (credit > 2 * creditChunk_) {
+            size_t extra = credit - creditChunk_;
+            size_t expected = credit;
+            if (slot.credit.compare_exchange_strong(expected, creditChunk_, std::memory_order_relaxed)) {
+                release(extra);
+            }
+        }
+    }
+
+    // Reserves bytes in this resource and all parents, false when a hard limit would be exceeded.
+    // shed: take back the credit of the slots and call the hard limit callback before giving up.
+    bool reserve(size_t bytes, bool shed = true) {
+        size_t after = reserved_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (after > hardLimit_) {
+            reserved_.fetch_sub(bytes, std::memory_order_relaxed);
+            if (!shed) {
+                return false;
+            }
+            // The credit of the slots counts as reserved but is not in use
+            if (reclaimCredit() > 0 && tryReserve(bytes)) {
+                return reserveInParent(bytes, shed);
+            }
+            // Let the subsystem free something and try once more
+            if (!hardCallback_ || inCallback_.exchange(true)) {
+                return false;
+            }
+            hardCallback_(*this);
+            inCallback_.store(false);
+            reclaimCredit(); // What the callback freed went to the credit of its slot
+            if (!tryReserve(bytes)) {
+                return false;
+            }
+            return reserveInParent(bytes, shed);
+        }
+        if (after > softLimit_ && after - bytes <= softLimit_) {
+            // Crossed the soft limit with this reservation
+            if (softCallback_ && !inCallback_.exchange(true)) {
+                softCallback_(*this);
+                inCallback_.store(false);
+            }
+        }
+        return reserveInParent(bytes, shed);
+    }
+
+    bool tryReserve(size_t bytes) {
+        if (reserved_.fetch_add(bytes, std::memory_order_relaxed) + bytes <= hardLimit_) {
+            return true;
+        }
+        reserved_.fetch_sub(bytes, std::memory_order_relaxed);
+        return false;
+    }
+
+    static size_t smallestHardLimit(size_t hardLimit, const QuotaResource* parent) {
+        for (; parent != nullptr; parent = parent->parent_) {
+            hardLimit = std::min(hardLimit, parent->hardLimit_);
+        }
+        return hardLimit;
+    }
+
+    // Gives the credit of every slot back, also of the children (it is charged to this resource as
+    // well), returns how much that was
+    size_t reclaimCredit() {
+        size_t total = 0;
+        {
+            std::lock_guard<std::mutex> lock(childrenMutex_);
+            for (QuotaResource* child : children_) {
+                total += child->reclaimCredit();
+            }
+        }
+        for (auto& slot : slots_) {
+            size_t credit = slot.credit.exchange(0, std::memory_order_relaxed);
+            if (credit > 0) {
+                release(credit);
+                total += credit;
+            }
+        }
+        return total;
+    }
+
+    bool reserveInParent(size_t bytes, bool shed) {
+        if (parent_ && !parent_->reserve(bytes, shed)) {
+            reserved_.fetch_sub(bytes, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    void release(size_t bytes) {
+        reserved_.fetch_sub(bytes, std::memory_order_relaxed);
+        if (parent_) {
+            parent_->release(bytes);
+        }
+    }
+
+    std::string name_;
+    size_t softLimit_;
+    size_t hardLimit_;
+    QuotaResource* parent_;
+    std::pmr::memory_resource* upstream_;
+    size_t creditChunk_;
+    std::mutex childrenMutex_;
+    std::vector<QuotaResource*> children_; // Whose credit is reclaimed with ours
+    Callback softCallback_;
+    Callback hardCallback_;
+    std::atomic<bool> inCallback_{false};
+    std::atomic<size_t> reserved_{0};
+    std::atomic<size_t> refusals_{0};
+    std::array<Slot, SlotCount> slots_{};
+};
+
+#endif //SMARTPOINTERCPP_QUOTA_RESOURCE_H
@@ -0,0 +1,53 @@
+#ifndef SMARTPOINTERCPP_READ_INDICATOR_H
+#define SMARTPOINTERCPP_READ_INDICATOR_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <thread>
+
+/*
+ *  Counts the readers inside a critical section, for a writer that has to wait until they left.
+ *  Every thread counts on its own slot (a cache line, picked by thread id), so readers arriving at the
+ *  same time do not fight over one cache line. Only the writer reads all slots.
+ *  Used by LeftRight (left_right.h) and EpochDomain (epoch.h).
+ */
+
+class ReadIndicator {
+public:
+    void arrive() { slots_[slotIndex()].readers.fetch_add(1, std::memory_order_seq_cst); }
+    void depart() { slots_[slotIndex()].readers.fetch_sub(1, std::memory_order_release); }
+
+    bool empty() const {
+        for (const auto& slot : slots_) {
+            if (slot.readers.load(std::memory_order_acquire) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Spins (yielding) until no reader is left
+    void waitUntilEmpty() const {
+        while (!empty()) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    static constexpr size_t SlotCount = 16;
+
+    struct alignas(64) Slot {
+        std::atomic<size_t> readers{0};
+    };
+
+    static size_t slotIndex() {
+        static thread_local size_t index = std::hash<std::thread::id>()(std::this_thread::get_id()) % SlotCount;
+        return index;
+    }
+
+    std::array<Slot, SlotCount> slots_{};
+};
+
+#endif //SMARTPOINTERCPP_READ_INDICATOR_H
@@ -0,0 +1,119 @@
+#ifndef SMARTPOINTERCPP_SEQLOCK_H
+#define SMARTPOINTERCPP_SEQLOCK_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+/*
+ *  Seqlock: consistent reads of a small record without locks.
+ *
+ *      Seqlock<PersonHot> scalars(PersonHot{30, 1});      // age and id of a Person, see hot_cold.h
+ *      PersonHot now = scalars.load();                     // Never a mix of two writes
+ *      scalars.store(PersonHot{31, 1});
+ *      scalars.update([](PersonHot& p) { ++p.age; });      // Read, change, write under the writer lock
+ *
+ *  A sequence number is odd while a write is in progress. A reader remembers the sequence, copies the
+ *  record and checks the sequence again: if it changed (or was odd) a writer was busy and the copy may be
+ *  torn, so the reader tries again. Readers never write shared memory, so any number of them can read
+ *  without moving a cache line between cores; writers are serialized by a small spin lock.
+ *
+ *  Only for trivially copyable records of a few words, like the scalar fields of a Person. The record is
+ *  stored as atomic words, so a reader racing a writer is well defined; a large record would make
+ *  readers retry too often, use LeftRight (left_right.h) for that.
+ */
+
+template<typename T>
+class Seqlock {
+    static_assert(std::is_trivially_copyable<T>::value, "a Seqlock copies the record word by word");
+
+public:
+    explicit Seqlock(const T& value = T{}) { storeWords(value); }
+
+    Seqlock(const Seqlock&) = delete;
+    Seqlock& operator=(const Seqlock&) = delete;
+
+    T load() const {
+        for (;;) {
+            uint64_t before = sequence_.load(std::memory_order_acquire);
+            if (before & 1) {
+                std::this_thread::yield(); // A writer is busy
+                continue;
+            }
+            T value = loadWords();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (sequence_.load(std::memory_order_relaxed) == before) {
+                return value;
+            }
+        }
+    }
+
+    void store(const T& value) {
+        WriteGuard guard(*this);
+        storeWords(value);
+    }
+
+    // Calls change(T&) on the current value and stores the result, atomically for other writers
+    template<typename Change>
+    void update(Change&& change) {
+        WriteGuard guard(*this);
+        T value = loadWords();
+        change(value);
+        storeWords(value);
+    }
+
+    // Number of writes so far
+    uint64_t version() const { return sequence_.load(std::memory_order_acquire) / 2; }
+
+private:
+    static constexpr size_t WordCount = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+
+    // Takes the writer lock and keeps the sequence odd for the lifetime of the guard
+    class WriteGuard {
+    public:
+        explicit WriteGuard(Seqlock& lock) : lock_(lock) {
+            while (lock_.writing_.exchange(true, std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            lock_.sequence_.store(lock_.sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        ~WriteGuard() {
+            lock_.sequence_.store(lock_.sequence_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            lock_.writing_.store(false, std::memory_order_release);
+        }
+
+    private:
+        Seqlock& lock_;
+    };
+
+    T loadWords() const {
+        uint64_t buffer[WordCount];
+        for (size_t i = 0; i < WordCount; ++i) {
+            buffer[i] = words_[i].load(std::memory_order_relaxed);
+        }
+        T value;
+        std::memcpy(&value, buffer, sizeof(T));
+        return value;
+    }
+
+    void storeWords(const T& value) {
+        uint64_t buffer[WordCount] = {};
+        std::memcpy(buffer, &value, sizeof(T));
+        for (size_t i = 0; i < WordCount; ++i) {
+            words_[i].store(buffer[i], std::memory_order_relaxed);
+        }
+    }
+
+    std::atomic<uint64_t> sequence_{0};
+    std::atomic<bool> writing_{false};
+    std::array<std::atomic<uint64_t>, WordCount> words_{};
+};
+
+#endif //SMARTPOINTERCPP_SEQLOCK_H
@@ -0,0 +1,136 @@
+#ifndef SMARTPOINTERCPP_SERIALIZATION_H
+#define SMARTPOINTERCPP_SERIALIZATION_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+#include "models.h"
+
+/*
+ *  Compact binary form of the model structs, for the spill and tiering code.
+ *
+ *      std::string bytes;
+ *      ByteWriter writer(bytes);
+ *      serialize(writer, *post);
+ *      ByteReader reader(bytes);
+ *      auto copy = std::make_shared<Post>(deserializePost(reader));
+ *      linkComments(copy);                     // Comment::post of the copy points to the copy
+ *
+ *  Numbers are written as varints (7 bits per byte, small numbers take one byte), strings as their
+ *  length followed by the characters. A Post carries its comments (their text); Comment::post is a
+ *  pointer and is not written, linkComments sets it again after reading.
+ *  ByteReader throws std::runtime_error when the data ends early.
+ */
+
+class ByteWriter {
+public:
+    explicit ByteWriter(std::string& out) : out_(out) {}
+
+    void number(uint64_t value) {
+        while (value >= 0x80) {
+            out_.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out_.push_back(static_cast<char>(value));
+    }
+
+    void text(std::string_view value) {
+        number(value.size());
+        out_.append(value);
+    }
+
+private:
+    std::string& out_;
+};
+
+class ByteReader {
+public:
+    explicit ByteReader(std::string_view in) : in_(in) {}
+
+    uint64_t number() {
+        uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (position_ >= in_.size()) {
+                throw std::runtime_error("ByteReader: data ends inside a number");
+            }
+            auto byte = static_cast<unsigned char>(in_[position_++]);
+            value |= uint64_t{byte & 0x7fu} << shift;
+            if ((byte & 0x80) == 0) {
+                return value;
+            }
+        }
+        throw std::runtime_error("ByteReader: number too long");
+    }
+
+    std::string_view text() {
+        uint64_t size = number();
+        if (size > in_.size() - position_) {
+            throw std::runtime_error("ByteReader: data ends inside a string");
+        }
+        std::string_view value = in_.substr(position_, size);
+        position_ += size;
+        return value;
+    }
+
+    bool done() const { return position_ == in_.size(); }
+    size_t remaining() const { return in_.size() - position_; }
+    size_t position() const { return position_; }
+
+private:
+    std::string_view in_;
+    size_t position_ = 0;
+};
+
+inline void serialize(ByteWriter& writer, const Person& person) {
+    writer.text(person.name);
+    writer.text(person.address);
+    writer.number(person.age);
+    writer.number(person.id);
+}
+
+inline Person deserializePerson(ByteReader& reader) {
+    Person person;
+    person.name = std::string(reader.text());
+    person.address = std::string(reader.text());
+    person.age = reader.number();
+    person.id = reader.number();
+    return person;
+}
+
+inline void serialize(ByteWriter& writer, const Post& post) {
+    writer.text(post.content);
+    writer.number(post.authorId);
+    writer.number(post.comments.size());
+    for (const auto& comment : post.comments) {
+        writer.text(comment->text.view());
+    }
+}
+
+// The comments come back without Comment::post, see linkComments
+inline Post deserializePost(ByteReader& reader) {
+    Post post;
+    post.content = std::string(reader.text());
+    post.authorId = reader.number();
+    uint64_t comments = reader.number();
+    post.comments.reserve(std::min<uint64_t>(comments, reader.remaining())); // Every comment takes a byte at least
+    for (uint64_t i = 0; i < comments; ++i) {
+        auto comment = std::make_shared<Comment>();
+        comment->text = reader.text();
+        post.comments.push_back(std::move(comment));
+    }
+    return post;
+}
+
+// Points Comment::post of every comment of post back to post
+inline void linkComments(const std::shared_ptr<Post>& post) {
+    for (auto& comment : post->comments) {
+        comment->post = post;
+    }
+}
+
+#endif //SMARTPOINTERCPP_SERIALIZATION_H
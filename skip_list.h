@@ -0,0 +1,379 @@
+#ifndef SMARTPOINTERCPP_SKIP_LIST_H
+#define SMARTPOINTERCPP_SKIP_LIST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <optional>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "epoch.h"
+#include "latency_histogram.h"
+#include "models.h"
+#include "parallel.h"
+
+/*
+ *  Lock free skip list, used as an ordered index on Person age.
+ *
+ *      PersonAgeIndex index;
+ *      index.insert(ageKey(*person), person);                  // key (age, id), value shared_ptr<Person>
+ *      for (const auto& entry : index.range({30, 0}, {40, 0})) {
+ *          std::cout << entry.value->name;                     // Everyone aged 30 to 39, ordered by (age, id)
+ *      }
+ *      index.erase(ageKey(*person));
+ *
+ *  insert, erase, find and range can be called from any number of threads at the same time, nobody takes
+ *  a lock. A range is always current: it walks the live list, so it sees entries inserted after it
+ *  started once it gets there, and skips entries erased before it got there.
+ *
+ *  Every node has a tower of `next` links; level 0 links all nodes, each higher level about a quarter of
+ *  the level below. The low bit of a link marks its node as erased on that level (Harris, Fraser):
+ *  erase marks the tower top down, level 0 last, and the next search unlinks marked nodes with a CAS.
+ *  An erased node may still be read by threads that found it before, so it is handed to an EpochDomain
+ *  (epoch.h) and freed when they are all gone. Every operation and every live range pins the epoch.
+ *
+ *  Keys are unique. Values are fixed once inserted, readers get them by const reference.
+ */
+
+template<typename Key, typename Value, typename Compare = std::less<Key>>
+class ConcurrentSkipList {
+public:
+    static constexpr size_t MaxHeight = 16;
+
+    struct Entry {
+        Key key;
+        Value value;
+    };
+
+private:
+    struct Node {
+        Entry entry;
+        size_t height;
+        // Both the inserting and the erasing thread have to be done with the node before it is retired
+        std::atomic<int> owners{2};
+
+        Node(const Key& key, const Value& value, size_t height) : entry{key, value}, height(height) {}
+
+        // The tower of links is allocated right behind the node
+        std::atomic<uintptr_t>& next(size_t level) {
+            return reinterpret_cast<std::atomic<uintptr_t>*>(this + 1)[level];
+        }
+    };
+
+    static constexpr uintptr_t Marked = 1;
+
+    static Node* pointerOf(uintptr_t link) { return reinterpret_cast<Node*>(link & ~Marked); }
+    static bool isMarked(uintptr_t link) { return (link & Marked) != 0; }
+    static uintptr_t linkTo(Node* node) { return reinterpret_cast<uintptr_t>(node); }
+
+public:
+    // Entries in [from, to), walking level 0 without a lock
+    class Range {
+    public:
+        class iterator {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = Entry;
+            using difference_type = std::ptrdiff_t;
+            using reference = const Entry&;
+            using pointer = const Entry*;
+
+            iterator(Node* node, const Range* range) : node_(node), range_(range) {}
+
+            reference operator*() const { return node_->entry; }
+            pointer operator->() const { return &node_->entry; }
+
+            iterator& operator++() {
+                node_ = range_->liveFrom(pointerOf(node_->next(0).load(std::memory_order_acquire)));
+                return *this;
+            }
+
+            bool operator==(const iterator& other) const { return node_ == other.node_; }
+            bool operator!=(const iterator& other) const { return node_ != other.node_; }
+
+        private:
+            Node* node_;
+            const Range* range_;
+        };
+
+        Range(const ConcurrentSkipList& list, const Key& from, const Key& to)
+                : list_(list), to_(to), guard_(list.epochs_.pin()), first_(liveFrom(list.lowerBound(from))) {}
+
+        iterator begin() const { return iterator(first_, this); }
+        iterator end() const { return iterator(nullptr, this); }
+
+    private:
+        // The first node from node on that is not erased and still in range, nullptr at the end
+        Node* liveFrom(Node* node) const {
+            while (node != nullptr && isMarked(node->next(0).load(std::memory_order_acquire))) {
+                node = pointerOf(node->next(0).load(std::memory_order_acquire));
+            }
+            return node != nullptr && list_.less_(node->entry.key, to_) ? node : nullptr;
+        }
+
+        const ConcurrentSkipList& list_;
+        Key to_;
+        EpochDomain::Guard guard_; // Keeps the nodes of the range alive while it is iterated
+        Node* first_;
+    };
+
+    explicit ConcurrentSkipList(Compare less = Compare()) : less_(std::move(less)), head_(createNode(Key{}, Value{}, MaxHeight)) {}
+
+    ConcurrentSkipList(const ConcurrentSkipList&) = delete;
+    ConcurrentSkipList& operator=(const ConcurrentSkipList&) = delete;
+
+    ~ConcurrentSkipList() {
+        Node* node = pointerOf(head_->next(0).load());
+        while (node != nullptr) {
+            Node* next = pointerOf(node->next(0).load());
+            destroyNode(node);
+            node = next;
+        }
+        destroyNode(head_);
+    }
+
+    // False when the key is already in the list
+    bool insert(const Key& key, const Value& value) {
+        SMARTPOINTERCPP_LATENCY_SCOPE("ConcurrentSkipList::insert");
+        auto guard = epochs_.pin();
+        return insertPinned(key, value);
+    }
+
+    // Bulk insert of (key, value) pairs: sorted first, so neighbouring inserts share most of their search
+    // path (in cache), then split into `threads` slices of disjoint key ranges. Returns the number inserted.
+    template<typename It>
+    size_t insert(It first, It last, size_t threads = 1) {
+        std::vector<std::pair<Key, Value>> batch(first, last);
+        std::sort(batch.begin(), batch.end(), [this](const auto& a, const auto& b) { return less_(a.first, b.first); });
+        std::atomic<size_t> inserted{0};
+        parallelSlices(batch.size(), threads, [&](size_t, size_t begin, size_t end) {
+            auto guard = epochs_.pin();
+            size_t count = 0;
+            for (size_t i = begin; i < end; ++i) {
+                count += insertPinned(batch[i].first, batch[i].second);
+            }
+            inserted += count;
+        });
+        return inserted;
+    }
+
+    // False when the key is not in the list (or another thread erased it first)
+    bool erase(const Key& key) {
+        SMARTPOINTERCPP_LATENCY_SCOPE("ConcurrentSkipList::erase");
+        auto guard = epochs_.pin();
+        Node* preds[MaxHeight];
+        Node* succs[MaxHeight];
+        if (!find(key, preds, succs)) {
+            return false;
+        }
+        Node* node = succs[0];
+        for (size_t level = node->height - 1; level >= 1; --level) {
+            uintptr_t link = node->next(level).load(std::memory_order_acquire);
+            while (!isMarked(link) && !node->next(level).compare_exchange_weak(link, link | Marked)) {
+            }
+        }
+        uintptr_t link = node->next(0).load(std::memory_order_acquire);
+        for (;;) {
+            if (isMarked(link)) {
+                return false; // Erased by another thread
+            }
+            if (node->next(0).compare_exchange_weak(link, link | Marked)) {
+                break;
+            }
+        }
+        find(key, preds, succs); // Unlinks the node on every level
+        size_.fetch_sub(1, std::memory_order_relaxed);
+        release(node);
+        return true;
+    }
+
+    std::optional<Value> find(const Key& key) const {
+        SMARTPOINTERCPP_LATENCY_SCOPE("ConcurrentSkipList::find");
+        auto guard = epochs_.pin();
+        Node* node = lowerBound(key);
+        while (node != nullptr && isMarked(node->next(0).load(std::memory_order_acquire))) {
+            node = pointerOf(node->next(0).load(std::memory_order_acquire));
+        }
+        if (node != nullptr && !less_(key, node->entry.key) && !less_(node->entry.key, key)) {
+            return node->entry.value;
+        }
+        return std::nullopt;
+    }
+
+    bool contains(const Key& key) const { return find(key).has_value(); }
+
+    Range range(const Key& from, const Key& to) const { return Range(*this, from, to); }
+
+    // Number of entries, exact when no insert or erase is running
+    size_t size() const { return size_.load(std::memory_order_relaxed); }
+
+    // Erased nodes not freed yet, for statistics
+    size_t pendingReclamation() const { return epochs_.pending(); }
+
+private:
+    static Node* createNode(const Key& key, const Value& value, size_t height) {
+        void* memory = ::operator new(sizeof(Node) + height * sizeof(std::atomic<uintptr_t>));
+        Node* node = ::new(memory) Node(key, value, height);
+        for (size_t level = 0; level < height; ++level) {
+            ::new(&node->next(level)) std::atomic<uintptr_t>(0);
+        }
+        return node;
+    }
+
+    static void destroyNode(Node* node) {
+        node->~Node();
+        ::operator delete(node);
+    }
+
+    // Called by the inserting and by the erasing thread when they are done with the node
+    void release(Node* node) {
+        if (node->owners.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            epochs_.retire(node, [](void* pointer) { destroyNode(static_cast<Node*>(pointer)); });
+        }
+    }
+
+    static size_t randomHeight() {
+        static thread_local uint64_t state = std::hash<std::thread::id>()(std::this_thread::get_id()) | 1;
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        size_t height = 1;
+        for (uint64_t bits = state; height < MaxHeight && (bits & 3) == 0; bits >>= 2) {
+            ++height; // Probability 1/4 per level
+        }
+        return height;
+    }
+
+    bool insertPinned(const Key& key, const Value& value) {
+        Node* preds[MaxHeight];
+        Node* succs[MaxHeight];
+        size_t height = randomHeight();
+        Node* node = nullptr;
+        for (;;) {
+            if (find(key, preds, succs)) {
+                if (node != nullptr) {
+                    destroyNode(node); // Never published
+                }
+                return false;
+            }
+            if (node == nullptr) {
+                node = createNode(key, value, height);
+            }
+            for (size_t level = 0; level < height; ++level) {
+                node->next(level).store(linkTo(succs[level]), std::memory_order_relaxed);
+            }
+            uintptr_t expected = linkTo(succs[0]);
+            if (preds[0]->next(0).compare_exchange_strong(expected, linkTo(node))) {
+                break; // In the list from now on
+            }
+        }
+        size_.fetch_add(1, std::memory_order_relaxed);
+
+        // Link the upper levels; stop when the node is being erased in the meantime
+        for (size_t level = 1; level < height; ++level) {
+            bool linked = false;
+            while (!linked) {
+                uintptr_t link = node->next(level).load(std::memory_order_acquire);
+                if (isMarked(link)) {
+                    break;
+                }
+                if (pointerOf(link) != succs[level] &&
+                    !node->next(level).compare_exchange_strong(link, linkTo(succs[level]))) {
+                    break; // Marked right now
+                }
+                uintptr_t expected = linkTo(succs[level]);
+                linked = preds[level]->next(level).compare_exchange_strong(expected, linkTo(node));
+                if (!linked) {
+                    find(key, preds, succs);
+                    if (succs[0] != node) {
+                        break; // Erased
+                    }
+                }
+            }
+            if (!linked) {
+                break;
+            }
+        }
+        if (isMarked(node->next(0).load(std::memory_order_acquire))) {
+            // Erased while linking: a level may have been linked after the eraser cleaned up
+            find(key, preds, succs);
+        }
+        release(node);
+        return true;
+    }
+
+    // Fills the nodes before and after key on every level, unlinking erased nodes on the way.
+    // True when succs[0] holds key.
+    bool find(const Key& key, Node** preds, Node** succs) {
+        while (!tryFind(key, preds, succs)) {
+        }
+        return succs[0] != nullptr && !less_(key, succs[0]->entry.key);
+    }
+
+    // False when another thread changed a link we wanted to unlink, the search then starts over
+    bool tryFind(const Key& key, Node** preds, Node** succs) {
+        Node* pred = head_;
+        for (size_t level = MaxHeight; level-- > 0;) {
+            Node* current = pointerOf(pred->next(level).load(std::memory_order_acquire));
+            while (current != nullptr) {
+                uintptr_t succ = current->next(level).load(std::memory_order_acquire);
+                if (isMarked(succ)) {
+                    uintptr_t expected = linkTo(current);
+                    if (!pred->next(level).compare_exchange_strong(expected, succ & ~Marked)) {
+                        return false;
+                    }
+                    current = pointerOf(succ);
+                } else if (less_(current->entry.key, key)) {
+                    pred = current;
+                    current = pointerOf(succ);
+                } else {
+                    break;
+                }
+            }
+            preds[level] = pred;
+            succs[level] = current;
+        }
+        return true;
+    }
+
+    // The first node with a key not less than key, possibly erased. Read only, never waits.
+    Node* lowerBound(const Key& key) const {
+        Node* pred = head_;
+        Node* current = nullptr;
+        for (size_t level = MaxHeight; level-- > 0;) {
+            current = pointerOf(pred->next(level).load(std::memory_order_acquire));
+            while (current != nullptr) {
+                uintptr_t succ = current->next(level).load(std::memory_order_acquire);
+                if (isMarked(succ) || less_(current->entry.key, key)) {
+                    if (!isMarked(succ)) {
+                        pred = current;
+                    }
+                    current = pointerOf(succ);
+                } else {
+                    break;
+                }
+            }
+        }
+        return current;
+    }
+
+    Compare less_;
+    Node* head_;
+    std::atomic<size_t> size_{0};
+    mutable EpochDomain epochs_;
+};
+
+// Ordered index of Persons on (age, id)
+using AgeKey = std::pair<size_t, size_t>;
+using PersonAgeIndex = ConcurrentSkipList<AgeKey, std::shared_ptr<Person>>;
+
+inline AgeKey ageKey(const Person& person) { return AgeKey{person.age, person.id}; }
+
+#endif //SMARTPOINTERCPP_SKIP_LIST_H
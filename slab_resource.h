@@ -0,0 +1,483 @@
+#ifndef SMARTPOINTERCPP_SLAB_RESOURCE_H
+#define SMARTPOINTERCPP_SLAB_RESOURCE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#include "thread_slots.h"
+
+/*
+ *  Size class slab allocator.
+ *
+ *      SlabResource slab;
+ *      auto person = makeSharedIn<Person>(slab, "John Doe", "123 London St", 30);   // see factories.h
+ *
+ *  make_shared for Person, Comment and Post asks for only a handful of different sizes. A slab allocator
+ *  rounds every small request up to a size class and carves the blocks of one class out of 64 KiB pages,
+ *  so a free block of the right size is always one pointer away and objects of the same type sit next to
+ *  each other.
+ *
+ *  - Per thread caches: every thread allocates from its own pages, no locks and no atomics on that path.
+ *    Blocks a thread frees are kept in a small bin per size class and handed out again first.
+ *  - Remote frees: a block freed by another thread than the one owning its page is not touched by the
+ *    freeing thread's pages. It is buffered and pushed to the owning page in batches, one atomic
+ *    exchange per page and batch, and the owner picks them up when it runs out of free blocks.
+ *  - Pages whose blocks are all free again are returned to the operating system (munmap / _aligned_free),
+ *    also when the blocks came back as remote frees: the owner returns those pages when it collects them.
+ *  - Thread exit: the blocks a thread kept (bins, buffered remote frees) go back to their pages and its
+ *    empty pages are returned. Pages with live blocks stay with the thread's slot, the next thread that
+ *    gets the slot adopts them.
+ *
+ *  Requests bigger than MaxBlock bytes or with an alignment above 16 go to the upstream resource.
+ *  All memory of the pages is released when the SlabResource is destroyed.
+ */
+
+class SlabResource : public std::pmr::memory_resource {
+public:
+    static constexpr size_t PageSize = 64 * 1024;
+    static constexpr size_t MaxBlock = 512;
+    static constexpr size_t MaxThreads = 128;   // Threads with their own cache, the rest share one (with a lock)
+    static constexpr size_t RemoteBatch = 32;   // Remote frees buffered before they are pushed to their pages
+    static constexpr size_t BinCapacity = 256;  // Freed blocks a thread keeps per size class before giving them back
+
+    explicit SlabResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+            : upstream_(upstream) {
+        for (size_t slot = 0; slot < caches_.size(); ++slot) {
+            caches_[slot].index = slot;
+        }
+        // Empties the caches of an ending thread before another thread can get its slot
+        Slots::onRelease(this, [](void* slab, size_t slot) {
+            auto* self = static_cast<SlabResource*>(slab);
+            self->retireCache(self->caches_[slot]);
+        });
+    }
+
+    SlabResource(const SlabResource&) = delete;
+    SlabResource& operator=(const SlabResource&) = delete;
+
+    ~SlabResource() override {
+        Slots::removeOnRelease(this);
+        for (auto& cache : caches_) {
+            for (size_t c = 0; c < ClassCount; ++c) {
+                releaseList(cache.available[c]);
+                releaseList(cache.full[c]);
+            }
+        }
+    }
+
+    // Pushes the remote frees buffered by the calling thread to their pages.
+    // Called automatically every RemoteBatch remote frees.
+    void flushRemoteFrees() {
+        CacheLock lock(*this);
+        flushRemote(lock.cache);
+    }
+
+    struct Stats {
+        size_t pagesMapped;    // Pages taken from the operating system
+        size_t pagesReturned;  // Pages given back to the operating system
+        size_t remoteFrees;    // Blocks freed by another thread than the page owner
+        size_t largeAllocations; // Requests passed on to the upstream resource
+    };
+
+    Stats stats() const {
+        return Stats{pagesMapped_.load(std::memory_order_relaxed), pagesReturned_.load(std::memory_order_relaxed),
+                     remoteFrees_.load(std::memory_order_relaxed), largeAllocations_.load(std::memory_order_relaxed)};
+    }
+
+    // Size class used for a request of `bytes` bytes, ClassCount when it does not fit a slab
+    static size_t sizeClass(size_t bytes) {
+        if (bytes <= 128) {
+            return bytes == 0 ? 0 : (bytes - 1) / 16;     // 16, 32, ... 128
+        }
+        if (bytes <= MaxBlock) {
+            return 8 + (bytes - 129) / 48;                // 176, 224, ... 512
+        }
+        return ClassCount;
+    }
+
+    static size_t classSize(size_t sizeClass) {
+        return sizeClass < 8 ? (sizeClass + 1) * 16 : 128 + (sizeClass - 7) * 48;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        size_t c = sizeClass(bytes);
+        if (c >= ClassCount || alignment > 16) {
+            largeAllocations_.fetch_add(1, std::memory_order_relaxed);
+            return upstream_->allocate(bytes, alignment);
+        }
+        CacheLock lock(*this);
+        return allocateBlock(lock.cache, c);
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        size_t c = sizeClass(bytes);
+        if (c >= ClassCount || alignment > 16) {
+            upstream_->deallocate(p, bytes, alignment);
+            return;
+        }
+        CacheLock lock(*this);
+        freeBlock(lock.cache, static_cast<Block*>(p));
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+
+private:
+    static constexpr size_t ClassCount = 16;
+    static constexpr size_t SharedSlot = ThreadSlots<MaxThreads>::Shared;
+
+    struct Block {
+        Block* next;
+    };
+
+    // Header at the start of every page, the blocks follow it
+    struct alignas(64) Page {
+        Page* prev = nullptr;
+        Page* next = nullptr;
+        std::atomic<Block*> remoteFree{nullptr}; // Pushed by other threads, taken by the owner
+        Block* localFree = nullptr;               // Owner only
+        char* bump = nullptr;                     // Start of the never used part of the page
+        char* end = nullptr;
+        size_t used = 0;                          // Blocks handed out and not yet collected back
+        size_t blockSize = 0;
+        size_t sizeClass = 0;
+        size_t owner = 0;                         // Index of the owning ThreadCache
+        bool full = false;                        // In the full list of its class
+    };
+
+    struct ThreadCache {
+        std::array<Page*, ClassCount> available{}; // Pages with (possibly) free blocks, the first one is used
+        std::array<Page*, ClassCount> full{};      // Pages without free blocks
+        std::array<Block*, ClassCount> bin{};      // Recently freed blocks of this thread's own pages
+        std::array<size_t, ClassCount> binCount{};
+        std::array<Block*, RemoteBatch> pending{}; // Remote frees not yet pushed
+        size_t pendingCount = 0;
+        size_t index = 0;
+    };
+
+    // Slot numbers of the live threads, reused after a thread ends (thread_slots.h)
+    using Slots = ThreadSlots<MaxThreads>;
+
+    // The cache of the calling thread. Only the shared cache (more than MaxThreads threads) takes a lock.
+    struct CacheLock {
+        ThreadCache& cache;
+        std::mutex* shared;
+
+        explicit CacheLock(SlabResource& slab)
+                : cache(slab.caches_[Slots::current()]),
+                  shared(cache.index == SharedSlot ? &slab.sharedMutex_ : nullptr) {
+            if (shared != nullptr) {
+                shared->lock();
+            }
+        }
+
+        ~CacheLock() {
+            if (shared != nullptr) {
+                shared->unlock();
+            }
+        }
+
+        CacheLock(const CacheLock&) = delete;
+        CacheLock& operator=(const CacheLock&) = delete;
+    };
+
+    static Page* pageOf(const void* block) {
+        return reinterpret_cast<Page*>(reinterpret_cast<uintptr_t>(block) & ~(uintptr_t{PageSize} - 1));
+    }
+
+    void* allocateBlock(ThreadCache& cache, size_t c) {
+        if (Block* block = cache.bin[c]) {
+            // Fast path: a block this thread freed recently, nothing but the block itself is touched
+            cache.bin[c] = block->next;
+            --cache.binCount[c];
+            return block;
+        }
+        for (Page* page = cache.available[c]; page != nullptr;) {
+            Page* next = page->next;
+            if (Block* block = takeBlock(page)) {
+                if (page != cache.available[c]) {
+                    // Start with this page next time
+                    unlink(cache.available[c], page);
+                    pushFront(cache.available[c], page);
+                }
+                return block;
+            }
+            // Nothing left on this page, park it in the full list
+            unlink(cache.available[c], page);
+            page->full = true;
+            pushFront(cache.full[c], page);
+            page = next;
+        }
+        // Before mapping a new page, pick up what other threads freed on the full pages. The first page
+        // that got blocks back is used, the other ones that are empty now are returned.
+        Page* reuse = nullptr;
+        for (Page* page = cache.full[c]; page != nullptr;) {
+            Page* next = page->next;
+            if (collectRemote(page)) {
+                unlink(cache.full[c], page);
+                page->full = false;
+                if (reuse == nullptr) {
+                    reuse = page;
+                } else if (page->used == 0) {
+                    releasePage(page);
+                } else {
+                    pushFront(cache.available[c], page);
+                }
+            }
+            page = next;
+        }
+        Page* page = reuse != nullptr ? reuse : newPage(cache, c);
+        pushFront(cache.available[c], page);
+        return takeBlock(page);
+    }
+
+    // Takes one block from the page, nullptr when it has none left
+    Block* takeBlock(Page* page) {
+        Block* block = page->localFree;
+        if (block != nullptr) {
+            page->localFree = block->next;
+            ++page->used;
+            return block;
+        }
+        if (page->bump + page->blockSize > page->end && collectRemote(page)) {
+            block = page->localFree;
+            page->localFree = block->next;
+        } else if (page->bump + page->blockSize <= page->end) {
+            block = reinterpret_cast<Block*>(page->bump);
+            page->bump += page->blockSize;
+        } else {
+            return nullptr;
+        }
+        ++page->used;
+        return block;
+    }
+
+    // Moves the blocks other threads freed on this page to its local free list
+    bool collectRemote(Page* page) {
+        Block* remote = page->remoteFree.exchange(nullptr, std::memory_order_acquire);
+        if (remote == nullptr) {
+            return false;
+        }
+        Block* last = remote;
+        size_t count = 1;
+        while (last->next != nullptr) {
+            last = last->next;
+            ++count;
+        }
+        last->next = page->localFree;
+        page->localFree = remote;
+        page->used -= count;
+        return true;
+    }
+
+    void freeBlock(ThreadCache& cache, Block* block) {
+        Page* page = pageOf(block);
+        if (page->owner != cache.index) {
+            remoteFrees_.fetch_add(1, std::memory_order_relaxed);
+            cache.pending[cache.pendingCount++] = block;
+            if (cache.pendingCount == RemoteBatch) {
+                flushRemote(cache);
+            }
+            return;
+        }
+        size_t c = page->sizeClass;
+        block->next = cache.bin[c];
+        cache.bin[c] = block;
+        if (++cache.binCount[c] == BinCapacity) {
+            // Give the older half of the bin back to the pages, so empty pages can be returned
+            Block* keep = cache.bin[c];
+            for (size_t i = 1; i < BinCapacity / 2; ++i) {
+                keep = keep->next;
+            }
+            Block* rest = keep->next;
+            keep->next = nullptr;
+            cache.binCount[c] = BinCapacity / 2;
+            while (rest != nullptr) {
+                Block* next = rest->next;
+                returnToPage(cache, rest);
+                rest = next;
+            }
+        }
+    }
+
+    void returnToPage(ThreadCache& cache, Block* block) {
+        Page* page = pageOf(block);
+        block->next = page->localFree;
+        page->localFree = block;
+        --page->used;
+        Page*& list = page->full ? cache.full[page->sizeClass] : cache.available[page->sizeClass];
+        if (page->used == 0 && list != page) {
+            // Every block of this page is free and it is not the page we allocate from: give it back
+            unlink(list, page);
+            releasePage(page);
+        } else if (page->full) {
+            unlink(cache.full[page->sizeClass], page);
+            page->full = false;
+            pushFront(cache.available[page->sizeClass], page);
+        }
+    }
+
+    // The thread of this cache ended: gives everything it kept back to the pages and returns the pages
+    // that are empty then. Pages that still hold blocks stay in the cache for the next owner of the slot.
+    void retireCache(ThreadCache& cache) {
+        flushRemote(cache);
+        for (size_t c = 0; c < ClassCount; ++c) {
+            while (Block* block = cache.bin[c]) {
+                cache.bin[c] = block->next;
+                returnToPage(cache, block);
+            }
+            cache.binCount[c] = 0;
+            for (Page* page = cache.full[c]; page != nullptr;) {
+                Page* next = page->next;
+                if (collectRemote(page)) {
+                    unlink(cache.full[c], page);
+                    page->full = false;
+                    pushFront(cache.available[c], page);
+                }
+                page = next;
+            }
+            for (Page* page = cache.available[c]; page != nullptr;) {
+                Page* next = page->next;
+                collectRemote(page);
+                if (page->used == 0) {
+                    unlink(cache.available[c], page);
+                    releasePage(page);
+                }
+                page = next;
+            }
+        }
+    }
+
+    // Links the buffered remote frees of the same page into one chain and pushes every chain with one CAS
+    void flushRemote(ThreadCache& cache) {
+        for (size_t i = 0; i < cache.pendingCount; ++i) {
+            Block* first = cache.pending[i];
+            if (first == nullptr) {
+                continue;
+            }
+            Page* page = pageOf(first);
+            Block* last = first;
+            for (size_t j = i + 1; j < cache.pendingCount; ++j) {
+                if (cache.pending[j] != nullptr && pageOf(cache.pending[j]) == page) {
+                    last->next = cache.pending[j];
+                    last = cache.pending[j];
+                    cache.pending[j] = nullptr;
+                }
+            }
+            Block* head = page->remoteFree.load(std::memory_order_relaxed);
+            do {
+                last->next = head;
+            } while (!page->remoteFree.compare_exchange_weak(head, first, std::memory_order_release,
+                                                             std::memory_order_relaxed));
+        }
+        cache.pendingCount = 0;
+    }
+
+    Page* newPage(ThreadCache& cache, size_t c) {
+        void* memory = mapPage();
+        auto* page = ::new(memory) Page();
+        page->blockSize = classSize(c);
+        page->sizeClass = c;
+        page->owner = cache.index;
+        page->bump = reinterpret_cast<char*>(page) + sizeof(Page);
+        page->end = reinterpret_cast<char*>(page) + PageSize;
+        pagesMapped_.fetch_add(1, std::memory_order_relaxed);
+        return page;
+    }
+
+    void releasePage(Page* page) {
+        page->~Page();
+        unmapPage(page);
+        pagesReturned_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void releaseList(Page*& list) {
+        while (list != nullptr) {
+            Page* page = list;
+            list = page->next;
+            page->~Page();
+            unmapPage(page);
+        }
+    }
+
+    static void pushFront(Page*& list, Page* page) {
+        page->prev = nullptr;
+        page->next = list;
+        if (list != nullptr) {
+            list->prev = page;
+        }
+        list = page;
+    }
+
+    static void unlink(Page*& list, Page* page) {
+        if (page->prev != nullptr) {
+            page->prev->next = page->next;
+        } else {
+            list = page->next;
+        }
+        if (page->next != nullptr) {
+            page->next->prev = page->prev;
+        }
+        page->prev = page->next = nullptr;
+    }
+
+    // Pages are PageSize aligned, so the page of a block is found by clearing the low bits of its address
+    static void* mapPage() {
+#if defined(_WIN32)
+        void* memory = _aligned_malloc(PageSize, PageSize);
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return memory;
+#else
+        // Map twice the size and cut off what is not needed for the alignment
+        void* raw = mmap(nullptr, 2 * PageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+        uintptr_t aligned = (start + PageSize - 1) & ~(uintptr_t{PageSize} - 1);
+        if (aligned > start) {
+            munmap(raw, aligned - start);
+        }
+        uintptr_t tail = aligned + PageSize;
+        uintptr_t rawEnd = start + 2 * PageSize;
+        if (rawEnd > tail) {
+            munmap(reinterpret_cast<void*>(tail), rawEnd - tail);
+        }
+        return reinterpret_cast<void*>(aligned);
+#endif
+    }
+
+    static void unmapPage(void* page) {
+#if defined(_WIN32)
+        _aligned_free(page);
+#else
+        munmap(page, PageSize);
+#endif
+    }
+
+    std::pmr::memory_resource* upstream_;
+    std::mutex sharedMutex_;
+    std::array<ThreadCache, MaxThreads + 1> caches_{};
+    std::atomic<size_t> pagesMapped_{0};
+    std::atomic<size_t> pagesReturned_{0};
+    std::atomic<size_t> remoteFrees_{0};
+    std::atomic<size_t> largeAllocations_{0};
+};
+
+#endif //SMARTPOINTERCPP_SLAB_RESOURCE_H
@@ -0,0 +1,411 @@
+#ifndef SMARTPOINTERCPP_SNAPSHOT_H
+#define SMARTPOINTERCPP_SNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "models.h"
+
+/*
+ *  Start up from a snapshot of the object graph instead of building it again.
+ *
+ *      writeSnapshot("/tmp/feed.snapshot", persons, posts);   // Once, after the objects are built
+ *      ...
+ *      auto snapshot = Snapshot::open("/tmp/feed.snapshot");    // Next start: one mmap and a fixup pass
+ *      for (const SnapshotPost& post : snapshot->posts()) {
+ *          std::cout << post.content << " by " << post.author->name << std::endl;
+ *      }
+ *      std::shared_ptr<const SnapshotPost> first = snapshot->post(0);  // Keeps the mapping alive
+ *
+ *  The file is an image of plain records (SnapshotPerson, SnapshotPost, SnapshotComment) whose pointer
+ *  fields hold offsets from the start of the file, followed by their text (stored once per distinct
+ *  string) and a relocation table: the position of every pointer field that is not null.
+ *  open() maps the file privately, adds the mapping address to every field in the table, checks that
+ *  every record points where it may, and makes the mapping read only. The records are then ready: no
+ *  allocation per object, and the text pages are only read in when the text is used.
+ *
+ *  The records mirror Person, Post and Comment: Post::comments and Comment::post become plain pointers
+ *  within the image, and Post::author points to the Person whose id is Post::authorId (nullptr when the
+ *  author was not in the snapshot). The records can not be changed; build new objects for that.
+ *  A snapshot is only read by the same build it was written by, open() throws std::runtime_error for a
+ *  file that does not look like one (other version, endianness or pointer size, or damaged).
+ */
+
+// Text inside a snapshot
+struct SnapshotText {
+    const char* data;
+    uint64_t size;
+
+    std::string_view view() const { return std::string_view(data, size); }
+    operator std::string_view() const { return view(); }
+
+    friend std::ostream& operator<<(std::ostream& os, const SnapshotText& text) { return os << text.view(); }
+};
+
+struct SnapshotPerson {
+    SnapshotText name;
+    SnapshotText address;
+    uint64_t age;
+    uint64_t id;
+};
+
+struct SnapshotComment;
+
+struct SnapshotPost {
+    SnapshotText content;
+    const SnapshotComment* comments; // commentCount records
+    uint64_t commentCount;
+    uint64_t authorId;
+    const SnapshotPerson* author;
+};
+
+struct SnapshotComment {
+    SnapshotText text;
+    const SnapshotPost* post;
+};
+
+// The records of one kind in a snapshot, usable in a range for
+template<typename T>
+class SnapshotRange {
+public:
+    SnapshotRange(const T* first, size_t size) : first_(first), size_(size) {}
+
+    const T* begin() const { return first_; }
+    const T* end() const { return first_ + size_; }
+    size_t size() const { return size_; }
+    const T& operator[](size_t i) const { return first_[i]; }
+
+private:
+    const T* first_;
+    size_t size_;
+};
+
+namespace snapshot {
+
+static_assert(sizeof(void*) == sizeof(uint64_t), "Snapshot pointer fields are stored as 64 bit offsets");
+
+constexpr char Magic[8] = {'S', 'P', 'C', 'S', 'N', 'A', 'P', '1'};
+constexpr uint32_t ByteOrder = 0x01020304; // Reads back differently on a machine of the other endianness
+
+struct Header {
+    char magic[8];
+    uint32_t byteOrder;
+    uint32_t recordSizes; // sizeof of the three records, packed, to catch layout changes
+    uint64_t fileSize;
+    uint64_t personCount, personsOffset;
+    uint64_t postCount, postsOffset;
+    uint64_t commentCount, commentsOffset;
+    uint64_t textOffset, textSize;
+    uint64_t relocationCount, relocationsOffset;
+};
+
+constexpr uint32_t recordSizes() {
+    return static_cast<uint32_t>(sizeof(SnapshotPerson) | sizeof(SnapshotPost) << 10 | sizeof(SnapshotComment) << 20);
+}
+
+inline uint64_t align8(uint64_t offset) { return (offset + 7) & ~uint64_t{7}; }
+
+// Builds the image in memory; pointer fields are written as offsets and recorded for the fixup
+class ImageWriter {
+public:
+    ImageWriter(uint64_t textOffset, size_t texts) : textOffset_(textOffset) { stored_.reserve(texts); }
+
+    std::string image;
+    std::string text;
+    std::vector<uint64_t> relocations;
+
+    void pointer(uint64_t fieldOffset, uint64_t target) {
+        std::memcpy(&image[fieldOffset], &target, sizeof(target));
+        if (target != 0) {
+            relocations.push_back(fieldOffset);
+        }
+    }
+
+    void number(uint64_t fieldOffset, uint64_t value) { std::memcpy(&image[fieldOffset], &value, sizeof(value)); }
+
+    // Every distinct string is stored once
+    void textField(uint64_t fieldOffset, std::string_view value) {
+        uint64_t target = 0;
+        if (!value.empty()) {
+            auto found = stored_.find(value);
+            if (found == stored_.end()) {
+                found = stored_.emplace(value, textOffset_ + text.size()).first;
+                text.append(value);
+            }
+            target = found->second;
+        }
+        pointer(fieldOffset + offsetof(SnapshotText, data), target);
+        number(fieldOffset + offsetof(SnapshotText, size), value.size());
+    }
+
+private:
+    uint64_t textOffset_;
+    std::unordered_map<std::string_view, uint64_t> stored_; // Views of strings owned by the caller's objects
+};
+
+} // namespace snapshot
+
+// Writes persons and posts (with their comments) to path, returns the size of the file.
+// PersonPtr and PostPtr are anything that dereferences to a Person and a Post, like their shared_ptrs.
+template<typename PersonPtr, typename PostPtr>
+size_t writeSnapshot(const std::string& path, const std::vector<PersonPtr>& persons, const std::vector<PostPtr>& posts) {
+    using namespace snapshot;
+    Header header{};
+    std::memcpy(header.magic, Magic, sizeof(Magic));
+    header.byteOrder = ByteOrder;
+    header.recordSizes = recordSizes();
+    header.personCount = persons.size();
+    header.postCount = posts.size();
+    for (const auto& post : posts) {
+        header.commentCount += post->comments.size();
+    }
+    header.personsOffset = align8(sizeof(Header));
+    header.postsOffset = header.personsOffset + header.personCount * sizeof(SnapshotPerson);
+    header.commentsOffset = header.postsOffset + header.postCount * sizeof(SnapshotPost);
+    header.textOffset = header.commentsOffset + header.commentCount * sizeof(SnapshotComment);
+
+    ImageWriter writer(header.textOffset, 2 * header.personCount + header.postCount + header.commentCount);
+    writer.image.assign(header.textOffset, '\0');
+    std::unordered_map<uint64_t, uint64_t> personById; // Person::id -> record offset
+    personById.reserve(persons.size());
+    for (size_t i = 0; i < persons.size(); ++i) {
+        const Person& person = *persons[i];
+        uint64_t record = header.personsOffset + i * sizeof(SnapshotPerson);
+        writer.textField(record + offsetof(SnapshotPerson, name), person.name);
+        writer.textField(record + offsetof(SnapshotPerson, address), person.address);
+        writer.number(record + offsetof(SnapshotPerson, age), person.age);
+        writer.number(record + offsetof(SnapshotPerson, id), person.id);
+        personById.emplace(person.id, record);
+    }
+    uint64_t comment = header.commentsOffset;
+    for (size_t i = 0; i < posts.size(); ++i) {
+        const Post& post = *posts[i];
+        uint64_t record = header.postsOffset + i * sizeof(SnapshotPost);
+        writer.textField(record + offsetof(SnapshotPost, content), post.content);
+        writer.pointer(record + offsetof(SnapshotPost, comments), post.comments.empty() ? 0 : comment);
+        writer.number(record + offsetof(SnapshotPost, commentCount), post.comments.size());
+        writer.number(record + offsetof(SnapshotPost, authorId), post.authorId);
+        auto author = personById.find(post.authorId);
+        writer.pointer(record + offsetof(SnapshotPost, author), author == personById.end() ? 0 : author->second);
+        for (const auto& item : post.comments) {
+            writer.textField(comment + offsetof(SnapshotComment, text), item->text.view());
+            writer.pointer(comment + offsetof(SnapshotComment, post), record);
+            comment += sizeof(SnapshotComment);
+        }
+    }
+
+    header.textSize = writer.text.size();
+    header.relocationCount = writer.relocations.size();
+    header.relocationsOffset = align8(header.textOffset + header.textSize);
+    header.fileSize = header.relocationsOffset + header.relocationCount * sizeof(uint64_t);
+    std::memcpy(&writer.image[0], &header, sizeof(header));
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(writer.image.data(), static_cast<std::streamsize>(writer.image.size()));
+    out.write(writer.text.data(), static_cast<std::streamsize>(writer.text.size()));
+    const char padding[8] = {};
+    out.write(padding, static_cast<std::streamsize>(header.relocationsOffset - header.textOffset - header.textSize));
+    out.write(reinterpret_cast<const char*>(writer.relocations.data()),
+              static_cast<std::streamsize>(writer.relocations.size() * sizeof(uint64_t)));
+    out.close();
+    if (!out) {
+        throw std::runtime_error("writeSnapshot: cannot write " + path);
+    }
+    return header.fileSize;
+}
+
+class Snapshot : public std::enable_shared_from_this<Snapshot> {
+public:
+    static std::shared_ptr<const Snapshot> open(const std::string& path) {
+        std::shared_ptr<Snapshot> snapshot(new Snapshot());
+        snapshot->map(path);
+        snapshot->fixup();
+        snapshot->verify();
+        snapshot->seal();
+        return snapshot;
+    }
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+
+    ~Snapshot() {
+        if (base_ == nullptr) {
+            return;
+        }
+#if defined(_WIN32)
+        _aligned_free(base_);
+#else
+        munmap(base_, size_);
+#endif
+    }
+
+    SnapshotRange<SnapshotPerson> persons() const { return {records<SnapshotPerson>(header().personsOffset), header().personCount}; }
+    SnapshotRange<SnapshotPost> posts() const { return {records<SnapshotPost>(header().postsOffset), header().postCount}; }
+    SnapshotRange<SnapshotComment> comments() const {
+        return {records<SnapshotComment>(header().commentsOffset), header().commentCount};
+    }
+
+    // A record that keeps the whole snapshot alive, like the aliasing shared_ptrs of comment_batch.h
+    std::shared_ptr<const SnapshotPerson> person(size_t i) const { return {shared_from_this(), &persons()[checked(i, header().personCount)]}; }
+    std::shared_ptr<const SnapshotPost> post(size_t i) const { return {shared_from_this(), &posts()[checked(i, header().postCount)]}; }
+
+    size_t fileSize() const { return size_; }
+
+private:
+    using Header = snapshot::Header;
+
+    Snapshot() = default;
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(base_); }
+
+    template<typename T>
+    const T* records(uint64_t offset) const { return reinterpret_cast<const T*>(base_ + offset); }
+
+    static size_t checked(size_t i, uint64_t size) {
+        if (i >= size) {
+            throw std::out_of_range("Snapshot: no such record");
+        }
+        return i;
+    }
+
+    void map(const std::string& path) {
+#if defined(_WIN32)
+        std::ifstream in(path, std::ios::binary | std::ios::ate);
+        if (!in) {
+            throw std::runtime_error("Snapshot: cannot open " + path);
+        }
+        size_ = static_cast<size_t>(in.tellg());
+        base_ = static_cast<char*>(_aligned_malloc(size_ == 0 ? 1 : size_, 64));
+        in.seekg(0);
+        in.read(base_, static_cast<std::streamsize>(size_));
+        if (!in) {
+            throw std::runtime_error("Snapshot: cannot read " + path);
+        }
+#else
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Snapshot: cannot open " + path);
+        }
+        struct stat info {};
+        if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            throw std::runtime_error("Snapshot: not a snapshot " + path);
+        }
+        size_ = static_cast<size_t>(info.st_size);
+        // Private and writable: the fixup writes to copies of the pages, the file stays as it is
+        void* data = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Snapshot: cannot map " + path);
+        }
+        base_ = static_cast<char*>(data);
+#endif
+        checkHeader();
+    }
+
+    void checkHeader() const {
+        using namespace snapshot;
+        if (size_ < sizeof(Header)) {
+            throw std::runtime_error("Snapshot: file too short");
+        }
+        const Header& h = header();
+        if (std::memcmp(h.magic, Magic, sizeof(Magic)) != 0 || h.byteOrder != ByteOrder || h.recordSizes != recordSizes()) {
+            throw std::runtime_error("Snapshot: not a snapshot of this build");
+        }
+        // Sections in order, each inside the file; the counts are bounded by the file size first
+        bool valid = h.fileSize == size_ && h.personCount <= size_ && h.postCount <= size_ && h.commentCount <= size_ &&
+                     h.relocationCount <= size_ && h.personsOffset == align8(sizeof(Header)) &&
+                     h.postsOffset == h.personsOffset + h.personCount * sizeof(SnapshotPerson) &&
+                     h.commentsOffset == h.postsOffset + h.postCount * sizeof(SnapshotPost) &&
+                     h.textOffset == h.commentsOffset + h.commentCount * sizeof(SnapshotComment) &&
+                     h.textSize <= size_ && h.relocationsOffset == align8(h.textOffset + h.textSize) &&
+                     h.relocationsOffset + h.relocationCount * sizeof(uint64_t) == size_;
+        if (!valid) {
+            throw std::runtime_error("Snapshot: damaged header");
+        }
+    }
+
+    // Turns every offset in the relocation table into an address
+    void fixup() {
+        const Header& h = header();
+        const char* table = base_ + h.relocationsOffset;
+        auto base = reinterpret_cast<uint64_t>(base_);
+        for (uint64_t i = 0; i < h.relocationCount; ++i) {
+            uint64_t field;
+            std::memcpy(&field, table + i * sizeof(uint64_t), sizeof(field));
+            if (field < h.personsOffset || field + sizeof(uint64_t) > h.textOffset || field % sizeof(uint64_t) != 0) {
+                throw std::runtime_error("Snapshot: relocation outside the records");
+            }
+            uint64_t& value = *reinterpret_cast<uint64_t*>(base_ + field);
+            if (value == 0 || value >= size_) {
+                throw std::runtime_error("Snapshot: pointer outside the file");
+            }
+            value += base;
+        }
+    }
+
+    // Every pointer (relocated or not) points into the section it belongs to, so reading a record
+    // can not leave the mapping
+    void verify() const {
+        const Header& h = header();
+        const char* text = base_ + h.textOffset;
+        auto textOk = [&](const SnapshotText& value) {
+            return value.size == 0 || (value.data >= text && value.size <= h.textSize &&
+                                       value.data - text <= static_cast<ptrdiff_t>(h.textSize - value.size));
+        };
+        auto persons = this->persons();
+        auto posts = this->posts();
+        auto comments = this->comments();
+        auto inside = [](const auto* pointer, const auto& range) {
+            return pointer >= range.begin() && pointer < range.end() &&
+                   (reinterpret_cast<const char*>(pointer) - reinterpret_cast<const char*>(range.begin())) %
+                                   sizeof(*pointer) == 0;
+        };
+        for (const auto& person : persons) {
+            if (!textOk(person.name) || !textOk(person.address)) {
+                throw std::runtime_error("Snapshot: damaged person");
+            }
+        }
+        for (const auto& post : posts) {
+            bool commentsOk = post.commentCount == 0 ||
+                              (inside(post.comments, comments) && post.commentCount <= size_t(comments.end() - post.comments));
+            if (!textOk(post.content) || !commentsOk || (post.author != nullptr && !inside(post.author, persons))) {
+                throw std::runtime_error("Snapshot: damaged post");
+            }
+        }
+        for (const auto& comment : comments) {
+            if (!textOk(comment.text) || !inside(comment.post, posts)) {
+                throw std::runtime_error("Snapshot: damaged comment");
+            }
+        }
+    }
+
+    // Read only from here on, a stray write faults instead of changing the snapshot
+    void seal() {
+#if !defined(_WIN32)
+        mprotect(base_, size_, PROT_READ);
+#endif
+    }
+
+    char* base_ = nullptr;
+    size_t size_ = 0;
+};
+
+#endif //SMARTPOINTERCPP_SNAPSHOT_H
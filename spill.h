@@ -0,0 +1,336 @@
+#ifndef SMARTPOINTERCPP_SPILL_H
+#define SMARTPOINTERCPP_SPILL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "models.h"
+#include "serialization.h"
+
+/*
+ *  Posts that go to disk instead of being destroyed, and come back when somebody asks for them.
+ *
+ *      SpillStore spill("/tmp/posts.spill");
+ *      std::shared_ptr<Post> post = spill.make(Post{"Holiday", {}, 1});
+ *      SpillRef<Post> ref(post);                       // Like a std::weak_ptr<Post>
+ *      post.reset();                                   // Last owner gone: the Post is written to the spill file
+ *      ref.lock();                                     // nullptr, like weak_ptr::lock()
+ *      std::shared_ptr<Post> again = ref.fetch().get();  // Read back on a loader thread
+ *
+ *  make() gives the Post a deleter that serializes it (serialization.h) to the spill file before
+ *  deleting it, as long as a SpillRef to it exists; without one nobody could ask for it again and it is
+ *  just deleted. SpillRef::lock() answers from memory only. SpillRef::fetch() returns a future: ready
+ *  at once when the Post is in memory, otherwise the loader thread of the store reads it back and every fetch waiting
+ *  for the same Post gets the same new object. Its comments point to it again (linkComments).
+ *
+ *  Comment::post stays a std::weak_ptr: comments are written and read with their Post, so the comments
+ *  of a reloaded Post point to the reloaded Post. Code that keeps a reference to a Post it does not own,
+ *  and wants it back after a spill, keeps a SpillRef instead of a weak_ptr.
+ *
+ *  The spill file is append only, a Post spilled twice is written twice; it is removed with the store.
+ *  Every Post made by a store must be gone before the store is destroyed.
+ */
+
+template<typename T>
+class SpillRef;
+
+class SpillStore {
+public:
+    struct Stats {
+        size_t spills = 0;
+        size_t reloads = 0;
+        size_t bytesWritten = 0;
+    };
+
+    explicit SpillStore(std::string path) : path_(std::move(path)) {
+        file_.open(path_, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!file_) {
+            throw std::runtime_error("SpillStore: cannot open " + path_);
+        }
+    }
+
+    SpillStore(const SpillStore&) = delete;
+    SpillStore& operator=(const SpillStore&) = delete;
+
+    ~SpillStore() {
+        {
+            std::lock_guard<std::mutex> lock(loadsMutex_);
+            stopping_ = true;
+            loadsReady_.notify_one();
+        }
+        if (loader_.joinable()) {
+            loader_.join(); // Finishes the loads already queued
+        }
+        file_.close();
+        std::remove(path_.c_str());
+    }
+
+    std::shared_ptr<Post> make(Post post) {
+        auto state = std::make_shared<State>();
+        state->store = this;
+        auto result = adopt(new Post(std::move(post)), state);
+        state->live = result;
+        return result;
+    }
+
+    Stats stats() const {
+        return Stats{spills_.load(std::memory_order_relaxed), reloads_.load(std::memory_order_relaxed),
+                     bytesWritten_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    template<typename T>
+    friend class SpillRef;
+
+    // Shared by the deleter of the live Post and all SpillRefs to it
+    struct State {
+        SpillStore* store = nullptr;
+        std::mutex mutex;
+        std::weak_ptr<Post> live;
+        bool onDisk = false;  // offset and size hold the latest copy, and the Post is not in memory
+        uint64_t offset = 0;
+        uint64_t size = 0;
+        bool loading = false;
+        std::exception_ptr lost; // The spill failed: the Post is gone, every fetch gets this
+        std::vector<std::promise<std::shared_ptr<Post>>> waiters;
+    };
+
+    struct Deleter {
+        std::shared_ptr<State> state;
+
+        void operator()(Post* post) const {
+            {
+                // live refers to our own control block, which holds this deleter: let go of it
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->live.reset();
+            }
+            // No SpillRef (only this deleter holds the state): nobody can ask for the Post again
+            if (state.use_count() > 1) {
+                state->store->spill(*post, state);
+            }
+            delete post;
+        }
+    };
+
+    static std::shared_ptr<Post> adopt(Post* post, const std::shared_ptr<State>& state) {
+        std::shared_ptr<Post> result(post, Deleter{state});
+        linkComments(result);
+        return result;
+    }
+
+    // Runs in a deleter, so it must not throw: a failed write is reported to the waiting fetches and
+    // to every later one
+    void spill(const Post& post, const std::shared_ptr<State>& state) noexcept {
+        std::string bytes;
+        uint64_t offset;
+        try {
+            ByteWriter writer(bytes);
+            serialize(writer, post);
+            offset = append(bytes);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            state->lost = std::current_exception();
+            for (auto& waiter : state->waiters) {
+                waiter.set_exception(state->lost);
+            }
+            state->waiters.clear();
+            return;
+        }
+        spills_.fetch_add(1, std::memory_order_relaxed);
+        std::lock_guard<std::mutex> lock(state->mutex);
+        state->offset = offset;
+        state->size = bytes.size();
+        state->onDisk = true;
+        if (!state->waiters.empty() && !state->loading) {
+            // Somebody asked while we were writing
+            state->loading = true;
+            startLoad(state);
+        }
+    }
+
+    // Called with state->mutex held
+    void startLoad(const std::shared_ptr<State>& state) {
+        std::lock_guard<std::mutex> lock(loadsMutex_);
+        if (!loader_.joinable()) {
+            loader_ = std::thread([this] { loaderLoop(); });
+        }
+        loads_.push_back(state);
+        loadsReady_.notify_one();
+    }
+
+    // One loader thread per store works through the queued loads in order
+    void loaderLoop() {
+        std::unique_lock<std::mutex> lock(loadsMutex_);
+        for (;;) {
+            loadsReady_.wait(lock, [this] { return stopping_ || !loads_.empty(); });
+            if (loads_.empty()) {
+                return; // Stopping, and nothing left to load
+            }
+            std::shared_ptr<State> state = std::move(loads_.front());
+            loads_.pop_front();
+            lock.unlock();
+            load(state);
+            lock.lock();
+        }
+    }
+
+    void load(const std::shared_ptr<State>& state) {
+        SMARTPOINTERCPP_LATENCY_SCOPE("SpillStore::load");
+        std::shared_ptr<Post> post;
+        std::exception_ptr error;
+        try {
+            uint64_t offset;
+            uint64_t size;
+            {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                offset = state->offset;
+                size = state->size;
+            }
+            std::string bytes = read(offset, size);
+            ByteReader reader(bytes);
+            post = adopt(new Post(deserializePost(reader)), state);
+            reloads_.fetch_add(1, std::memory_order_relaxed);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        std::vector<std::promise<std::shared_ptr<Post>>> waiters;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (post != nullptr) {
+                state->live = post;
+                state->onDisk = false;
+            }
+            state->loading = false;
+            waiters.swap(state->waiters);
+        }
+        for (auto& waiter : waiters) {
+            if (error) {
+                waiter.set_exception(error);
+            } else {
+                waiter.set_value(post);
+            }
+        }
+        // Dropping post may spill it again right away, when every waiter let go of it already
+    }
+
+    uint64_t append(const std::string& bytes) {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        file_.seekp(0, std::ios::end);
+        auto offset = static_cast<uint64_t>(file_.tellp());
+        file_.write(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+        file_.flush();
+        if (!file_) {
+            throw std::runtime_error("SpillStore: cannot write " + path_);
+        }
+        bytesWritten_.fetch_add(bytes.size(), std::memory_order_relaxed);
+        return offset;
+    }
+
+    std::string read(uint64_t offset, uint64_t size) {
+        std::lock_guard<std::mutex> lock(fileMutex_);
+        std::string bytes(size, '\0');
+        file_.seekg(static_cast<std::streamoff>(offset));
+        file_.read(&bytes[0], static_cast<std::streamsize>(size));
+        if (!file_) {
+            file_.clear();
+            throw std::runtime_error("SpillStore: cannot read " + path_);
+        }
+        return bytes;
+    }
+
+    std::string path_;
+    std::fstream file_;
+    std::mutex fileMutex_;
+    std::mutex loadsMutex_;
+    std::condition_variable loadsReady_;
+    std::deque<std::shared_ptr<State>> loads_;
+    bool stopping_ = false;
+    std::thread loader_;
+    std::atomic<size_t> spills_{0};
+    std::atomic<size_t> reloads_{0};
+    std::atomic<size_t> bytesWritten_{0};
+};
+
+// A weak reference with a way back from disk, see SpillStore. For a Post not made by a SpillStore it
+// behaves like a std::weak_ptr, fetch() then never loads anything.
+template<typename T>
+class SpillRef {
+    static_assert(std::is_same<T, Post>::value, "SpillStore spills Posts");
+
+public:
+    SpillRef() = default;
+
+    SpillRef(const std::shared_ptr<T>& object) {
+        if (auto* deleter = std::get_deleter<SpillStore::Deleter>(object)) {
+            state_ = deleter->state;
+        } else {
+            weak_ = object;
+        }
+    }
+
+    // The object if it is in memory, like std::weak_ptr::lock()
+    std::shared_ptr<T> lock() const {
+        if (state_ == nullptr) {
+            return weak_.lock();
+        }
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->live.lock();
+    }
+
+    // The object, loaded from the spill file when needed. nullptr only for an object that is gone for good;
+    // the exception of the write when spilling it failed.
+    std::future<std::shared_ptr<T>> fetch() const {
+        std::promise<std::shared_ptr<T>> promise;
+        auto future = promise.get_future();
+        if (state_ == nullptr) {
+            promise.set_value(weak_.lock());
+            return future;
+        }
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        if (auto live = state_->live.lock()) {
+            promise.set_value(std::move(live));
+            return future;
+        }
+        if (state_->lost != nullptr) {
+            promise.set_exception(state_->lost);
+            return future;
+        }
+        // On disk, or about to be written there by its deleter, which then starts the load
+        state_->waiters.push_back(std::move(promise));
+        if (state_->onDisk && !state_->loading) {
+            state_->loading = true;
+            state_->store->startLoad(state_);
+        }
+        return future;
+    }
+
+    // True while the object is only in the spill file
+    bool spilled() const {
+        if (state_ == nullptr) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(state_->mutex);
+        return state_->onDisk;
+    }
+
+private:
+    std::shared_ptr<SpillStore::State> state_;
+    std::weak_ptr<T> weak_;
+};
+
+#endif //SMARTPOINTERCPP_SPILL_H
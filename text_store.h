@@ -0,0 +1,232 @@
+#ifndef SMARTPOINTERCPP_TEXT_STORE_H
+#define SMARTPOINTERCPP_TEXT_STORE_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "latency_histogram.h"
+
+/*
+ *  Deduplicated, immutable text shared by everyone who stores the same string.
+ *
+ *      comment->text = "I like it.";                   // Comment::text is a SharedText
+ *      other->text = "I like it.";                     // Same buffer as above, no second heap string
+ *      std::cout << comment->text;                     // Reads like a std::string
+ *      TextStoreStats stats = TextStore::global().stats();
+ *      std::cout << stats.dedupRatio();                // Bytes referenced / bytes stored
+ *
+ *  A TextStore keeps every distinct text once. Interning hashes the text, looks it up and hands out a
+ *  counted reference (SharedText) to the stored copy; the copy is freed with its last reference.
+ *  A SharedText is one pointer, copying it increments a counter instead of copying the characters.
+ *  The text itself can not be changed through it, assigning a new text interns that one.
+ *
+ *  The store is split into ShardCount shards by hash, each with its own mutex and map, so threads
+ *  interning different texts rarely wait for each other. The hash is computed before taking the lock.
+ *  Statistics are counted per shard under the same lock, no shared counter is written per call.
+ *
+ *  Every SharedText must be gone before its store is destroyed; TextStore::global() is never destroyed.
+ */
+
+class SharedText;
+
+struct TextStoreStats {
+    size_t interned = 0;        // Calls to intern
+    size_t hits = 0;            // ... that found the text already stored
+    size_t uniqueTexts = 0;     // Texts stored now
+    size_t storedBytes = 0;     // Their size
+    size_t referencedBytes = 0; // Size of all live references together, what separate strings would take
+
+    double dedupRatio() const { return storedBytes == 0 ? 1.0 : double(referencedBytes) / double(storedBytes); }
+};
+
+class TextStore {
+public:
+    static constexpr size_t ShardCount = 64;
+
+    TextStore() = default;
+    TextStore(const TextStore&) = delete;
+    TextStore& operator=(const TextStore&) = delete;
+
+    // The store Comment::text interns into
+    static TextStore& global() {
+        static TextStore* store = new TextStore(); // Never destroyed, comments may outlive static destruction
+        return *store;
+    }
+
+    SharedText intern(std::string_view text);
+
+    TextStoreStats stats() {
+        TextStoreStats total;
+        for (auto& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            total.interned += shard.interned;
+            total.hits += shard.hits;
+            total.uniqueTexts += shard.entries.size();
+            for (const auto& item : shard.entries) {
+                size_t size = item.second->text.size();
+                total.storedBytes += size;
+                total.referencedBytes += size * item.second->references.load(std::memory_order_relaxed);
+            }
+        }
+        return total;
+    }
+
+private:
+    friend class SharedText;
+
+    struct Shard;
+
+    struct Entry {
+        std::string text;
+        size_t hash;
+        Shard* shard;
+        std::atomic<size_t> references{1};
+
+        Entry(std::string_view text, size_t hash, Shard* shard) : text(text), hash(hash), shard(shard) {}
+
+        // A new reference, unless the last one is being released right now
+        bool acquire() {
+            size_t count = references.load(std::memory_order_relaxed);
+            while (count != 0) {
+                if (references.compare_exchange_weak(count, count + 1, std::memory_order_relaxed)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // The map key carries the hash, so it is not computed again under the lock
+    struct Key {
+        std::string_view text;
+        size_t hash;
+
+        bool operator==(const Key& other) const { return hash == other.hash && text == other.text; }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& key) const { return key.hash; }
+    };
+
+    struct alignas(64) Shard {
+        std::mutex mutex;
+        std::unordered_map<Key, Entry*, KeyHash> entries; // Keys point into Entry::text
+        size_t interned = 0;
+        size_t hits = 0;
+    };
+
+    // The last reference is gone: remove the entry, unless a new entry for the same text replaced it
+    static void release(Entry* entry) {
+        if (entry->references.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        Shard& shard = *entry->shard;
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = shard.entries.find(Key{entry->text, entry->hash});
+            if (found != shard.entries.end() && found->second == entry) {
+                shard.entries.erase(found);
+            }
+        }
+        delete entry;
+    }
+
+    std::array<Shard, ShardCount> shards_;
+};
+
+class SharedText {
+public:
+    SharedText() = default;
+
+    // Interned in TextStore::global()
+    SharedText(std::string_view text) : SharedText(TextStore::global().intern(text)) {}
+    SharedText(const std::string& text) : SharedText(std::string_view(text)) {}
+    SharedText(const char* text) : SharedText(std::string_view(text)) {}
+
+    SharedText(const SharedText& other) : entry_(other.entry_) {
+        if (entry_ != nullptr) {
+            entry_->references.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    SharedText(SharedText&& other) noexcept : entry_(std::exchange(other.entry_, nullptr)) {}
+
+    SharedText& operator=(SharedText other) noexcept {
+        std::swap(entry_, other.entry_);
+        return *this;
+    }
+
+    ~SharedText() {
+        if (entry_ != nullptr) {
+            TextStore::release(entry_);
+        }
+    }
+
+    const std::string& str() const { return entry_ != nullptr ? entry_->text : emptyText(); }
+    operator const std::string&() const { return str(); }
+    std::string_view view() const { return str(); }
+    const char* c_str() const { return str().c_str(); }
+    size_t size() const { return str().size(); }
+    bool empty() const { return entry_ == nullptr || entry_->text.empty(); }
+
+    // True when both refer to the same stored copy
+    bool sharesBufferWith(const SharedText& other) const { return entry_ == other.entry_; }
+
+    friend bool operator==(const SharedText& a, const SharedText& b) {
+        return a.entry_ == b.entry_ || a.view() == b.view(); // Different stores may hold the same text
+    }
+    friend bool operator!=(const SharedText& a, const SharedText& b) { return !(a == b); }
+    friend bool operator==(const SharedText& a, std::string_view b) { return a.view() == b; }
+    friend bool operator!=(const SharedText& a, std::string_view b) { return a.view() != b; }
+    friend bool operator==(const SharedText& a, const std::string& b) { return a.view() == b; }
+    friend bool operator!=(const SharedText& a, const std::string& b) { return a.view() != b; }
+    friend bool operator==(const SharedText& a, const char* b) { return a.view() == b; }
+    friend bool operator!=(const SharedText& a, const char* b) { return a.view() != b; }
+
+    friend std::ostream& operator<<(std::ostream& os, const SharedText& text) { return os << text.str(); }
+
+private:
+    friend class TextStore;
+
+    explicit SharedText(TextStore::Entry* entry) : entry_(entry) {}
+
+    static const std::string& emptyText() {
+        static const std::string* text = new std::string();
+        return *text;
+    }
+
+    TextStore::Entry* entry_ = nullptr;
+};
+
+inline SharedText TextStore::intern(std::string_view text) {
+    if (text.empty()) {
+        return SharedText();
+    }
+    SMARTPOINTERCPP_LATENCY_SCOPE("TextStore::intern");
+    size_t hash = std::hash<std::string_view>()(text);
+    Shard& shard = shards_[(hash >> 8) % ShardCount];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    ++shard.interned;
+    auto found = shard.entries.find(Key{text, hash});
+    if (found != shard.entries.end()) {
+        if (found->second->acquire()) {
+            ++shard.hits;
+            return SharedText(found->second);
+        }
+        // Its last reference is being released: store a new copy, the old one deletes itself
+        shard.entries.erase(found);
+    }
+    auto* entry = new Entry(text, hash, &shard);
+    shard.entries.emplace(Key{entry->text, hash}, entry);
+    return SharedText(entry);
+}
+
+#endif //SMARTPOINTERCPP_TEXT_STORE_H
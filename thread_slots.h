@@ -0,0 +1,110 @@
+#ifndef SMARTPOINTERCPP_THREAD_SLOTS_H
+#define SMARTPOINTERCPP_THREAD_SLOTS_H
+
+#include <algorithm>
+#include <cstddef>
+#include <mutex>
+#include <vector>
+
+/*
+ *  A small number per live thread, to keep per thread data in an array instead of in thread_locals.
+ *
+ *      using Slots = ThreadSlots<64>;
+ *      std::array<Counter, 64 + 1> counters;
+ *      counters[Slots::current()].add(1);         // 0 .. 63 for the first 64 live threads, else Slots::Shared
+ *
+ *  A thread gets a free number on its first call and gives it back when it ends, so the next new thread
+ *  continues on the same data. Threads beyond Count all get Slots::Shared, so do the calls a thread makes
+ *  after it gave its number back (from thread_locals destroyed after that): data in the shared slot needs
+ *  a lock or atomics.
+ *
+ *  onRelease(context, callback) has callback(context, slot) called when a thread gives its number back,
+ *  before another thread can get it. SlabResource empties the caches of the thread that way.
+ */
+
+template<size_t Count>
+class ThreadSlots {
+public:
+    static constexpr size_t Shared = Count;
+
+    using ReleaseCallback = void (*)(void* context, size_t slot);
+
+    static size_t current() {
+        if (index_ == Unassigned) {
+            static thread_local Registration registration;
+            index_ = registration.index;
+        }
+        return index_;
+    }
+
+    static void onRelease(void* context, ReleaseCallback callback) {
+        std::lock_guard<std::mutex> lock(mutex());
+        listeners().push_back(Listener{context, callback});
+    }
+
+    static void removeOnRelease(void* context) {
+        std::lock_guard<std::mutex> lock(mutex());
+        auto& all = listeners();
+        all.erase(std::remove_if(all.begin(), all.end(), [&](const Listener& listener) { return listener.context == context; }),
+                  all.end());
+    }
+
+private:
+    static constexpr size_t Unassigned = ~size_t{0};
+
+    struct Listener {
+        void* context;
+        ReleaseCallback callback;
+    };
+
+    // A plain thread_local needs no initialization guard, so the fast path is a single load
+    static inline thread_local size_t index_ = Unassigned;
+
+    struct Registration {
+        size_t index;
+
+        Registration() {
+            std::lock_guard<std::mutex> lock(mutex());
+            auto& free = freeSlots();
+            if (!free.empty()) {
+                index = free.back();
+                free.pop_back();
+            } else {
+                index = nextSlot() < Count ? nextSlot()++ : Shared;
+            }
+        }
+
+        ~Registration() {
+            if (index != Shared) {
+                std::lock_guard<std::mutex> lock(mutex());
+                for (const Listener& listener : listeners()) {
+                    listener.callback(listener.context, index);
+                }
+                freeSlots().push_back(index);
+            }
+            index_ = Shared; // The slot may belong to another thread from now on
+        }
+    };
+
+    static std::mutex& mutex() {
+        static std::mutex m;
+        return m;
+    }
+
+    static std::vector<Listener>& listeners() {
+        static std::vector<Listener> all;
+        return all;
+    }
+
+    static std::vector<size_t>& freeSlots() {
+        static std::vector<size_t> slots;
+        return slots;
+    }
+
+    static size_t& nextSlot() {
+        static size_t next = 0;
+        return next;
+    }
+};
+
+#endif //SMARTPOINTERCPP_THREAD_SLOTS_H
@@ -0,0 +1,480 @@
+#ifndef SMARTPOINTERCPP_TIERED_STORE_H
+#define SMARTPOINTERCPP_TIERED_STORE_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "latency_histogram.h"
+#include "lz_codec.h"
+#include "models.h"
+#include "serialization.h"
+
+/*
+ *  Posts in three tiers, so many more of them fit in the same memory.
+ *
+ *      TieredPostStore store("/tmp/posts.cold", TieredStoreOptions{16 << 20, 64 << 20});
+ *      TieredPostStore::Id id = store.add(Post{"Holiday", {}, 1});
+ *      std::shared_ptr<const Post> post = store.get(id);   // From whichever tier it is in
+ *
+ *  - Hot: the live Post, get() hands out the stored shared_ptr.
+ *  - Warm: the Post serialized (serialization.h) and compressed with the LZ codec (lz_codec.h), in RAM.
+ *  - Cold: the same bytes in a file mapped into memory. The kernel writes the pages out and drops them
+ *    when it needs the memory; reading one maps it back in. In RAM a cold Post takes one small Entry.
+ *
+ *  Every get() counts an access of the Post. The counters are halved every time there were as many
+ *  accesses as there are Posts (lazily, when a Post is next touched), so they measure recent use.
+ *  A warm or cold Post read promoteAfter times is brought back to hot, when the hot tier has room or
+ *  the Post was used more than the hot one it would push out; one read less often is unpacked for the
+ *  caller only. When the hot or warm tier is over its budget, sampleSize Posts of it are picked at
+ *  random and the least used goes one tier down (sampled LFU, no list to keep in order).
+ *
+ *  A single Post is too short for the codec to find much to repeat, so the store compresses against a
+ *  dictionary (LzDictionary) made of the first dictionaryBytes of serialized Posts it was given.
+ *
+ *  Stored Posts do not change, so demoting is cheap: a hot Post keeps its compressed bytes (counted in
+ *  the hot budget) and a Post written to the cold file once keeps its place there. Demoting then drops
+ *  the live object or the bytes in RAM, and nobody waits for a serialization on the way down.
+ *
+ *  One mutex guards the bookkeeping; unpacking runs outside of it. The cold file grows in segments that
+ *  stay mapped, it is append only and removed with the store. On Windows the cold segments are plain
+ *  memory, the tier then only saves the bookkeeping.
+ */
+
+struct TieredStoreOptions {
+    size_t hotBytes = 16 << 20;        // Live Posts and their compressed bytes
+    size_t warmBytes = 64 << 20;       // Compressed Posts in RAM
+    unsigned promoteAfter = 2;         // Recent reads that bring a warm or cold Post back to hot
+    size_t sampleSize = 8;             // Posts looked at to pick the one to demote
+    size_t dictionaryBytes = 16 << 10; // 0 compresses every Post on its own
+};
+
+class TieredPostStore {
+public:
+    static constexpr size_t SegmentSize = 16 << 20;
+
+    using Id = size_t;
+
+    enum class Tier : uint8_t { Hot, Warm, Cold, Gone };
+
+    struct Stats {
+        size_t hot = 0, warm = 0, cold = 0;
+        size_t hotBytes = 0, warmBytes = 0;
+        size_t coldBytes = 0;  // Written to the cold file, including Posts promoted or erased since
+        size_t indexBytes = 0; // Bookkeeping of all tiers
+        size_t hotReads = 0, warmReads = 0, coldReads = 0;
+        size_t promotions = 0, demotions = 0;
+    };
+
+    explicit TieredPostStore(std::string path, TieredStoreOptions options = {})
+            : path_(std::move(path)), options_(options) {
+#if !defined(_WIN32)
+        fd_ = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd_ < 0) {
+            throw std::runtime_error("TieredPostStore: cannot open " + path_);
+        }
+#endif
+    }
+
+    TieredPostStore(const TieredPostStore&) = delete;
+    TieredPostStore& operator=(const TieredPostStore&) = delete;
+
+    ~TieredPostStore() {
+        for (auto& segment : segments_) {
+#if defined(_WIN32)
+            delete[] segment.data;
+#else
+            munmap(segment.data, segment.size);
+#endif
+        }
+#if !defined(_WIN32)
+        ::close(fd_);
+        ::unlink(path_.c_str());
+#endif
+    }
+
+    // New Posts start hot
+    Id add(Post post) {
+        auto resident = std::make_shared<Resident>();
+        std::string bytes;
+        ByteWriter writer(bytes);
+        serialize(writer, post);
+        const LzDictionary* dictionary = dictionary_.load(std::memory_order_acquire);
+        resident->packed = dictionary != nullptr ? lzCompress(bytes, *dictionary) : lzCompress(bytes);
+        resident->packed.shrink_to_fit(); // Kept while the Post is warm, without the room lzCompress reserved
+        resident->rawSize = static_cast<uint32_t>(bytes.size());
+        resident->liveBytes = static_cast<uint32_t>(liveBytes(post));
+        resident->withDictionary = dictionary != nullptr;
+        resident->hot = std::make_shared<Post>(std::move(post));
+        linkComments(resident->hot);
+
+        std::vector<std::shared_ptr<Post>> dropped;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Id id = entries_.size();
+        entries_.emplace_back();
+        Entry& entry = entries_.back();
+        entry.resident = std::move(resident);
+        entry.period = period_;
+        entry.hits = 1;
+        if (dictionary == nullptr) {
+            collectSample(bytes);
+        }
+        enter(id, Tier::Hot);
+        enforceBudgets(dropped);
+        return id; // dropped is declared first, so it is destroyed after unlocking
+    }
+
+    // nullptr for an erased Post
+    std::shared_ptr<const Post> get(Id id) {
+        SMARTPOINTERCPP_LATENCY_SCOPE("TieredPostStore::get");
+        std::shared_ptr<Resident> resident;
+        std::string_view bytes;
+        size_t rawSize;
+        bool withDictionary;
+        bool promote;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            Entry& entry = entries_.at(id);
+            if (entry.tier == Tier::Gone) {
+                return nullptr;
+            }
+            touch(entry);
+            if (entry.tier == Tier::Hot) {
+                ++hotReads_;
+                return entry.resident->hot;
+            }
+            if (entry.tier == Tier::Warm) {
+                ++warmReads_;
+                resident = entry.resident; // Keeps the bytes alive even if the Post goes cold meanwhile
+                bytes = resident->packed;
+                rawSize = resident->rawSize;
+                withDictionary = resident->withDictionary;
+            } else {
+                ++coldReads_;
+                ByteReader record = coldRecord(entry); // Segments stay mapped while the store lives
+                rawSize = record.number();
+                withDictionary = record.number() != 0;
+                bytes = record.text();
+            }
+            promote = entry.hits >= options_.promoteAfter;
+        }
+
+        const LzDictionary* dictionary = dictionary_.load(std::memory_order_acquire);
+        std::string raw = withDictionary ? lzDecompress(bytes, rawSize, *dictionary) : lzDecompress(bytes, rawSize);
+        ByteReader reader(raw);
+        auto post = std::make_shared<Post>(deserializePost(reader));
+        linkComments(post);
+        if (!promote) {
+            return post;
+        }
+
+        std::vector<std::shared_ptr<Post>> dropped;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_[id];
+        if (entry.tier == Tier::Hot) {
+            return entry.resident->hot; // Another reader promoted it first
+        }
+        if (entry.tier == Tier::Gone) {
+            return post;
+        }
+        if (hotBytes_ + liveBytes(*post) > options_.hotBytes && !hotIds_.empty() &&
+            entries_[leastUsed(hotIds_)].hits >= entry.hits) {
+            return post; // Not used more than the hot Post it would push out
+        }
+        if (entry.resident == nullptr) {
+            // Cold, or gone cold while we unpacked: the bytes come back into RAM with the Post
+            entry.resident = std::make_shared<Resident>();
+            entry.resident->packed = std::string(bytes);
+            entry.resident->rawSize = static_cast<uint32_t>(rawSize);
+            entry.resident->withDictionary = withDictionary;
+        }
+        entry.resident->liveBytes = static_cast<uint32_t>(liveBytes(*post));
+        leave(id);
+        entry.resident->hot = post;
+        enter(id, Tier::Hot);
+        ++promotions_;
+        enforceBudgets(dropped);
+        return post;
+    }
+
+    void erase(Id id) {
+        std::shared_ptr<Resident> resident;
+        std::lock_guard<std::mutex> lock(mutex_);
+        Entry& entry = entries_.at(id);
+        if (entry.tier == Tier::Gone) {
+            return;
+        }
+        leave(id);
+        resident = std::move(entry.resident);
+        entry.tier = Tier::Gone;
+    }
+
+    Tier tier(Id id) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.at(id).tier;
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return hotIds_.size() + warmIds_.size() + cold_;
+    }
+
+    Stats stats() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Stats stats;
+        stats.hot = hotIds_.size();
+        stats.warm = warmIds_.size();
+        stats.cold = cold_;
+        stats.hotBytes = hotBytes_;
+        stats.warmBytes = warmBytes_;
+        stats.coldBytes = coldBytes_;
+        stats.indexBytes = entries_.size() * sizeof(Entry) + (hotIds_.capacity() + warmIds_.capacity()) * sizeof(Id);
+        stats.hotReads = hotReads_;
+        stats.warmReads = warmReads_;
+        stats.coldReads = coldReads_;
+        stats.promotions = promotions_;
+        stats.demotions = demotions_;
+        return stats;
+    }
+
+    // Estimated heap footprint of a live Post: the object, its strings and the comments with their control
+    // blocks. Comment text is counted in full, even where the text store shares it.
+    static size_t liveBytes(const Post& post) {
+        size_t bytes = sizeof(Post) + ControlBlock + post.comments.capacity() * sizeof(std::shared_ptr<Comment>);
+        if (post.content.size() > SmallString) {
+            bytes += post.content.capacity() + 1;
+        }
+        for (const auto& comment : post.comments) {
+            bytes += sizeof(Comment) + ControlBlock + comment->text.size();
+        }
+        return bytes;
+    }
+
+private:
+    static constexpr size_t SmallString = sizeof(std::string) - 1; // Roughly what fits without a heap buffer
+    static constexpr size_t ControlBlock = 2 * sizeof(void*);
+    static constexpr uint64_t NoLocation = UINT64_MAX;
+
+    // What a hot or warm Post keeps in RAM, shared with the readers unpacking it
+    struct Resident {
+        std::shared_ptr<Post> hot; // Hot only
+        std::string packed;        // The compressed serialized Post
+        uint32_t rawSize = 0;
+        uint32_t liveBytes = 0;
+        bool withDictionary = false; // Compressed against dictionary_
+
+        size_t bytes() const { return sizeof(Resident) + ControlBlock + (packed.size() > SmallString ? packed.capacity() + 1 : 0); }
+    };
+
+    // 32 bytes per Post, whatever its tier
+    struct Entry {
+        std::shared_ptr<Resident> resident; // Hot and warm
+        uint64_t location = NoLocation;     // Segment << 32 | offset, once written to the cold file; never changes
+        uint32_t slot = 0;                  // Position in hotIds_ or warmIds_
+        uint16_t period = 0;                // period_ when hits was last brought up to date
+        uint8_t hits = 0;
+        Tier tier = Tier::Gone;
+    };
+
+    struct Segment {
+        char* data;
+        size_t size;
+        size_t used;
+    };
+
+    // Called with the lock held, until there is a dictionary. Made once, it never changes afterwards:
+    // an add() that saw no dictionary before it took the lock may still get here after it was made.
+    void collectSample(const std::string& bytes) {
+        if (options_.dictionaryBytes == 0 || dictionaryOwner_ != nullptr) {
+            return;
+        }
+        samples_.append(bytes);
+        if (samples_.size() >= options_.dictionaryBytes) {
+            dictionaryOwner_ = std::make_unique<const LzDictionary>(samples_);
+            dictionary_.store(dictionaryOwner_.get(), std::memory_order_release);
+            samples_.clear();
+            samples_.shrink_to_fit();
+        }
+    }
+
+    // Halves the counter once for every period passed since it was last touched
+    void age(Entry& entry) {
+        auto periods = static_cast<uint16_t>(period_ - entry.period);
+        entry.hits = periods >= 8 ? 0 : static_cast<uint8_t>(entry.hits >> periods);
+        entry.period = period_;
+    }
+
+    void touch(Entry& entry) {
+        age(entry);
+        if (entry.hits < UINT8_MAX) {
+            ++entry.hits;
+        }
+        if (++accesses_ >= std::max<size_t>(entries_.size(), 1024)) {
+            accesses_ = 0;
+            ++period_;
+        }
+    }
+
+    void enter(Id id, Tier tier) {
+        Entry& entry = entries_[id];
+        entry.tier = tier;
+        if (tier == Tier::Hot) {
+            entry.slot = static_cast<uint32_t>(hotIds_.size());
+            hotIds_.push_back(id);
+            hotBytes_ += entry.resident->liveBytes + entry.resident->bytes();
+        } else if (tier == Tier::Warm) {
+            entry.slot = static_cast<uint32_t>(warmIds_.size());
+            warmIds_.push_back(id);
+            warmBytes_ += entry.resident->bytes();
+        } else {
+            ++cold_;
+        }
+    }
+
+    void leave(Id id) {
+        Entry& entry = entries_[id];
+        if (entry.tier == Tier::Hot) {
+            removeSlot(hotIds_, entry.slot);
+            hotBytes_ -= entry.resident->liveBytes + entry.resident->bytes();
+        } else if (entry.tier == Tier::Warm) {
+            removeSlot(warmIds_, entry.slot);
+            warmBytes_ -= entry.resident->bytes();
+        } else {
+            --cold_;
+        }
+    }
+
+    void removeSlot(std::vector<Id>& ids, uint32_t slot) {
+        ids[slot] = ids.back();
+        entries_[ids[slot]].slot = slot;
+        ids.pop_back();
+    }
+
+    // Demoted live Posts go to dropped, the caller destroys them after unlocking
+    void enforceBudgets(std::vector<std::shared_ptr<Post>>& dropped) {
+        while (hotBytes_ > options_.hotBytes && !hotIds_.empty()) {
+            Id id = leastUsed(hotIds_);
+            leave(id);
+            dropped.push_back(std::move(entries_[id].resident->hot));
+            enter(id, Tier::Warm);
+            ++demotions_;
+        }
+        while (warmBytes_ > options_.warmBytes && !warmIds_.empty()) {
+            Id id = leastUsed(warmIds_);
+            Entry& entry = entries_[id];
+            if (entry.location == NoLocation) {
+                writeCold(entry);
+            }
+            leave(id);
+            entry.resident.reset(); // Readers still unpacking it hold their own reference
+            enter(id, Tier::Cold);
+            ++demotions_;
+        }
+    }
+
+    Id leastUsed(const std::vector<Id>& ids) {
+        Id best = ids[nextRandom() % ids.size()];
+        age(entries_[best]);
+        for (size_t i = 1; i < options_.sampleSize; ++i) {
+            Id candidate = ids[nextRandom() % ids.size()];
+            age(entries_[candidate]);
+            if (entries_[candidate].hits < entries_[best].hits) {
+                best = candidate;
+            }
+        }
+        return best;
+    }
+
+    uint64_t nextRandom() {
+        random_ ^= random_ << 13;
+        random_ ^= random_ >> 7;
+        random_ ^= random_ << 17;
+        return random_;
+    }
+
+    // A record is the raw size, the dictionary flag and the compressed bytes, see ByteWriter
+    void writeCold(Entry& entry) {
+        std::string record;
+        ByteWriter writer(record);
+        writer.number(entry.resident->rawSize);
+        writer.number(entry.resident->withDictionary);
+        writer.text(entry.resident->packed);
+        if (segments_.empty() || segments_.back().size - segments_.back().used < record.size()) {
+            addSegment(std::max(SegmentSize, record.size()));
+        }
+        Segment& segment = segments_.back();
+        std::memcpy(segment.data + segment.used, record.data(), record.size());
+        entry.location = uint64_t{segments_.size() - 1} << 32 | segment.used;
+        segment.used += record.size();
+        coldBytes_ += record.size();
+    }
+
+    ByteReader coldRecord(const Entry& entry) const {
+        const Segment& segment = segments_[entry.location >> 32];
+        size_t offset = entry.location & UINT32_MAX;
+        return ByteReader(std::string_view(segment.data + offset, segment.used - offset));
+    }
+
+    void addSegment(size_t size) {
+#if defined(_WIN32)
+        segments_.push_back(Segment{new char[size], size, 0});
+#else
+        auto page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        size = (size + page - 1) / page * page;
+        if (ftruncate(fd_, static_cast<off_t>(fileSize_ + size)) != 0) {
+            throw std::runtime_error("TieredPostStore: cannot grow " + path_);
+        }
+        void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(fileSize_));
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("TieredPostStore: cannot map " + path_);
+        }
+        fileSize_ += size;
+        segments_.push_back(Segment{static_cast<char*>(data), size, 0});
+#endif
+    }
+
+    std::string path_;
+    TieredStoreOptions options_;
+    mutable std::mutex mutex_;
+    std::deque<Entry> entries_; // Indexed by Id, grows without moving or doubling
+    std::vector<Id> hotIds_;
+    std::vector<Id> warmIds_;
+    size_t cold_ = 0;
+    size_t hotBytes_ = 0;
+    size_t warmBytes_ = 0;
+    size_t coldBytes_ = 0;
+    size_t accesses_ = 0;
+    uint16_t period_ = 0;
+    uint64_t random_ = 0x9e3779b97f4a7c15ull;
+    size_t hotReads_ = 0;
+    size_t warmReads_ = 0;
+    size_t coldReads_ = 0;
+    size_t promotions_ = 0;
+    size_t demotions_ = 0;
+    std::deque<Segment> segments_; // Never moved: readers outside the lock hold pointers into the data
+    std::string samples_;          // Serialized Posts collected for the dictionary
+    std::unique_ptr<const LzDictionary> dictionaryOwner_;
+    std::atomic<const LzDictionary*> dictionary_{nullptr};
+#if !defined(_WIN32)
+    int fd_ = -1;
+    size_t fileSize_ = 0;
+#endif
+};
+
+#endif //SMARTPOINTERCPP_TIERED_STORE_H
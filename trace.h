@@ -0,0 +1,502 @@
+#ifndef SMARTPOINTERCPP_TRACE_H
+#define SMARTPOINTERCPP_TRACE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "factories.h"
+#include "models.h"
+#include "serialization.h"
+#include "slab_resource.h"
+
+/*
+ *  Recording what a program does with its smart pointers, and doing it again against another backend.
+ *
+ *      TraceRecorder recorder;
+ *      {
+ *          TraceRecorder::Thread trace(recorder);                  // One per recording thread
+ *          auto post = std::make_shared<Post>(Post{"Holiday", {}, 1});
+ *          trace.create(&post, post->content.size());
+ *          std::weak_ptr<Post> watcher = post;
+ *          trace.observe(&watcher, &post);
+ *          if (auto locked = watcher.lock()) {
+ *              trace.lock(&locked, &watcher);
+ *              ...
+ *              trace.reset(&locked);                               // Before it goes out of scope
+ *          }
+ *      }
+ *      recorder.trace().save("feed.trace");
+ *
+ *      SlabOwnership slab;
+ *      ReplayResult result = replayTrace(Trace::load("feed.trace"), slab);
+ *
+ *  The recorder calls sit next to the operations they describe: create, copy (a new owner), observe (a
+ *  weak_ptr taken), lock (weak_ptr::lock), reset (an owner or observer dropped) and append (a Comment
+ *  added to the Post). A move is a copy followed by a reset of the source.
+ *
+ *  Operations name the smart pointer variables they act on by address (the handle), not the objects.
+ *  Each Thread gives every live handle a small number, a slot, and reuses the slot after reset, so a
+ *  replay needs a table as large as the most handles alive at once. A handle this Thread has not seen
+ *  (never created, or from another thread) is slot 0, which is always empty. Assigning to a handle
+ *  that has a slot keeps the slot: the replay assigns too, which releases what the slot held.
+ *
+ *  A Thread encodes every operation into its own buffer, no lock and no allocation per operation, the
+ *  handles are looked up in a flat hash table; the recorder takes the buffer over when the Thread is destroyed.
+ *  The format is the varints of serialization.h, operation and slot in the first number, then the
+ *  source slot or size in bytes: two to four bytes per operation.
+ *
+ *  replayTrace runs the operations of every recorded thread on a thread of its own, all starting at
+ *  once and as fast as they can, with a slot table per thread. Objects are not shared between recorded
+ *  threads: replaying a handover would need the original interleaving.
+ *
+ *  A backend is any class with
+ *      using Strong = ...;  using Weak = ...;                 // Default constructed empty, Strong tests as bool
+ *      std::string name() const;
+ *      Strong create(uint32_t bytes);                         // A Post with content of that size
+ *      Strong copy(const Strong& from);
+ *      Weak observe(const Strong& from);
+ *      Strong lock(const Weak& from);
+ *      void append(const Strong& post, uint32_t bytes);       // A Comment with text of that size
+ *  Resets assign Strong{} and Weak{}. Backends are used by several threads at once.
+ */
+
+enum class TraceOp : uint8_t { Create, Copy, Observe, Lock, Reset, Append };
+
+struct TraceEvent {
+    TraceOp op;
+    uint32_t slot;
+    uint32_t source; // Copy, Observe, Lock: slot read from
+    uint32_t size;   // Create, Append: bytes
+};
+
+class Trace {
+public:
+    static constexpr char Magic[8] = {'S', 'P', 'T', 'R', 'A', 'C', 'E', '1'};
+
+    // The encoded operations of one recorded thread
+    struct Thread {
+        uint64_t events = 0;
+        std::string bytes;
+    };
+
+    std::vector<Thread> threads;
+
+    size_t events() const {
+        size_t total = 0;
+        for (const auto& thread : threads) {
+            total += thread.events;
+        }
+        return total;
+    }
+
+    size_t bytes() const {
+        size_t total = 0;
+        for (const auto& thread : threads) {
+            total += thread.bytes.size();
+        }
+        return total;
+    }
+
+    // Operations of thread t; throws std::runtime_error for a damaged trace
+    std::vector<TraceEvent> decode(size_t t) const {
+        const Thread& thread = threads.at(t);
+        std::vector<TraceEvent> events;
+        events.reserve(std::min<size_t>(thread.events, thread.bytes.size() / 2));
+        ByteReader reader(thread.bytes);
+        while (!reader.done()) {
+            uint64_t first = reader.number();
+            // Every slot was new in an earlier operation, so none is above the number of operations
+            if ((first & 7) > static_cast<uint64_t>(TraceOp::Append) || (first >> 3) > thread.bytes.size()) {
+                throw std::runtime_error("Trace: bad operation");
+            }
+            TraceEvent event{static_cast<TraceOp>(first & 7), static_cast<uint32_t>(first >> 3), 0, 0};
+            if (event.op != TraceOp::Reset) {
+                uint64_t second = reader.number();
+                bool size = event.op == TraceOp::Create || event.op == TraceOp::Append;
+                if (second > (size ? uint64_t{UINT32_MAX} : uint64_t{thread.bytes.size()})) {
+                    throw std::runtime_error("Trace: bad operand");
+                }
+                (size ? event.size : event.source) = static_cast<uint32_t>(second);
+            }
+            events.push_back(event);
+        }
+        if (events.size() != thread.events) {
+            throw std::runtime_error("Trace: wrong number of operations");
+        }
+        return events;
+    }
+
+    void save(const std::string& path) const {
+        std::string header;
+        ByteWriter writer(header);
+        writer.number(threads.size());
+        for (const auto& thread : threads) {
+            writer.number(thread.events);
+            writer.number(thread.bytes.size());
+        }
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(Magic, sizeof(Magic));
+        out.write(header.data(), static_cast<std::streamsize>(header.size()));
+        for (const auto& thread : threads) {
+            out.write(thread.bytes.data(), static_cast<std::streamsize>(thread.bytes.size()));
+        }
+        if (!out.flush()) {
+            throw std::runtime_error("Trace: cannot write " + path);
+        }
+    }
+
+    static Trace load(const std::string& path) {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            throw std::runtime_error("Trace: cannot open " + path);
+        }
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        if (data.compare(0, sizeof(Magic), Magic, sizeof(Magic)) != 0) {
+            throw std::runtime_error("Trace: not a trace " + path);
+        }
+        ByteReader reader(std::string_view(data).substr(sizeof(Magic)));
+        Trace trace;
+        uint64_t threads = reader.number();
+        if (threads > reader.remaining()) {
+            throw std::runtime_error("Trace: bad header");
+        }
+        std::vector<uint64_t> sizes;
+        for (uint64_t t = 0; t < threads; ++t) {
+            trace.threads.push_back(Thread{reader.number(), {}});
+            sizes.push_back(reader.number());
+        }
+        size_t position = sizeof(Magic) + reader.position();
+        for (uint64_t t = 0; t < threads; ++t) {
+            if (sizes[t] > data.size() - position) {
+                throw std::runtime_error("Trace: file too short");
+            }
+            trace.threads[t].bytes.assign(data, position, sizes[t]);
+            position += sizes[t];
+        }
+        return trace;
+    }
+};
+
+namespace trace {
+
+// Handle -> slot, open addressing with linear probing: lookups and erases allocate nothing
+class SlotTable {
+public:
+    SlotTable() : entries_(64) {}
+
+    // 0 when handle has no slot
+    uint32_t find(const void* handle) const {
+        for (size_t i = home(handle);; i = (i + 1) & mask()) {
+            if (entries_[i].handle == handle || entries_[i].handle == nullptr) {
+                return entries_[i].slot;
+            }
+        }
+    }
+
+    // The slot of handle, or a new one from next
+    template<typename Next>
+    uint32_t findOrAdd(const void* handle, Next next) {
+        size_t i = home(handle);
+        for (; entries_[i].handle != nullptr; i = (i + 1) & mask()) {
+            if (entries_[i].handle == handle) {
+                return entries_[i].slot;
+            }
+        }
+        uint32_t slot = next();
+        entries_[i] = Entry{handle, slot};
+        if (++size_ * 2 > entries_.size()) {
+            grow();
+        }
+        return slot;
+    }
+
+    // The slot handle had, 0 when none
+    uint32_t erase(const void* handle) {
+        size_t i = home(handle);
+        for (; entries_[i].handle != handle; i = (i + 1) & mask()) {
+            if (entries_[i].handle == nullptr) {
+                return 0;
+            }
+        }
+        uint32_t slot = entries_[i].slot;
+        // Backward shift: move later entries of the run into the hole, no tombstones
+        for (size_t j = (i + 1) & mask(); entries_[j].handle != nullptr; j = (j + 1) & mask()) {
+            size_t wanted = home(entries_[j].handle);
+            if (((j - wanted) & mask()) >= ((j - i) & mask())) {
+                entries_[i] = entries_[j];
+                i = j;
+            }
+        }
+        entries_[i] = Entry{};
+        --size_;
+        return slot;
+    }
+
+private:
+    struct Entry {
+        const void* handle = nullptr;
+        uint32_t slot = 0;
+    };
+
+    size_t mask() const { return entries_.size() - 1; }
+
+    size_t home(const void* handle) const {
+        auto bits = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(handle));
+        return static_cast<size_t>((bits * 0x9e3779b97f4a7c15ull) >> 32) & mask();
+    }
+
+    void grow() {
+        std::vector<Entry> old(entries_.size() * 2);
+        old.swap(entries_);
+        for (const auto& entry : old) {
+            if (entry.handle != nullptr) {
+                size_t i = home(entry.handle);
+                while (entries_[i].handle != nullptr) {
+                    i = (i + 1) & mask();
+                }
+                entries_[i] = entry;
+            }
+        }
+    }
+
+    std::vector<Entry> entries_;
+    size_t size_ = 0;
+};
+
+} // namespace trace
+
+class TraceRecorder {
+public:
+    class Thread;
+
+    // Everything the Threads destroyed so far have recorded, one Trace::Thread each
+    Trace trace() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Trace trace;
+        for (const auto& thread : threads_) {
+            if (thread.events > 0) {
+                trace.threads.push_back(thread);
+            }
+        }
+        return trace;
+    }
+
+private:
+    size_t attach() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_.emplace_back();
+        return threads_.size() - 1;
+    }
+
+    void handOver(size_t index, Trace::Thread thread) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        threads_[index] = std::move(thread);
+    }
+
+    mutable std::mutex mutex_;
+    std::vector<Trace::Thread> threads_;
+};
+
+// Records the operations of one thread, see TraceRecorder. Not shared between threads.
+class TraceRecorder::Thread {
+public:
+    explicit Thread(TraceRecorder& recorder) : recorder_(recorder), index_(recorder.attach()), writer_(thread_.bytes) {}
+
+    Thread(const Thread&) = delete;
+    Thread& operator=(const Thread&) = delete;
+
+    ~Thread() { recorder_.handOver(index_, std::move(thread_)); }
+
+    void create(const void* handle, size_t bytes) { put(TraceOp::Create, slotFor(handle), clamp(bytes)); }
+    void copy(const void* to, const void* from) { put(TraceOp::Copy, slotFor(to), slotOf(from)); }
+    void observe(const void* to, const void* from) { put(TraceOp::Observe, slotFor(to), slotOf(from)); }
+    void lock(const void* to, const void* from) { put(TraceOp::Lock, slotFor(to), slotOf(from)); }
+    void append(const void* handle, size_t bytes) { put(TraceOp::Append, slotOf(handle), clamp(bytes)); }
+
+    void reset(const void* handle) {
+        uint32_t slot = slots_.erase(handle);
+        if (slot == 0) {
+            return; // Never held anything we know of
+        }
+        writer_.number(static_cast<uint64_t>(slot) << 3 | static_cast<uint64_t>(TraceOp::Reset));
+        ++thread_.events;
+        free_.push_back(slot);
+    }
+
+private:
+    static uint32_t clamp(size_t bytes) { return static_cast<uint32_t>(std::min<size_t>(bytes, UINT32_MAX)); }
+
+    void put(TraceOp op, uint32_t slot, uint32_t operand) {
+        writer_.number(static_cast<uint64_t>(slot) << 3 | static_cast<uint64_t>(op));
+        writer_.number(operand);
+        ++thread_.events;
+    }
+
+    uint32_t slotOf(const void* handle) const { return slots_.find(handle); }
+
+    uint32_t slotFor(const void* handle) {
+        return slots_.findOrAdd(handle, [this] {
+            if (free_.empty()) {
+                return next_++;
+            }
+            uint32_t slot = free_.back();
+            free_.pop_back();
+            return slot;
+        });
+    }
+
+    TraceRecorder& recorder_;
+    size_t index_;
+    Trace::Thread thread_;
+    ByteWriter writer_;
+    trace::SlotTable slots_;
+    std::vector<uint32_t> free_;
+    uint32_t next_ = 1; // Slot 0 stays empty
+};
+
+struct ReplayResult {
+    std::string backend;
+    size_t events = 0;
+    size_t threads = 0;
+    size_t locks = 0;
+    size_t lockFailures = 0; // lock() that returned an empty Strong
+    double seconds = 0;
+
+    double throughput() const { return seconds == 0 ? 0 : double(events) / seconds; }
+};
+
+// Replays trace against backend, one thread per recorded thread, all starting together
+template<typename Backend>
+ReplayResult replayTrace(const Trace& trace, Backend& backend) {
+    using Clock = std::chrono::steady_clock;
+    struct Slot {
+        typename Backend::Strong strong{};
+        typename Backend::Weak weak{};
+    };
+
+    // Decoded up front, so the replay measures the backend and not the varints
+    std::vector<std::vector<TraceEvent>> threads;
+    std::vector<uint32_t> slotCounts;
+    for (size_t t = 0; t < trace.threads.size(); ++t) {
+        threads.push_back(trace.decode(t));
+        uint32_t highest = 0;
+        for (const auto& event : threads.back()) {
+            highest = std::max({highest, event.slot, event.op == TraceOp::Create || event.op == TraceOp::Append ? 0 : event.source});
+        }
+        slotCounts.push_back(highest + 1);
+    }
+
+    ReplayResult result;
+    result.backend = backend.name();
+    result.threads = threads.size();
+    result.events = trace.events();
+    std::vector<size_t> locks(threads.size()), lockFailures(threads.size());
+    std::atomic<size_t> waiting{threads.size()};
+    auto worker = [&](size_t t) {
+        std::vector<Slot> slots(slotCounts[t]);
+        size_t locked = 0, failed = 0;
+        waiting.fetch_sub(1);
+        while (waiting.load() != 0) {
+            std::this_thread::yield(); // Everybody starts at once
+        }
+        for (const auto& event : threads[t]) {
+            Slot& slot = slots[event.slot];
+            switch (event.op) {
+                case TraceOp::Create:
+                    slot.strong = backend.create(event.size);
+                    break;
+                case TraceOp::Copy:
+                    slot.strong = backend.copy(slots[event.source].strong);
+                    break;
+                case TraceOp::Observe:
+                    slot.weak = backend.observe(slots[event.source].strong);
+                    break;
+                case TraceOp::Lock:
+                    slot.strong = backend.lock(slots[event.source].weak);
+                    ++locked;
+                    failed += slot.strong ? 0 : 1;
+                    break;
+                case TraceOp::Reset:
+                    slot.strong = typename Backend::Strong{};
+                    slot.weak = typename Backend::Weak{};
+                    break;
+                case TraceOp::Append:
+                    if (slot.strong) {
+                        backend.append(slot.strong, event.size);
+                    }
+                    break;
+            }
+        }
+        locks[t] = locked;
+        lockFailures[t] = failed;
+        // The slots still holding objects are released here, which is part of the run
+    };
+
+    auto start = Clock::now();
+    std::vector<std::thread> workers;
+    for (size_t t = 1; t < threads.size(); ++t) {
+        workers.emplace_back(worker, t);
+    }
+    if (!threads.empty()) {
+        worker(0);
+    }
+    for (auto& thread : workers) {
+        thread.join();
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    for (size_t t = 0; t < threads.size(); ++t) {
+        result.locks += locks[t];
+        result.lockFailures += lockFailures[t];
+    }
+    return result;
+}
+
+// std::make_shared, the way models.h builds Posts
+class SharedOwnership {
+public:
+    using Strong = std::shared_ptr<Post>;
+    using Weak = std::weak_ptr<Post>;
+
+    std::string name() const { return "std::make_shared"; }
+
+    Strong create(uint32_t bytes) { return std::make_shared<Post>(Post{text(bytes), {}, 0}); }
+    Strong copy(const Strong& from) { return from; }
+    Weak observe(const Strong& from) { return from; }
+    Strong lock(const Weak& from) { return from.lock(); }
+
+    void append(const Strong& post, uint32_t bytes) {
+        post->comments.push_back(std::make_shared<Comment>(Comment{text(bytes), post}));
+    }
+
+protected:
+    static std::string text(uint32_t bytes) { return std::string(std::min<uint32_t>(bytes, 4096), 'x'); }
+};
+
+// Posts and Comments in a SlabResource (slab_resource.h) through makeSharedIn (factories.h)
+class SlabOwnership : public SharedOwnership {
+public:
+    std::string name() const { return "makeSharedIn + SlabResource"; }
+
+    Strong create(uint32_t bytes) { return makeSharedIn<Post>(slab_, Post{text(bytes), {}, 0}); }
+
+    void append(const Strong& post, uint32_t bytes) {
+        post->comments.push_back(makeSharedIn<Comment>(slab_, Comment{text(bytes), post}));
+    }
+
+private:
+    SlabResource slab_;
+};
+
+#endif //SMARTPOINTERCPP_TRACE_H
@@ -0,0 +1,286 @@
+#ifndef SMARTPOINTERCPP_WORKLOAD_H
+#define SMARTPOINTERCPP_WORKLOAD_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "latency_histogram.h"
+#include "models.h"
+
+/*
+ *  A synthetic social graph and a read/write load on it, to compare storage backends for Posts.
+ *
+ *      WorkloadOptions options;                        // 100000 Posts, 90% reads, 4 threads, ...
+ *      SocialGraph graph = generateGraph(options);
+ *      WorkloadPlan plan = generateOperations(options);
+ *      SharedPtrBackend backend;                       // workload_backends.h, or your own
+ *      backend.load(graph);
+ *      WorkloadResult result = runWorkload(backend, plan, graph);
+ *      std::cout << result.throughput() << " ops/s, p99 " << result.p99 << " us";
+ *
+ *  Like the Post/Comment example: Persons write Posts, Posts collect Comments. A read fetches a Post,
+ *  its author and all its comments; a write appends a comment. Which Post an operation touches follows
+ *  a Zipf distribution (a few Posts get most of the traffic, like a feed), and the most popular Posts are
+ *  spread over the id range, not the first ones.
+ *
+ *  The operations are generated up front, one list per thread, from the seed: the same options give the
+ *  same load, and generating them is not part of the measured time. Every operation is timed on its
+ *  own into a LatencyHistogram (latency_histogram.h) for the percentiles.
+ *
+ *  A backend is any class with
+ *      std::string name() const;
+ *      void load(const SocialGraph& graph);                // Before the run
+ *      size_t read(size_t post);                           // Post, author name and comment text; any checksum of them
+ *      void comment(size_t post, const std::string& text); // Safe to call from several threads, also with reads
+ *      static constexpr bool Writable;                     // false: runWorkload refuses plans with writes
+ */
+
+struct WorkloadOptions {
+    size_t persons = 10000;
+    size_t posts = 100000;
+    size_t commentsPerPost = 8; // On average, each Post gets 0 to twice as many
+    double zipfExponent = 0.99; // Skew of Post popularity, 0 is uniform
+    unsigned readPercent = 90;  // The rest are comment writes
+    size_t threads = 4;
+    size_t operations = 1000000; // Over all threads
+    uint64_t seed = 42;
+};
+
+// Samples ranks 0 (most popular) to n - 1 with probability proportional to 1 / (rank + 1)^exponent.
+// Rejection inversion (Hörmann and Derflinger): O(1) per sample and no table, whatever n is.
+class ZipfDistribution {
+public:
+    ZipfDistribution(size_t n, double exponent) : n_(static_cast<double>(n)), exponent_(exponent) {
+        if (n == 0 || exponent < 0) {
+            throw std::invalid_argument("ZipfDistribution: needs n > 0 and exponent >= 0");
+        }
+        hIntegralX1_ = hIntegral(1.5) - 1.0;
+        hIntegralN_ = hIntegral(n_ + 0.5);
+        s_ = 2.0 - hIntegralInverse(hIntegral(2.5) - h(2.0));
+    }
+
+    template<typename Random>
+    size_t operator()(Random& random) const {
+        std::uniform_real_distribution<double> uniform(0.0, 1.0);
+        for (;;) {
+            double u = hIntegralN_ + uniform(random) * (hIntegralX1_ - hIntegralN_);
+            double x = hIntegralInverse(u);
+            double k = std::min(n_, std::max(1.0, std::floor(x + 0.5)));
+            if (k - x <= s_ || u >= hIntegral(k + 0.5) - h(k)) {
+                return static_cast<size_t>(k) - 1;
+            }
+        }
+    }
+
+private:
+    double h(double x) const { return std::exp(-exponent_ * std::log(x)); }
+
+    // Integral of h, and its inverse; the helpers keep them exact near exponent 1
+    double hIntegral(double x) const {
+        double logX = std::log(x);
+        return expm1OverX((1.0 - exponent_) * logX) * logX;
+    }
+
+    double hIntegralInverse(double x) const {
+        double t = std::max(-1.0, x * (1.0 - exponent_));
+        return std::exp(log1pOverX(t) * x);
+    }
+
+    static double log1pOverX(double x) { return std::abs(x) > 1e-8 ? std::log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x)); }
+    static double expm1OverX(double x) {
+        return std::abs(x) > 1e-8 ? std::expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+    }
+
+    double n_;
+    double exponent_;
+    double hIntegralX1_;
+    double hIntegralN_;
+    double s_;
+};
+
+struct SocialGraph {
+    std::vector<std::shared_ptr<Person>> persons; // Person::id is the index
+    std::vector<std::shared_ptr<Post>> posts;     // Post::authorId is a Person::id
+    std::vector<std::string> phrases;             // Texts of the comments the writes add
+};
+
+struct WorkloadOperation {
+    enum Kind : uint8_t { Read, Comment };
+
+    Kind kind;
+    uint32_t phrase; // Index in SocialGraph::phrases, for Comment
+    uint64_t post;
+};
+
+struct WorkloadPlan {
+    std::vector<std::vector<WorkloadOperation>> threads; // The operations of every thread, in order
+
+    size_t size() const {
+        size_t total = 0;
+        for (const auto& operations : threads) {
+            total += operations.size();
+        }
+        return total;
+    }
+};
+
+struct WorkloadResult {
+    std::string backend;
+    size_t operations = 0;
+    size_t reads = 0;
+    size_t writes = 0;
+    size_t threads = 0;
+    double seconds = 0;
+    double p50 = 0, p90 = 0, p99 = 0, p999 = 0, max = 0; // Latency of one operation, microseconds
+    size_t checksum = 0; // Sum of what the reads returned, so they can not be optimized away
+
+    double throughput() const { return seconds == 0 ? 0 : double(operations) / seconds; }
+};
+
+namespace workload {
+
+// Comment-like text of minWords to maxWords words; the generated graph and the benches all use this one word list
+inline std::string sentence(std::mt19937_64& random, size_t minWords, size_t maxWords) {
+    static const char* words[] = {"I", "like", "it", "beautiful", "shot", "where", "was", "this", "taken",
+                                  "amazing", "colors", "love", "the", "light", "great", "photo", "wow", "so",
+                                  "nice", "thanks", "for", "sharing", "what", "camera", "did", "you", "use",
+                                  "stunning", "view", "!"};
+    std::string text;
+    for (size_t w = minWords + random() % (maxWords - minWords + 1); w > 0; --w) {
+        text += words[random() % (sizeof(words) / sizeof(words[0]))];
+        text += w > 1 ? " " : ".";
+    }
+    return text;
+}
+
+} // namespace workload
+
+inline SocialGraph generateGraph(const WorkloadOptions& options) {
+    std::mt19937_64 random(options.seed);
+    SocialGraph graph;
+    size_t persons = std::max<size_t>(1, options.persons);
+    graph.persons.reserve(persons);
+    for (size_t i = 0; i < persons; ++i) {
+        graph.persons.push_back(std::make_shared<Person>(
+                Person{"Person " + std::to_string(i), std::to_string(1 + random() % 999) + " London St", 18 + random() % 60, i}));
+    }
+    ZipfDistribution authors(persons, 0.8); // Some Persons write much more than others
+    graph.posts.reserve(options.posts);
+    for (size_t i = 0; i < options.posts; ++i) {
+        auto post = std::make_shared<Post>(Post{workload::sentence(random, 4, 12), {}, authors(random)});
+        size_t comments = options.commentsPerPost == 0 ? 0 : random() % (2 * options.commentsPerPost + 1);
+        for (size_t c = 0; c < comments; ++c) {
+            post->comments.push_back(std::make_shared<Comment>(Comment{workload::sentence(random, 2, 10), post}));
+        }
+        graph.posts.push_back(std::move(post));
+    }
+    for (size_t i = 0; i < 256; ++i) {
+        graph.phrases.push_back(workload::sentence(random, 2, 10));
+    }
+    return graph;
+}
+
+inline WorkloadPlan generateOperations(const WorkloadOptions& options) {
+    if (options.posts == 0 || options.threads == 0) {
+        throw std::invalid_argument("generateOperations: needs Posts and threads");
+    }
+    std::mt19937_64 random(options.seed + 1);
+    // Popularity rank -> Post, so the popular Posts are scattered over the ids
+    std::vector<uint64_t> byRank(options.posts);
+    std::iota(byRank.begin(), byRank.end(), 0);
+    std::shuffle(byRank.begin(), byRank.end(), random);
+    ZipfDistribution popularity(options.posts, options.zipfExponent);
+
+    WorkloadPlan plan;
+    plan.threads.resize(options.threads);
+    for (size_t t = 0; t < options.threads; ++t) {
+        std::mt19937_64 threadRandom(options.seed + 2 + t);
+        size_t count = options.operations / options.threads + (t < options.operations % options.threads ? 1 : 0);
+        auto& operations = plan.threads[t];
+        operations.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            bool read = threadRandom() % 100 < options.readPercent;
+            operations.push_back(WorkloadOperation{read ? WorkloadOperation::Read : WorkloadOperation::Comment,
+                                                   static_cast<uint32_t>(threadRandom() % 256), byRank[popularity(threadRandom)]});
+        }
+    }
+    return plan;
+}
+
+// Runs plan against backend, one thread per operation list, all starting together
+template<typename Backend>
+WorkloadResult runWorkload(Backend& backend, const WorkloadPlan& plan, const SocialGraph& graph) {
+    using Clock = std::chrono::steady_clock;
+    WorkloadResult result;
+    result.backend = backend.name();
+    result.threads = plan.threads.size();
+    for (const auto& operations : plan.threads) {
+        for (const auto& operation : operations) {
+            (operation.kind == WorkloadOperation::Read ? result.reads : result.writes) += 1;
+        }
+    }
+    result.operations = result.reads + result.writes;
+    if (result.writes > 0 && !Backend::Writable) {
+        throw std::invalid_argument("runWorkload: " + result.backend + " does not take writes");
+    }
+
+    LatencyHistogram latencies; // Nanoseconds
+    std::vector<size_t> checksums(plan.threads.size());
+    std::atomic<size_t> waiting{plan.threads.size()};
+    Clock::time_point start; // Taken by the last thread to arrive, thread start up is not timed
+    auto worker = [&](size_t t) {
+        const auto& operations = plan.threads[t];
+        size_t checksum = 0;
+        if (waiting.fetch_sub(1) == 1) {
+            start = Clock::now();
+        }
+        while (waiting.load() != 0) {
+            std::this_thread::yield(); // Everybody starts at once
+        }
+        for (size_t i = 0; i < operations.size(); ++i) {
+            const auto& operation = operations[i];
+            auto begin = Clock::now();
+            if (operation.kind == WorkloadOperation::Read) {
+                checksum += backend.read(operation.post);
+            } else {
+                backend.comment(operation.post, graph.phrases[operation.phrase]);
+            }
+            latencies.record(Clock::now() - begin);
+        }
+        checksums[t] = checksum;
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < plan.threads.size(); ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    result.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (size_t checksum : checksums) {
+        result.checksum += checksum;
+    }
+    auto snapshot = latencies.snapshot();
+    result.p50 = double(snapshot.percentile(50)) / 1e3;
+    result.p90 = double(snapshot.percentile(90)) / 1e3;
+    result.p99 = double(snapshot.percentile(99)) / 1e3;
+    result.p999 = double(snapshot.percentile(99.9)) / 1e3;
+    result.max = double(snapshot.max()) / 1e3;
+    return result;
+}
+
+#endif //SMARTPOINTERCPP_WORKLOAD_H
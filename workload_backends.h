@@ -0,0 +1,199 @@
+#ifndef SMARTPOINTERCPP_WORKLOAD_BACKENDS_H
+#define SMARTPOINTERCPP_WORKLOAD_BACKENDS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "models.h"
+#include "snapshot.h"
+#include "tiered_store.h"
+#include "workload.h"
+
+/*
+ *  Storage backends for the workload driver (workload.h).
+ *
+ *      SharedPtrBackend      std::shared_ptr<Post> per Post, a reader-writer lock per stripe of Posts
+ *      CopyOnWriteBackend    readers load an atomic std::shared_ptr<const Post>, writers publish a copy
+ *      TieredBackend         TieredPostStore (tiered_store.h), read only
+ *      SnapshotBackend       Snapshot (snapshot.h), read only
+ *
+ *  load() copies the Posts of the graph, so the writes of one backend do not show up in the next one.
+ *  The copies share the Comments of the graph, which nobody changes; TieredBackend makes its own,
+ *  because the store points their Comment::post to its copy.
+ */
+
+namespace workload {
+
+constexpr size_t Stripes = 64;
+
+// One lock per stripe of Posts: threads touching different Posts rarely share a lock
+template<typename Mutex>
+struct alignas(64) Stripe {
+    Mutex mutex;
+};
+
+inline std::vector<std::shared_ptr<Post>> copyPosts(const SocialGraph& graph) {
+    std::vector<std::shared_ptr<Post>> posts;
+    posts.reserve(graph.posts.size());
+    for (const auto& post : graph.posts) {
+        posts.push_back(std::make_shared<Post>(*post));
+    }
+    return posts;
+}
+
+// A Post with Comments of its own, for stores that link the comments to their copy
+inline Post deepCopy(const Post& post) {
+    Post copy{post.content, {}, post.authorId};
+    copy.comments.reserve(post.comments.size());
+    for (const auto& comment : post.comments) {
+        copy.comments.push_back(std::make_shared<Comment>(Comment{comment->text, {}}));
+    }
+    return copy;
+}
+
+inline size_t readPost(const Post& post, const std::vector<std::shared_ptr<Person>>& persons) {
+    size_t checksum = post.content.size() + persons[post.authorId]->name.size();
+    for (const auto& comment : post.comments) {
+        checksum += comment->text.size();
+    }
+    return checksum;
+}
+
+} // namespace workload
+
+class SharedPtrBackend {
+public:
+    static constexpr bool Writable = true;
+
+    std::string name() const { return "shared_ptr + shared_mutex"; }
+
+    void load(const SocialGraph& graph) {
+        persons_ = graph.persons;
+        posts_ = workload::copyPosts(graph);
+    }
+
+    size_t read(size_t post) {
+        std::shared_lock<std::shared_mutex> lock(stripes_[post % workload::Stripes].mutex);
+        return workload::readPost(*posts_[post], persons_);
+    }
+
+    void comment(size_t post, const std::string& text) {
+        auto comment = std::make_shared<Comment>(Comment{text, posts_[post]});
+        std::unique_lock<std::shared_mutex> lock(stripes_[post % workload::Stripes].mutex);
+        posts_[post]->comments.push_back(std::move(comment));
+    }
+
+private:
+    std::vector<std::shared_ptr<Person>> persons_;
+    std::vector<std::shared_ptr<Post>> posts_;
+    std::array<workload::Stripe<std::shared_mutex>, workload::Stripes> stripes_;
+};
+
+// Reads never wait; a write copies the Post (its comment pointers, not the Comments). Comment::post of
+// earlier comments keeps pointing to the version they were added to.
+class CopyOnWriteBackend {
+public:
+    static constexpr bool Writable = true;
+
+    std::string name() const { return "copy on write (atomic shared_ptr)"; }
+
+    void load(const SocialGraph& graph) {
+        persons_ = graph.persons;
+        auto posts = workload::copyPosts(graph);
+        posts_.assign(posts.begin(), posts.end());
+    }
+
+    size_t read(size_t post) {
+        std::shared_ptr<const Post> current = std::atomic_load(&posts_[post]);
+        return workload::readPost(*current, persons_);
+    }
+
+    void comment(size_t post, const std::string& text) {
+        std::lock_guard<std::mutex> lock(stripes_[post % workload::Stripes].mutex); // One writer per Post
+        auto next = std::make_shared<Post>(*std::atomic_load(&posts_[post]));
+        next->comments.push_back(std::make_shared<Comment>(Comment{text, next}));
+        std::atomic_store(&posts_[post], std::shared_ptr<const Post>(std::move(next)));
+    }
+
+private:
+    std::vector<std::shared_ptr<Person>> persons_;
+    std::vector<std::shared_ptr<const Post>> posts_;
+    std::array<workload::Stripe<std::mutex>, workload::Stripes> stripes_;
+};
+
+class TieredBackend {
+public:
+    static constexpr bool Writable = false;
+
+    TieredBackend(std::string path, TieredStoreOptions options) : path_(std::move(path)), options_(options) {}
+
+    std::string name() const { return "TieredPostStore"; }
+
+    void load(const SocialGraph& graph) {
+        persons_ = graph.persons;
+        store_ = std::make_unique<TieredPostStore>(path_, options_);
+        ids_.clear();
+        ids_.reserve(graph.posts.size());
+        for (const auto& post : graph.posts) {
+            ids_.push_back(store_->add(workload::deepCopy(*post)));
+        }
+    }
+
+    size_t read(size_t post) { return workload::readPost(*store_->get(ids_[post]), persons_); }
+
+    void comment(size_t, const std::string&) {}
+
+    const TieredPostStore& store() const { return *store_; }
+
+private:
+    std::string path_;
+    TieredStoreOptions options_;
+    std::vector<std::shared_ptr<Person>> persons_;
+    std::unique_ptr<TieredPostStore> store_;
+    std::vector<TieredPostStore::Id> ids_;
+};
+
+// The graph written to a snapshot file and mapped again, like a process starting from it
+class SnapshotBackend {
+public:
+    static constexpr bool Writable = false;
+
+    explicit SnapshotBackend(std::string path) : path_(std::move(path)) {}
+
+    ~SnapshotBackend() {
+        if (snapshot_ != nullptr) {
+            std::remove(path_.c_str());
+        }
+    }
+
+    std::string name() const { return "Snapshot"; }
+
+    void load(const SocialGraph& graph) {
+        writeSnapshot(path_, graph.persons, graph.posts);
+        snapshot_ = Snapshot::open(path_);
+    }
+
+    size_t read(size_t post) {
+        const SnapshotPost& record = snapshot_->posts()[post];
+        size_t checksum = record.content.size + (record.author != nullptr ? record.author->name.size : 0);
+        for (size_t c = 0; c < record.commentCount; ++c) {
+            checksum += record.comments[c].text.size;
+        }
+        return checksum;
+    }
+
+    void comment(size_t, const std::string&) {}
+
+private:
+    std::string path_;
+    std::shared_ptr<const Snapshot> snapshot_;
+};
+
+#endif //SMARTPOINTERCPP_WORKLOAD_BACKENDS_H